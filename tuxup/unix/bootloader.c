@@ -32,17 +32,26 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
-#include "usb-connection.h"
-#include "tux_hid_unix.h"
+#include "transport.h"
 #include "tux-api.h"
 #include "error.h"
 #include "log.h"
+#include "timer.h"
+#include "stats.h"
+#include "hex_image.h"
+#include "bootloader.h"
 
 
-bool HID;
 static float step;
 static float progress = 0;
 static int hashes;
+/* Print the progress as lines of percents instead of a bar */
+static bool progress_lines = false;
+static unsigned int total;
+static unsigned int tenths;
+/* Receives the progress instead of the terminal, if set */
+static bootload_progress_t progress_hook = NULL;
+static uint8_t cpu;
 
 /* Debug commands */
 //#define keybreak()      {puts("Press return to read feedback"); getchar();}
@@ -53,771 +62,371 @@ static int hashes;
 #define TRUE    1
 #define FALSE   0
 
-#define USB_TIMEOUT 5
-#define BOOT_INIT_ACK 255 
-#define BOOT_EXIT_ACK 254 
+#define USB_TIMEOUT 5000 /* ms */
 
-/* USB bootloader commands */
-#define BOOT_INIT 1
-#define BOOT_FILLPAGE 2
-#define BOOT_EXIT 3
-
-static bool wait_status(unsigned char value, int timeout);
-static void compute_progress_bar(const char *filename);
-typedef uint32_t FILE_Addr_t;
-typedef uint32_t FILE_SegmentLen_t;
-typedef unsigned FILE_LineNum_t;
-typedef uint8_t FILE_ParsedLen_t;
-
-static uint8_t counter;
+static unsigned int counter;
 
 static enum mem_type_t mem_type;
 
-typedef struct
-{
-    FILE_LineNum_t lineNum;     /* Line number of data record in ASCII file. */
-    FILE_Addr_t addr;           /* Address that was parsed */
-    FILE_ParsedLen_t dataLen;   /* Number of bytes of data */
-    FILE_ParsedLen_t dataAlloc; /* Number of bytes allocated */
-    uint8_t *data;              /* Data that was parsed */
-
-} FILE_ParsedData_t;
-
-typedef struct
-{
-    FILE_LineNum_t lineNum;     /* Tracks line number we're working on */
-    FILE_ParsedData_t parsedData;       /* Last hunk of data parsed */
-    FILE_Addr_t segAddr;        /* Address of the segment in memory */
-    FILE_SegmentLen_t segLen;   /* Length of the segment in memory */
-    int inSeg;                  /* Inside a segment */
-    FILE_Addr_t currAddr;       /* Current address in memory being processed */
-    uint8_t *segmentData;       /* Complete segment data */
-    int segmentDataIdx;         /* Index used for filling in the segment data */
-    usb_dev_handle *dev_handle; /* USB device handle for sending parsed data */
-} Parser_t;
-
 /**
- *   Clears any data stored in the parsed data
+ * \brief Print the progress as a line every 10 percents instead of a bar.
+ * The bar can't be followed when the output of several programmings is
+ * mixed.
  */
-
-static void ClearData(FILE_ParsedData_t * parsedData)
+void bootload_progress_lines(bool enable)
 {
-    if (parsedData->dataAlloc > 0)
-    {
-        memset(parsedData->data, 0, parsedData->dataAlloc);
-    }
-
-}                               // ClearData
-
-/**
-*   Releases any allocated data in the parsed data buffer.
-*/
-
-static void FreeData(FILE_ParsedData_t * parsedData)
-{
-    if (parsedData->dataAlloc > 0)
-    {
-        free(parsedData->data);
-        parsedData->data = NULL;
-        parsedData->dataAlloc = 0;
-    }
-
-}                               // FreeData
+    progress_lines = enable;
+}
 
 /**
- *   Allocates (or reallocates) the data buffer
+ * \brief Give the progress to hook instead of printing it. The hook is
+ * called when an upload starts and then every 10 percents.
  */
-
-static uint8_t *AllocData(FILE_ParsedData_t * parsedData, FILE_ParsedLen_t reqLen)
+void bootload_progress_hook(bootload_progress_t hook)
 {
-    if (reqLen <= parsedData->dataAlloc)
-    {
-        return parsedData->data;
-    }
-
-    FreeData(parsedData);
-
-    if ((parsedData->data = malloc(reqLen)) != NULL)
-    {
-        parsedData->dataAlloc = reqLen;
-
-        ClearData(parsedData);
-    }
-
-    return parsedData->data;
-
-}                               // AllocData
+    progress_hook = hook;
+}
 
 /**
- * Parses a single nibble from a string containing ASCII Hex characters.
- *
- * @param[in,out] parser  Parser object that we're reporting about
- * @param[in,out] s       Pointer to string; will be advanced.
- * @param[out]    b       Nibble that was parsed
- * @param[int]    label   Error string (used for reporting errors)
- *
- * @return  TRUE, if a nibble was parsed successfully, FALSE otherwise.
+ * Print the hashes of the progress bar up to the current page counter
  */
-static int GetNibble(Parser_t * parser, const char **s, unsigned char *b,
-                     const char *label)
+static void update_progress(void)
 {
-    char ch = **s;
-
-    *s = *s + 1;
-
-    if ((ch >= '0') && (ch <= '9'))
+    if (progress_hook)
     {
-        *b = ch - '0';
-        return TRUE;
+        /* Once for a page that covers several tenths */
+        if (total && counter * 10 / total > tenths)
+        {
+            tenths = counter * 10 / total;
+            progress_hook(cpu, mem_type, counter, total);
+        }
+        return;
     }
-
-    if ((ch >= 'A') && (ch <= 'F'))
+    if (progress_lines)
     {
-        *b = ch - 'A' + 10;
-        return TRUE;
+        while (total && counter * 10 / total > tenths)
+        {
+            tenths++;
+            printf("%s %3u%%\n", mem_type == EEPROM ? "EEPROM" : "FLASH",
+                   tenths * 10);
+        }
+        fflush(stdout);
+        return;
     }
-
-    if ((ch >= 'a') && (ch <= 'f'))
+    while (counter >= progress && hashes <= 60)
     {
-        *b = ch - 'a' + 10;
-        return TRUE;
+        printf("#");
+        progress += step;
+        hashes++;
     }
-
-    // Error(parser, "parsing %s, expecting hex digit, found '%c'", label, ch);
-    return FALSE;
-
-}                               // GetNibble
+    fflush (stdout);
+}
 
 /**
- * Parses a single byte from a string containing ASCII Hex characters.
- *
- * @param[in,out] parser  Parser object that we're reporting about
- * @param[in,out] s       Pointer to string; will be advanced
- * @param[out]    b       Byte that was parsed
- * @param[in]     label   Error string (used for reporting errors)
- *
- * @return  TRUE, if a byte was parsed successfully, FALSE otherwise.
+ * \brief Build the command that enters the bootloader of a CPU
+ * \return the size of the command
  */
-static int GetByte(Parser_t * parser, const char **s, unsigned char *b,
-                   const char *label)
+int bootload_init_command(uint8_t cpu_address, uint8_t * command)
 {
-    unsigned char b1, b2;
-
-    if (GetNibble(parser, s, &b1, label) && GetNibble(parser, s, &b2, label))
-    {
-        *b = b1 << 4 | b2;
-        return TRUE;
-    }
-
-    return FALSE;
-
-}                               // GetByte
+    command[0] = HID_I2C_HEADER;
+    command[1] = BOOT_INIT;
+    command[2] = cpu_address;
+    command[3] = 64;            /* Page size, XXX should depend on CPU type */
+    command[4] = 2;             /* Packets per page, XXX idem */
+    return BOOT_COMMAND_SIZE;
+}
 
 /**
- * Parses two bytes from a string containing ASCII Hex characters.
- *
- * @param[in,out] parser  Parser object that we're reporting about
- * @param[in,out] s       Pointer to string; will be advanced
- * @param[out]    b       Word that was parsed
- * @param[in]     label   Error string (used for reporting errors)
- *
- * @return  TRUE, if a byte was parsed successfully, FALSE otherwise.
+ * \brief Build the command that leaves the bootloader
+ * \return the size of the command
  */
-static int GetWord(Parser_t * parser, const char **s, unsigned short *b,
-                   const char *label)
+int bootload_exit_command(uint8_t * command)
 {
-    unsigned char b1, b2;
-
-    if (GetByte(parser, s, &b1, label) && GetByte(parser, s, &b2, label))
-    {
-        *b = (unsigned short)b1 << 8 | b2;
-        return TRUE;
-    }
-
-    return FALSE;
-
-}                               // GetWord
+    command[0] = HID_I2C_HEADER;
+    command[1] = BOOT_EXIT;
+    command[2] = 0;
+    command[3] = 0;
+    command[4] = 0;
+    return BOOT_COMMAND_SIZE;
+}
 
-static int startSegment(Parser_t * parser)
+/**
+ * \brief Split a FILLPAGE segment in its two packets: the address and the
+ * first half of the page in first, the second half in second
+ */
+void bootload_fillpage_packets(const uint8_t * segment, int mem_t,
+                               uint8_t * first, uint8_t * second)
 {
-    parser->segmentDataIdx = 0;
-
-    /* set segment address */
-    parser->segmentData[parser->segmentDataIdx++] =
-        (uint8_t) (parser->segAddr >> 8);
-    parser->segmentData[parser->segmentDataIdx++] = (uint8_t) parser->segAddr;
-
-    /* fill with '0xFF' if necessary */
-    while (parser->currAddr < parser->parsedData.addr)
-    {
-        parser->segmentData[parser->segmentDataIdx++] = 0xFF;
-        parser->currAddr++;
-    }
-
-    return TRUE;
+    first[0] = second[0] = HID_I2C_HEADER;
+    first[1] = second[1] = BOOT_FILLPAGE;
+    memcpy(&first[2], segment, FILLPAGE_FIRST_SIZE - 2);
+    memcpy(&second[2], segment + FILLPAGE_FIRST_SIZE - 2,
+           FILLPAGE_SECOND_SIZE - 2);
+    /* set the last bit to 1 to indicate eeprom type to the bootloader */
+    if (mem_t == EEPROM)
+        first[2] |= 0x80;
 }
 
 /**
- * Put one byte of data in the segmentData
+ * \brief Whether frame is the status frame of the bootloader carrying value:
+ * the acknowledge of a command or the counter of a page
  */
-static int fillSegment(Parser_t * parser, unsigned char data)
+bool bootload_is_status(const uint8_t * frame, uint8_t value)
 {
-    parser->segmentData[parser->segmentDataIdx++] = data;
-    parser->currAddr++;
-    return TRUE;
+    return frame[0] == BOOT_STATUS_FRAME && frame[2] == value;
 }
 
 /**
- * Send the segment to the USB chip for I2C bootloading
- *
- * \todo remove the USB commands from here and put them in their own function
+ * Send the page to the USB chip for I2C bootloading
  */
-int finishSegment(Parser_t * parser)
+static int finishSegment(const transport_t * transport,
+                         const uint8_t * segmentData)
 {
-    int i, idx = 0;
-    unsigned char data_buffer[64];
-    int ret;
-
-    /* Indicate that we completed a segment */
-    parser->inSeg = FALSE;
+#if (PRINT_DATA)
+    int i;
+#endif
+    uint8_t data_buffer[TRANSPORT_REPORT_SIZE];
+    uint8_t second_buffer[TRANSPORT_REPORT_SIZE];
+    uint64_t start;
+    bool ret;
 
 #if (PRINT_DATA)
     /* XXX debug */
     printf("segment data: \n");
-    for (i = 0; i < parser->segLen + 2; i++)
-        printf("%02x", parser->segmentData[i]);
+    for (i = 0; i < FILLPAGE_SEGMENT_SIZE; i++)
+        printf("%02x", segmentData[i]);
     printf("\n");
 #endif
 
-    data_buffer[0] = HID_I2C_HEADER;
-    data_buffer[1] = BOOT_FILLPAGE;
-
-    /*
-     * Send first packet
-     */
-    for (i = 2; i < 36; i++)
-        data_buffer[i] = parser->segmentData[idx++];
     /* EEPROM handling */
     if (mem_type == EEPROM)
     {
         /* try to solve the programming problem with some boards */
-        usleep(200000);
-         /* set the last bit to 1 to indicate eeprom type to the bootloader */
-        data_buffer[2] |= 0x80;
-    }
-    if (HID)
-    {
-        ret = tux_hid_write(36, data_buffer);
+        usleep(BOOTLOAD_EEPROM_PAUSE * 1000);
     }
-    else
+    bootload_fillpage_packets(segmentData, mem_type, data_buffer,
+                              second_buffer);
+
+    start = timer_now_us();
+    if (transport->queue_page)
     {
-        ret = usb_send_commands(parser->dev_handle, data_buffer, 36);
+        /* Both packets are queued at once, the status is checked by the
+         * backend while the next page is prepared. The latency recorded is
+         * the time the queue was full. */
+        if (!transport->queue_page(data_buffer, FILLPAGE_FIRST_SIZE,
+                                   second_buffer, FILLPAGE_SECOND_SIZE,
+                                   ++counter))
+        {
+            log_error("\nBootloading failed, program aborted at dongle "
+                      "reply.\n");
+            exit(E_TUXUP_BOOTLOADINGFAILED);
+        }
+        stats_page(start);
+        update_progress();
+        return TRUE;
     }
+
+    ret = transport_write(transport, data_buffer, FILLPAGE_FIRST_SIZE);
 #if (PRINT_DATA)
     printf("Status of the first packet sent: %d\n", ret);
 #endif
-    if (HID)
-    {
-        if (!ret)
-            return FALSE;
-    }
-    else
-    {
-        if (ret != 36)
-            return FALSE;
-    }
-
-    /*
-     * Send second packet
-     */
-    for (i = 2; i < 34; i++)
-        data_buffer[i] = parser->segmentData[idx++];
+    if (!ret)
+        return FALSE;
     keybreak();
-    if (HID)
-    {
-        ret = tux_hid_write(34, data_buffer);
-    }
-    else
-    {
-        ret = usb_send_commands(parser->dev_handle, data_buffer, 34);
-    }
+    ret = transport_write(transport, second_buffer, FILLPAGE_SECOND_SIZE);
 #if (PRINT_DATA)
     printf("Status of the second packet sent: %d\n", ret);
 #endif
-    if (HID)
-    {
-        if (!ret)
-            return FALSE;
-    }
-    else
-    {
-        if (ret != 34)
-            return FALSE;
-    }
-
+    if (!ret)
+        return FALSE;
     keybreak();
 
     /*
      * Bootlader status command and result
      */
-    if (HID)
-    {
-        ret = (wait_status(++counter, USB_TIMEOUT));
-        ret = tux_hid_read(5, data_buffer);
-    }
-    else
-    {
-        ret = usb_get_commands(parser->dev_handle, data_buffer, 64);
-        counter ++;
-    }
+    ret = transport_wait_frame(transport, ++counter,
+                               timer_deadline_ms(USB_TIMEOUT), data_buffer);
 #if (PRINT_DATA)
     printf("Status of feedback from bootloader: %x\n", ret);
 #endif
-    if (HID)
+    if (!ret || data_buffer[1] != 0)
     {
-        if ((ret) && (data_buffer[0] == 0xF0) && (data_buffer[1] == 0))
-        {
-            while (counter >= progress && hashes <= 60)
-            {
-                printf("#");
-                progress += step;
-                hashes++;
-            }
-            fflush (stdout);
-            sleep(0.05);
-            return TRUE;
-        }
-        else
-        {
-            log_error("Bootloading failed, program aborted at dongle reply.\n");
-            exit(E_TUXUP_BOOTLOADINGFAILED);
-        }
-    }
-    else
-    {
-        if ((ret == 64) && (data_buffer[0] == 0xF0) && (data_buffer[1] == 0))
-        {
-            while (counter >= progress && hashes <= 60)
-            {
-                printf("#");
-                progress += step;
-                hashes++;
-            }
-            fflush (stdout);
-            return TRUE;
-        }
-        else
-        {
-            log_error("\nBootloading failed, program aborted at dongle reply.\n");
-            exit(E_TUXUP_BOOTLOADINGFAILED);
-        }
+        log_error("\nBootloading failed, program aborted at dongle reply.\n");
+        exit(E_TUXUP_BOOTLOADINGFAILED);
     }
+    stats_page(start);
+    update_progress();
+    return TRUE;
 }
 
 /**
- * Called when a data line is parsed. This routine will,
- * in turn, call startSegment(), fillSegment(), and finishSegment() as
- * appropriate.
- *
- * @return TRUE if parsing should continue, FALSE if it should stop.
+ * Enter the bootloader of a CPU and prepare the progress bar for count
+ * pages.
  */
-static int ParsedData(Parser_t * parser, int lastSeg)
+static int boot_begin(const transport_t * transport, uint8_t cpu_address,
+                      uint8_t mem_t, unsigned int count)
 {
-    FILE_ParsedData_t *parsedData = &parser->parsedData;
-
-    /* Last segment, fill with '0xFF', send and return */
-    if (lastSeg)
-    {
-#if (PRINT_DATA)
-        printf("--last segment --\n");
-#endif
-        /* fill with '0' until the end of segment */
-        while (parser->currAddr < (parser->segAddr + parser->segLen))
-        {
-            fillSegment(parser, 0xFF);
-        }
-        finishSegment(parser);
-        return TRUE;
-    }
-
-    /* resynchronise currAddr and addr */
-    while (parser->currAddr != parsedData->addr)
-    {
-#if (PRINT_DATA)
-        printf("--synchronisation--\n");
-#endif
-        if (!parser->inSeg)
-        {
-            /* set current address at the segment start by zeroing lower bits */
-            parser->currAddr = parsedData->addr & ~(parser->segLen - 1);
-            break;
-        }
-        fillSegment(parser, 0xFF);
-
-        /* end of segment ? */
-        if (parser->currAddr == (parser->segAddr + parser->segLen))
-        {
-            finishSegment(parser);
-        }
-    }
-
-    /* loop until all data has been processed */
-    int dataIdx = 0;
-
-    while (parser->currAddr < (parsedData->addr + parsedData->dataLen))
-    {
+    uint8_t data_buffer[TRANSPORT_REPORT_SIZE];
+    uint64_t start;
+    int size;
 
-#if (PRINT_DATA)
-        printf("--loop--");
-#endif
-        /* start a new segment if needed */
-        if (!parser->inSeg)
-        {
-#if (PRINT_DATA)
-            printf("--new segment--\n");
-#endif
-            parser->inSeg = TRUE;
-            /* set address of the segment start */
-            parser->segAddr = parser->currAddr;
-            startSegment(parser);
-        }
-
-        /* store data in segmentData */
-        fillSegment(parser, parsedData->data[dataIdx]);
-        dataIdx++;
+    /* Set global variable mem_type to the memory type */
+    mem_type = mem_t;
+    cpu = cpu_address;
 
-        /* end of segment ? */
-        if (parser->currAddr == (parser->segAddr + parser->segLen))
-        {
-#if (PRINT_DATA)
-            printf("--end segment--");
-#endif
-            finishSegment(parser);
-        }
+    /* For *nix system, display the memory type and prepare the progress bar.
+     * ex : FLASH   [                                              ]
+     */
+    /** \todo Find how works the escape sequences on windows */
+    if (progress_hook)
+        progress_hook(cpu_address, mem_type, 0, count);
+    else if (progress_lines)
+        printf("%s 0x%02x: %u pages\n",
+               mem_type == EEPROM ? "EEPROM" : "FLASH", cpu_address, count);
+    else if (mem_type == EEPROM)
+        printf("EEPROM [\033[s\033[61C]\033[u\033[1B"); 
+    else
+        printf("FLASH  [\033[s\033[61C]\033[u\033[1B"); 
+    /* Bootloader initialization */
+    size = bootload_init_command(cpu_address, data_buffer);
+    
+    counter = 0;
+    progress = 0;
+    hashes = 0;
+    total = count;
+    tenths = 0;
+    /* 60 hashes to print for the whole image */
+    step = count / 60.0;
+
+    stats_upload_begin(cpu_address, mem_type);
+    start = timer_now_us();
+    /* The bootloader is ready as soon as it acknowledges the init */
+    transport_drain(transport);
+    if (!transport_write(transport, data_buffer, size)
+        || !transport_wait_frame(transport, BOOT_INIT_ACK,
+                                 timer_deadline_ms(USB_TIMEOUT), data_buffer))
+    {
+        log_error("\nInitialization failed\n");
+        stats_upload_end(false);
+        return FALSE;
     }
 
+    stats_upload_init(start);
+    log_debug("Bootloader ready in %d ms",
+              (int)((timer_now_us() - start) / 1000));
     return TRUE;
-
-}                               // ParsedData
+}
 
 /**
- *   Parses a single line from an Intel Hex file.
- *
- *   The Intel Hex format looks like this:
- *
- *   : BC AAAA TT HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH CC <CR>
- *
- *   Note: Number of H's varies with data ..... this is example only.
- *   Note: Spaces added for clarity
- *
- *   :     Start of record character
- *   BC    Byte count
- *   AAAA  Address to load data.  (tells receiving device where to load)
- *   TT    Record type. (00=Data record, 01=End of file. No data in EOF record)
- *   HH    Each H is one ASCII hex digit.  (2 hex digits=1 byte)
- *   CC    Checksum of all bytes in record (BC+AAAA+TT+HH......HH+CC=0)
- *
- *   See: http://www.xess.com/faq/intelhex.pdf for the complete spec
+ * Leave the bootloader once the pages have been sent. Returns rc, the
+ * result of the programming, or FALSE if the exit failed.
  */
-
-static int parseIHexLine(Parser_t * parser, const char *line)
+static int boot_end(const transport_t * transport, int rc)
 {
-    int i;
-    FILE_ParsedData_t *parsedData = &parser->parsedData;
-    uint8_t *data;
+    uint8_t data_buffer[TRANSPORT_REPORT_SIZE];
+    uint64_t start;
+    int size;
 
-    ClearData(parsedData);
-
-    if (line[0] != ':')
-    {
-        /* In Intel Hex format, lines which don't start with ':' are
-           supposed to be ignored */
-        return TRUE;
-    }
-
-    const char *s = &line[1];
-    unsigned char dataLen;
-
-    if (!GetByte(parser, &s, &dataLen, "count"))
+    /* Wait for the status of the pages still in flight */
+    if (transport->flush && !transport->flush())
     {
-        return FALSE;
+        log_error("\nBootloading failed, program aborted at dongle reply.\n");
+        exit(E_TUXUP_BOOTLOADINGFAILED);
     }
 
-    data = AllocData(parsedData, dataLen);
-
-    unsigned short addr;
-
-    if (!GetWord(parser, &s, &addr, "addr"))
-    {
-        return FALSE;
-    }
-
-    unsigned char recType;
-
-    if (!GetByte(parser, &s, &recType, "recType"))
-    {
-        return FALSE;
-    }
-
-    unsigned char checksumCalc =
-        dataLen + ((addr & 0xFF00) >> 8) + (addr & 0x00FF) + recType;
-
-    for (i = 0; i < dataLen; i++)
-    {
-        if (!GetByte(parser, &s, &data[i], "data"))
-        {
-            return FALSE;
-        }
-        checksumCalc += data[i];
-    }
-
-    unsigned char checksumFound;
-
-    if (!GetByte(parser, &s, &checksumFound, "checksum"))
-    {
-        return FALSE;
-    }
+    /* Exit bootloader */
+    size = bootload_exit_command(data_buffer);
 
-    if ((unsigned char)(checksumCalc + checksumFound) != 0)
+    progress = 0;
+    
+    start = timer_now_us();
+    if (!transport_write(transport, data_buffer, size)
+        || !transport_wait_frame(transport, BOOT_EXIT_ACK,
+                                 timer_deadline_ms(USB_TIMEOUT), data_buffer))
     {
-        // Error(parser, "found checksum 0x%02x, expecting 0x%02x",
-        // checksumFound, 0 - checksumCalc);
+        log_error("\nBootloader exit failed \n");
+        stats_upload_end(false);
         return FALSE;
     }
-
-    switch (recType)
-    {
-    case 0:                    // Data
-        {
-            parsedData->addr = addr;
-            parsedData->dataLen = dataLen;
-
-            ParsedData(parser, FALSE);
-            break;
-        }
-
-    case 1:                    // EOF
-        {
-            ParsedData(parser, TRUE);   /* fill the last segment and send it */
-            // Flush(parser); /* XXX what to do here? */
-            break;
-        }
-
-    default:
-        {
-            // Error(parser, "Unrecognized record type: %d", recType);
-            return FALSE;
-        }
-    }
-
-    return TRUE;
-
-}                               // parseIHexLine
+    stats_upload_exit(start);
+    stats_upload_end(rc);
+    return rc;
+}
 
 /**
- *   Parses an intel hex file, calling the appropriate callbacks along the way
+ * \brief Build the FILLPAGE segment of a page: its address followed by its
+ * content
+ * \return false if the address doesn't fit in the FILLPAGE header
  */
-static int FILE_ParseFile(usb_dev_handle * dev_h, const char *fileName)
+bool bootload_segment(const hex_page_t * page, uint8_t * segment)
 {
-    FILE *fs = NULL;
-    Parser_t parser;
-    char line[100];
-    int rc = FALSE;
-    memset(&parser, 0, sizeof(parser)); /* clear all parser elements */
-
-    /* TODO get this value from either the file or the main program.
-       What if we get an ATM168? */
-    parser.segLen = 0x40;
-    /* XXX this is not a good way to pass the handle up to
-       finishSegment, any better idea? */
-    parser.dev_handle = dev_h;
-
-    if ((parser.segmentData = malloc(parser.segLen + 2)) == NULL)
-    {
-        log_error("Unable to allocate segmentData space");
-        goto cleanup;
-    }
-
-    if ((fs = fopen(fileName, "rt")) == NULL)
+    if (page->addr >= FILLPAGE_ADDR_LIMIT)
     {
-        log_error("Unable to open file '%s' for reading", fileName);
-        goto cleanup;
-    }
-
-    /* Nb of line */
-    compute_progress_bar(fileName);
-
-    while (fgets(line, sizeof(line), fs) != NULL)
-    {
-        parser.lineNum++;
-        if (!parseIHexLine(&parser, line))
-        {
-            goto cleanup;
-        }
+        log_error("\nThe page at 0x%X is beyond the addresses the "
+                  "bootloader can program (0x%X)\n", page->addr,
+                  FILLPAGE_ADDR_LIMIT);
+        return false;
     }
-
-    /* Everything went successfully */
-    rc = TRUE;
-
-  cleanup:
-
-    if (fs != NULL)
-    {
-        free(parser.segmentData);
-        fclose(fs);
-    }
-
-    return rc;
-
-}                               // FILE_ParseFile
+    segment[0] = (uint8_t) (page->addr >> 8);
+    segment[1] = (uint8_t) page->addr;
+    memcpy(&segment[2], page->data, HEX_PAGE_SIZE);
+    return true;
+}
 
 /**
- *   Bootloads a CPU with the provided hex file
+ *   Bootloads a CPU with the provided image
  */
-int bootload(usb_dev_handle * dev_h, uint8_t cpu_address, uint8_t mem_t,
-             const char *filename)
+int bootload(const transport_t * transport, uint8_t cpu_address,
+             uint8_t mem_t, const hex_image_t * image)
 {
-    int rc = FALSE;
-    unsigned char data_buffer[64];
-    uint8_t page_size = 64;   /* XXX Should depend on CPU type */
-    uint8_t packet_total = 2; /* XXX should depend on CPU type */
-    int ret;
+    uint8_t segment[FILLPAGE_SEGMENT_SIZE];
+    unsigned int i;
 
-    
-    /* Set global variable mem_type to the memory type */
-    mem_type = mem_t;
-
-    /* For *nix system, display the memory type and prepare the progress bar.
-     * ex : FLASH   [                                              ]
-     */
-    /** \todo Find how works the escape sequences on windows */
-    if (mem_type == EEPROM)
-        printf("EEPROM [\033[s\033[61C]\033[u\033[1B"); 
-    else
-        printf("FLASH  [\033[s\033[61C]\033[u\033[1B"); 
-    /* Bootloader initialization */
-    data_buffer[0] = HID_I2C_HEADER;
-    data_buffer[1] = BOOT_INIT;
-    data_buffer[2] = cpu_address;
-    data_buffer[3] = page_size;
-    data_buffer[4] = packet_total;
-    
-    counter = 0;
-    progress = 0;
-    hashes = 0;
-
-    if (HID)
+    /* Refuse the images the bootloader can't address rather than folding
+     * their pages over the lower ones */
+    for (i = 0; i < image->page_count; i++)
     {
-        sleep(0.5);
-        ret = tux_hid_write(5, data_buffer);
-        sleep(1);
-    }
-    else
-    { 
-        /* Send the command to active the bootloader */
-        ret = usb_send_commands(dev_h, data_buffer, 5);
-        /* ... and read the status to be ure that it's correctly initialized */
-        ret = usb_get_commands(dev_h, data_buffer, 64);
-    }
-    if (HID)
-    {
-        if (!wait_status(BOOT_INIT_ACK, USB_TIMEOUT) || !ret)
-        {
-            log_error("\nInitialization failed\n");
-            return FALSE;
-        }
-    }
-    else
-    {
-#if (PRINT_DATA)
-        printf("Boot init status: %x\n", ret);
-#endif
-        if ((ret != 64) && data_buffer[2] != BOOT_INIT_ACK)
-        {
-            log_error("\nInitialization failed\n");
+        if (!bootload_segment(&image->pages[i], segment))
             return FALSE;
-        }
     }
 
-    /* Bootloader: parse hex file and send data */
-    if (FILE_ParseFile(dev_h, filename))
-    {
-        rc = TRUE;
-    }
-
-    /* Exit bootloader */
-    data_buffer[0] = HID_I2C_HEADER;
-    data_buffer[1] = BOOT_EXIT;
-    data_buffer[2] = 0;
-    data_buffer[3] = 0;
-    data_buffer[4] = 0;
+    if (!boot_begin(transport, cpu_address, mem_t, image->page_count))
+        return FALSE;
 
-    progress = 0;
-    
-    if (HID)
-    {  
-        tux_hid_write(5, data_buffer);
-        tux_hid_read(5, data_buffer);
-        if (!wait_status(BOOT_EXIT_ACK, USB_TIMEOUT))
-        {
-            log_error("\nBootloader exit failed \n");
-            return FALSE;
-        }
-    }
-    else
+    /* Bootloader: send all the pages of the image */
+    for (i = 0; i < image->page_count; i++)
     {
-        ret = usb_send_commands(dev_h, data_buffer, 5);
-        ret = usb_get_commands(dev_h, data_buffer, 64);
+        bootload_segment(&image->pages[i], segment);
+        if (!finishSegment(transport, segment))
+            break;
     }
-    return rc;
+    return boot_end(transport, i == image->page_count);
 }
 
 /**
- * \brief Wait a specific ACK.
- * This function wait for a specific value of the second parameter of the
- * bootloader ACK.
+ *   Bootloads a CPU with a precompiled image, the segments are sent as they
+ *   are stored in the file.
  */
-static bool wait_status(unsigned char value, int timeout)
+int bootload_tuxfw(const transport_t * transport, uint8_t cpu_address,
+                   const tuxfw_t * fw, bool skip_blank)
 {
-    unsigned char data_buffer[64];
-    uint8_t sttime = time(NULL);
-    uint8_t edtime = 0;
-    
-    tux_hid_read(64, data_buffer);
-    while ((data_buffer[2] != value) || (data_buffer[0] != 0xF0))
+    unsigned int i, count = 0;
+
+    for (i = 0; i < fw->header->page_count; i++)
     {
-        edtime = time(NULL);
-        if (difftime(edtime, sttime) > timeout)
-        {
-            return 0;
-        }
-        tux_hid_read(64, data_buffer);
-        usleep(5000);
+        if (!skip_blank || !tuxfw_page_is_blank(fw, i))
+            count++;
     }
-    return 1;
-}
 
-/**
- * \brief Compute the progress bar depending of the number of line in the file. 
- * One packet use 4 line. So, to know the number of packet to send, just divide
- * the line number per 4.
- * This progress bar display 60 "#"
- * \todo Find a better way to now the number of packet.
- */
-static void compute_progress_bar(const char *filename)
-{
-    FILE *fs = NULL;
-    char line[100];
-    int char_cnt = 0;
-
-    if ((fs = fopen(filename, "r")) == NULL)
-        return;
-
-    while (fgets(line, sizeof(line), fs) != NULL)
-        /* 13 bytes are not data to be programmed */
-        char_cnt += strlen(line) - 13;
-    fclose(fs);
+    if (!boot_begin(transport, cpu_address, fw->header->mem_type, count))
+        return FALSE;
 
-    /* 2 chars per byte, 64 bytes per frame, 60 hashes to print */
-    step = (char_cnt / (2 * 64.0 * 60.0));
+    for (i = 0; i < fw->header->page_count; i++)
+    {
+        if (skip_blank && tuxfw_page_is_blank(fw, i))
+            continue;
+        if (!finishSegment(transport, tuxfw_segment(fw, i)))
+            break;
+    }
+    return boot_end(transport, i == fw->header->page_count);
 }
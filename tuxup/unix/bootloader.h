@@ -22,8 +22,38 @@
 #ifndef bootloader_h
 #define bootloader_h
 #include <stdbool.h>
-#include "usb-connection.h"
-extern bool HID;
-int bootload(usb_dev_handle * dev_h, uint8_t cpu_address, uint8_t mem_type,
-             const char *filename);
+#include "transport.h"
+#include "hex_image.h"
+#include "tuxfw.h"
+
+/* The FILLPAGE header holds the page address on 15 bits, the upper bit
+ * selects the eeprom */
+#define FILLPAGE_ADDR_LIMIT 0x8000
+/* Page as sent by FILLPAGE: address, high byte first, then the content */
+#define FILLPAGE_SEGMENT_SIZE (HEX_PAGE_SIZE + 2)
+/* A segment is sent as two packets, both starting with the I2C header and
+ * the FILLPAGE command */
+#define FILLPAGE_FIRST_SIZE 36
+#define FILLPAGE_SECOND_SIZE 34
+/* Size of the INIT and EXIT commands */
+#define BOOT_COMMAND_SIZE 5
+/* Pause before each page of eeprom, some boards need it */
+#define BOOTLOAD_EEPROM_PAUSE 200 /* ms */
+
+/** Progress of an upload: sent pages out of total */
+typedef void (*bootload_progress_t)(uint8_t cpu_address, int mem_type,
+                                    unsigned int sent, unsigned int total);
+
+int bootload(const transport_t * transport, uint8_t cpu_address,
+             uint8_t mem_type, const hex_image_t * image);
+int bootload_tuxfw(const transport_t * transport, uint8_t cpu_address,
+                   const tuxfw_t * fw, bool skip_blank);
+bool bootload_segment(const hex_page_t * page, uint8_t * segment);
+int bootload_init_command(uint8_t cpu_address, uint8_t * command);
+int bootload_exit_command(uint8_t * command);
+void bootload_fillpage_packets(const uint8_t * segment, int mem_type,
+                               uint8_t * first, uint8_t * second);
+bool bootload_is_status(const uint8_t * frame, uint8_t value);
+void bootload_progress_lines(bool enable);
+void bootload_progress_hook(bootload_progress_t hook);
 #endif
@@ -0,0 +1,331 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   bundle.c
+ *
+ *   @brief  Firmware bundles.
+ *
+ *   A .tuxbundle file holds the images of a release with a manifest giving
+ *   their name, CPU, version, CRC and programming order. It is mapped once
+ *   and checked entirely before anything is programmed. The AVR images are
+ *   stored as .tuxfw images, the fuxusb one as its hex file.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "bundle.h"
+#include "tux-api.h"
+#include "log.h"
+
+/**
+ * Check the header, the manifest and the entries of a mapped bundle.
+ */
+static bool bundle_check(const bundle_t *bundle, const char *filename)
+{
+    const bundle_header_t *header = bundle->header;
+    const bundle_entry_t *entry;
+    tuxfw_t fw;
+    unsigned int i;
+
+    if (bundle->size < sizeof(bundle_header_t)
+        || memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic))
+        || header->format != BUNDLE_FORMAT
+        || header->entry_size != sizeof(bundle_entry_t)
+        || header->entry_count > BUNDLE_MAX_ENTRIES
+        || sizeof(bundle_header_t) + header->entry_count
+           * sizeof(bundle_entry_t) > bundle->size)
+    {
+        log_error("'%s' is not a valid bundle", filename);
+        return false;
+    }
+    if (tuxfw_crc32(bundle->entries, header->entry_count
+                    * sizeof(bundle_entry_t)) != header->manifest_crc)
+    {
+        log_error("'%s': the manifest is corrupted", filename);
+        return false;
+    }
+
+    for (i = 0; i < header->entry_count; i++)
+    {
+        entry = &bundle->entries[i];
+        if (memchr(entry->name, '\0', sizeof(entry->name)) == NULL
+            || entry->cpu_nbr > HIGHEST_CPU_NUM
+            || (uint64_t)entry->offset + entry->size > bundle->size)
+        {
+            log_error("'%s': entry %u is not valid", filename, i);
+            return false;
+        }
+        if (tuxfw_crc32(bundle_data(bundle, i), entry->size) != entry->crc)
+        {
+            log_error("'%s': %s is corrupted", filename, entry->name);
+            return false;
+        }
+        if (entry->kind == BUNDLE_TUXFW)
+        {
+            if (!tuxfw_attach(&fw, bundle_data(bundle, i), entry->size,
+                              entry->name))
+                return false;
+        }
+        else if (entry->kind != BUNDLE_HEX)
+        {
+            log_error("'%s': %s has an unknown kind", filename, entry->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Map a bundle and check all its entries
+ * \return false if the file can't be read or is corrupted
+ */
+bool bundle_open(bundle_t *bundle, const char *filename)
+{
+    struct stat st;
+    int fd;
+
+    memset(bundle, 0, sizeof(*bundle));
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+    {
+        log_error("Unable to open file '%s' for reading", filename);
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(bundle_header_t))
+    {
+        log_error("'%s' is not a bundle", filename);
+        close(fd);
+        return false;
+    }
+    bundle->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (bundle->map == MAP_FAILED)
+    {
+        log_error("Unable to map file '%s'", filename);
+        bundle->map = NULL;
+        return false;
+    }
+    bundle->size = st.st_size;
+    bundle->header = bundle->map;
+    bundle->entries = (const bundle_entry_t *)(bundle->header + 1);
+
+    if (!bundle_check(bundle, filename))
+    {
+        bundle_close(bundle);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Unmap a bundle
+ */
+void bundle_close(bundle_t *bundle)
+{
+    if (bundle->map)
+        munmap(bundle->map, bundle->size);
+    memset(bundle, 0, sizeof(*bundle));
+}
+
+/**
+ * \brief Use the .tuxfw image of entry i, which stays in the mapping
+ */
+bool bundle_attach(const bundle_t *bundle, unsigned int i, tuxfw_t *fw)
+{
+    return tuxfw_attach(fw, bundle_data(bundle, i), bundle->entries[i].size,
+                        bundle->entries[i].name);
+}
+
+/**
+ * \brief Start an empty bundle
+ */
+void bundle_writer_init(bundle_writer_t *writer)
+{
+    memset(writer, 0, sizeof(*writer));
+}
+
+/**
+ * Add an entry, the data is freed with the writer.
+ */
+static bool bundle_add(bundle_writer_t *writer, const char *name,
+                       uint8_t kind, uint8_t cpu_nbr, int mem_type,
+                       const version_t *version, uint8_t *data,
+                       size_t size)
+{
+    bundle_entry_t *entry;
+
+    if (writer->count == BUNDLE_MAX_ENTRIES
+        || strlen(name) >= sizeof(entry->name))
+    {
+        log_error("%s can't be added to the bundle", name);
+        free(data);
+        return false;
+    }
+    entry = &writer->entries[writer->count];
+    memset(entry, 0, sizeof(*entry));
+    strcpy(entry->name, name);
+    entry->kind = kind;
+    entry->cpu_nbr = cpu_nbr;
+    entry->mem_type = mem_type;
+    if (version)
+    {
+        entry->flags |= BUNDLE_HAS_VERSION;
+        entry->version = *version;
+    }
+    entry->size = size;
+    entry->crc = tuxfw_crc32(data, size);
+    writer->data[writer->count++] = data;
+    return true;
+}
+
+/**
+ * \brief Add an image to program by FILLPAGE
+ * \param name  Name of the entry, the file the image comes from
+ * \return false if the image can't be sent by FILLPAGE
+ */
+bool bundle_add_image(bundle_writer_t *writer, const char *name,
+                      const hex_image_t *image, uint8_t cpu_nbr,
+                      int mem_type)
+{
+    version_t version;
+    uint8_t *data;
+    size_t size;
+
+    if (!tuxfw_build(image, cpu_nbr, mem_type, &data, &size))
+        return false;
+    hex_image_get_version(image, &version);
+    return bundle_add(writer, name, BUNDLE_TUXFW, cpu_nbr, mem_type,
+                      image->has_version ? &version : NULL, data, size);
+}
+
+/**
+ * \brief Add a hex file as it is
+ * \param name     Name of the entry
+ * \param version  Version record of the file
+ * \return false if the file can't be read
+ */
+bool bundle_add_file(bundle_writer_t *writer, const char *name,
+                     const char *filename, const version_t *version)
+{
+    uint8_t *data = NULL;
+    long size = 0;
+    bool ok;
+    FILE *fs;
+
+    if ((fs = fopen(filename, "rb")) == NULL)
+    {
+        log_error("Unable to open file '%s' for reading", filename);
+        return false;
+    }
+    ok = fseek(fs, 0, SEEK_END) == 0 && (size = ftell(fs)) > 0
+         && fseek(fs, 0, SEEK_SET) == 0
+         && (data = malloc(size)) != NULL;
+    if (ok && fread(data, 1, size, fs) != (size_t)size)
+    {
+        free(data);
+        ok = false;
+    }
+    fclose(fs);
+    if (!ok)
+    {
+        log_error("Unable to read file '%s'", filename);
+        return false;
+    }
+    return bundle_add(writer, name, BUNDLE_HEX,
+                      CPU_VER_CPU(version->cpu_ver_maj), FLASH,
+                      version, data, size);
+}
+
+/**
+ * \brief Write the bundle, the entries in the order they were added
+ * \return false if the file can't be written
+ */
+bool bundle_write(bundle_writer_t *writer, const char *filename)
+{
+    static const uint8_t padding[TUXFW_ALIGN];
+    bundle_header_t header;
+    uint32_t offset;
+    unsigned int i;
+    bool ok;
+    FILE *fs;
+
+    offset = sizeof(header) + writer->count * sizeof(bundle_entry_t);
+    for (i = 0; i < writer->count; i++)
+    {
+        offset += (TUXFW_ALIGN - offset % TUXFW_ALIGN) % TUXFW_ALIGN;
+        writer->entries[i].offset = offset;
+        offset += writer->entries[i].size;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.format = BUNDLE_FORMAT;
+    header.entry_count = writer->count;
+    header.entry_size = sizeof(bundle_entry_t);
+    header.manifest_crc = tuxfw_crc32(writer->entries,
+                                      writer->count * sizeof(bundle_entry_t));
+
+    if ((fs = fopen(filename, "wb")) == NULL)
+    {
+        log_error("Unable to open file '%s' for writing", filename);
+        return false;
+    }
+    ok = fwrite(&header, sizeof(header), 1, fs) == 1
+         && fwrite(writer->entries, sizeof(bundle_entry_t), writer->count,
+                   fs) == writer->count;
+    for (i = 0; i < writer->count && ok; i++)
+    {
+        offset = writer->entries[i].offset - ftell(fs);
+        ok = fwrite(padding, 1, offset, fs) == offset
+             && fwrite(writer->data[i], 1, writer->entries[i].size, fs)
+                == writer->entries[i].size;
+    }
+    if (fclose(fs) != 0)
+        ok = false;
+    if (!ok)
+    {
+        log_error("Unable to write file '%s'", filename);
+        unlink(filename);
+    }
+    return ok;
+}
+
+/**
+ * \brief Free the entries of a bundle being built
+ */
+void bundle_writer_free(bundle_writer_t *writer)
+{
+    unsigned int i;
+
+    for (i = 0; i < writer->count; i++)
+        free(writer->data[i]);
+    writer->count = 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "common/defines.h"
+#include "tuxfw.h"
+
+#define BUNDLE_MAGIC        "TXBN"
+#define BUNDLE_FORMAT       1
+#define BUNDLE_EXTENSION    ".tuxbundle"
+#define BUNDLE_MAX_ENTRIES  16
+
+/* Kinds of entries */
+#define BUNDLE_TUXFW        1       /* .tuxfw image, sent by FILLPAGE */
+#define BUNDLE_HEX          2       /* Hex file, for dfu-programmer */
+
+/** version is valid */
+#define BUNDLE_HAS_VERSION  0x01
+
+/**
+ * Entry of the manifest: an image to program, in the order of the
+ * manifest. The entries are stored aligned on TUXFW_ALIGN.
+ */
+typedef struct
+{
+    char name[24];                  /* File the image was built from */
+    uint8_t kind;                   /* BUNDLE_TUXFW or BUNDLE_HEX */
+    uint8_t cpu_nbr;
+    uint8_t mem_type;               /* FLASH or EEPROM */
+    uint8_t flags;
+    version_t version;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t crc;                   /* CRC-32 of the entry */
+} bundle_entry_t;
+
+/**
+ * Header of a .tuxbundle file, in the byte order of the host, followed by
+ * the manifest.
+ */
+typedef struct
+{
+    char magic[4];                  /* BUNDLE_MAGIC */
+    uint8_t format;                 /* BUNDLE_FORMAT */
+    uint8_t entry_count;
+    uint16_t entry_size;            /* sizeof(bundle_entry_t) */
+    uint32_t manifest_crc;          /* CRC-32 of the manifest */
+} bundle_header_t;
+
+/** .tuxbundle file mapped in memory, checked when opened */
+typedef struct
+{
+    void *map;
+    size_t size;
+    const bundle_header_t *header;
+    const bundle_entry_t *entries;
+} bundle_t;
+
+/** Bundle being built, the entries are written when it's complete */
+typedef struct
+{
+    bundle_entry_t entries[BUNDLE_MAX_ENTRIES];
+    uint8_t *data[BUNDLE_MAX_ENTRIES];
+    unsigned int count;
+} bundle_writer_t;
+
+/* Prototypes */
+bool bundle_open(bundle_t *bundle, const char *filename);
+void bundle_close(bundle_t *bundle);
+bool bundle_attach(const bundle_t *bundle, unsigned int i, tuxfw_t *fw);
+void bundle_writer_init(bundle_writer_t *writer);
+bool bundle_add_image(bundle_writer_t *writer, const char *name,
+                      const hex_image_t *image, uint8_t cpu_nbr,
+                      int mem_type);
+bool bundle_add_file(bundle_writer_t *writer, const char *name,
+                     const char *filename, const version_t *version);
+bool bundle_write(bundle_writer_t *writer, const char *filename);
+void bundle_writer_free(bundle_writer_t *writer);
+
+/** Content of entry i */
+static inline const uint8_t *bundle_data(const bundle_t *bundle,
+                                         unsigned int i)
+{
+    return (const uint8_t *)bundle->map + bundle->entries[i].offset;
+}
+
+#endif /* BUNDLE_H */
@@ -0,0 +1,772 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   daemon.c
+ *
+ *   @brief  Long running tuxup serving jobs on a local socket.
+ *
+ *   'tuxup daemon' keeps the dongle connected between the jobs: the USB
+ *   scan, the stop of the driver and the check of the fuxusb version are
+ *   only done for the first one. The jobs are read from a UNIX socket as
+ *   JSON lines and their messages, progress and result are sent back as
+ *   JSON lines too, the events:
+ *
+ *   {"id": "1", "event": "log", "level": "notice", "text": "..."}
+ *   {"id": "1", "event": "progress", "cpu_address": 48, "mem": "flash",
+ *    "sent": 12, "pages": 41}
+ *   {"id": "1", "event": "version", "cpu": "tuxcore", "version": "0.4.2"}
+ *   {"id": "1", "event": "done", "code": 0}
+ *
+ *   Each job runs in a child process that inherits the connection: the
+ *   programming exits on most errors and the daemon has to stay up. The
+ *   clients are served one at a time, their jobs in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "daemon.h"
+#include "error.h"
+#include "log.h"
+
+/* Longest line of a request or an event */
+#define DAEMON_LINE_SIZE    (DAEMON_FILES_MAX * PATH_MAX + 1024)
+/* Pending connections */
+#define DAEMON_BACKLOG      8
+
+static const char *job_names[] = {
+    [DAEMON_FLASH] = "flash",
+    [DAEMON_VERIFY] = "verify",
+    [DAEMON_VERSION] = "version"
+};
+
+/* Client of the job in progress */
+static int client_fd = -1;
+static char client_id[64];
+
+/* Set by SIGINT and SIGTERM */
+static volatile sig_atomic_t stopping = 0;
+
+/*
+ * JSON
+ */
+
+/** Receives the members of an object, reads the value at *p */
+typedef bool (*json_member_t)(void *ctx, const char *key, const char **p);
+
+static void json_space(const char **p)
+{
+    while (**p == ' ' || **p == '\t' || **p == '\r' || **p == '\n')
+        (*p)++;
+}
+
+/**
+ * Read a string in out, escapes decoded. The characters beyond ASCII of
+ * the \u escapes are replaced by '?'.
+ */
+static bool json_string(const char **p, char *out, size_t size)
+{
+    const char *s = *p;
+    size_t len = 0;
+    char code[5];
+    long unicode;
+    char c;
+
+    json_space(&s);
+    if (*s++ != '"')
+        return false;
+    while ((c = *s++) != '"')
+    {
+        if (c == '\0')
+            return false;
+        if (c == '\\')
+        {
+            switch (c = *s++)
+            {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u':
+                if (strspn(s, "0123456789abcdefABCDEF") < 4)
+                    return false;
+                snprintf(code, sizeof(code), "%.4s", s);
+                unicode = strtol(code, NULL, 16);
+                c = (unicode > 0 && unicode < 0x80) ? unicode : '?';
+                s += 4;
+                break;
+            case '"': case '\\': case '/':
+                break;
+            default:
+                return false;
+            }
+        }
+        if (len + 1 >= size)
+            return false;
+        out[len++] = c;
+    }
+    out[len] = '\0';
+    *p = s;
+    return true;
+}
+
+static bool json_bool(const char **p, bool *value)
+{
+    json_space(p);
+    if (!strncmp(*p, "true", 4))
+        *value = true;
+    else if (!strncmp(*p, "false", 5))
+        *value = false;
+    else
+        return false;
+    *p += *value ? 4 : 5;
+    return true;
+}
+
+static bool json_int(const char **p, int *value)
+{
+    char *end;
+
+    json_space(p);
+    *value = strtol(*p, &end, 10);
+    if (end == *p)
+        return false;
+    /* Fractions and exponents are dropped */
+    *p = end + strspn(end, "0123456789.eE+-");
+    return true;
+}
+
+/**
+ * Skip a value of any type, up to the ',' or the '}' that follows it.
+ */
+static bool json_skip(const char **p)
+{
+    char text[PATH_MAX];
+    int depth = 0;
+
+    for (;;)
+    {
+        if (**p == '"')
+        {
+            if (!json_string(p, text, sizeof(text)))
+                return false;
+            continue;
+        }
+        if (**p == '\0')
+            return false;
+        if (depth == 0 && (**p == ',' || **p == '}' || **p == ']'))
+            return true;
+        if (**p == '{' || **p == '[')
+            depth++;
+        else if (**p == '}' || **p == ']')
+            depth--;
+        (*p)++;
+    }
+}
+
+/**
+ * Parse an object, giving its members to member.
+ */
+static bool json_object(const char *p, json_member_t member, void *ctx)
+{
+    char key[64];
+
+    json_space(&p);
+    if (*p++ != '{')
+        return false;
+    json_space(&p);
+    if (*p == '}')
+        return true;
+    for (;;)
+    {
+        if (!json_string(&p, key, sizeof(key)))
+            return false;
+        json_space(&p);
+        if (*p++ != ':' || !member(ctx, key, &p))
+            return false;
+        json_space(&p);
+        if (*p == '}')
+            break;
+        if (*p++ != ',')
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Write text as a JSON string, quotes included.
+ */
+static size_t json_quote(char *out, size_t size, const char *text)
+{
+    size_t len = 0;
+    int n;
+
+    for (out[len++] = '"'; *text && len + 8 < size; text++)
+    {
+        if (*text == '"' || *text == '\\')
+        {
+            out[len++] = '\\';
+            out[len++] = *text;
+        }
+        else if ((unsigned char)*text < 0x20)
+        {
+            n = snprintf(out + len, size - len, "\\u%04x", *text);
+            len += n;
+        }
+        else
+            out[len++] = *text;
+    }
+    out[len++] = '"';
+    out[len] = '\0';
+    return len;
+}
+
+/*
+ * Requests
+ */
+
+static bool request_member(void *ctx, const char *key, const char **p)
+{
+    daemon_request_t *request = ctx;
+    char text[16];
+    size_t i;
+    int n;
+
+    if (!strcmp(key, "id"))
+    {
+        json_space(p);
+        if (**p == '"')
+            return json_string(p, request->id, sizeof(request->id));
+        if (!json_int(p, &n))
+            return false;
+        snprintf(request->id, sizeof(request->id), "%d", n);
+        return true;
+    }
+    if (!strcmp(key, "job"))
+    {
+        if (!json_string(p, text, sizeof(text)))
+            return false;
+        for (i = 0; i < sizeof(job_names) / sizeof(job_names[0]); i++)
+        {
+            if (!strcmp(text, job_names[i]))
+            {
+                request->job = i;
+                return true;
+            }
+        }
+        return false;
+    }
+    if (!strcmp(key, "files"))
+    {
+        json_space(p);
+        if (*(*p)++ != '[')
+            return false;
+        json_space(p);
+        while (**p != ']')
+        {
+            if (request->file_count == DAEMON_FILES_MAX
+                || !json_string(p, request->files[request->file_count++],
+                                PATH_MAX))
+                return false;
+            json_space(p);
+            if (**p == ',')
+                (*p)++;
+            else if (**p != ']')
+                return false;
+        }
+        (*p)++;
+        return true;
+    }
+    if (!strcmp(key, "main") || !strcmp(key, "all"))
+    {
+        snprintf(request->mode, sizeof(request->mode), "%s", key);
+        return json_string(p, request->path, sizeof(request->path));
+    }
+    if (!strcmp(key, "device"))
+        return json_string(p, request->device, sizeof(request->device));
+    if (!strcmp(key, "full"))
+        return json_bool(p, &request->full);
+    if (!strcmp(key, "skip_blank"))
+        return json_bool(p, &request->skip_blank);
+    if (!strcmp(key, "update"))
+        return json_bool(p, &request->update);
+    if (!strcmp(key, "pretend"))
+        return json_bool(p, &request->pretend);
+    return json_skip(p);
+}
+
+/**
+ * Write a request as a JSON line.
+ */
+static void format_request(const daemon_request_t *request, char *line,
+                           size_t size)
+{
+    size_t len;
+    int i;
+
+    len = snprintf(line, size, "{\"id\": ");
+    len += json_quote(line + len, size - len, request->id);
+    len += snprintf(line + len, size - len, ", \"job\": \"%s\"",
+                    job_names[request->job]);
+    if (request->mode[0])
+    {
+        len += snprintf(line + len, size - len, ", \"%s\": ", request->mode);
+        len += json_quote(line + len, size - len, request->path);
+    }
+    len += snprintf(line + len, size - len, ", \"files\": [");
+    for (i = 0; i < request->file_count; i++)
+    {
+        if (i)
+            len += snprintf(line + len, size - len, ", ");
+        len += json_quote(line + len, size - len, request->files[i]);
+    }
+    len += snprintf(line + len, size - len, "], \"device\": ");
+    len += json_quote(line + len, size - len, request->device);
+    snprintf(line + len, size - len, ", \"full\": %s, \"skip_blank\": %s, "
+             "\"update\": %s, \"pretend\": %s}\n",
+             request->full ? "true" : "false",
+             request->skip_blank ? "true" : "false",
+             request->update ? "true" : "false",
+             request->pretend ? "true" : "false");
+}
+
+/*
+ * Events
+ */
+
+static bool write_all(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((n = write(fd, data, len)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * \brief Send an event of the job in progress to its client
+ * \param fmt  Members added to the event, "\"code\": %d" for example
+ */
+void daemon_event(const char *event, const char *fmt, ...)
+{
+    char line[4096];
+    size_t len;
+    va_list ap;
+
+    if (client_fd < 0)
+        return;
+    len = snprintf(line, sizeof(line), "{\"id\": ");
+    len += json_quote(line + len, sizeof(line) - len, client_id);
+    len += snprintf(line + len, sizeof(line) - len, ", \"event\": \"%s\", ",
+                    event);
+    va_start(ap, fmt);
+    len += vsnprintf(line + len, sizeof(line) - len, fmt, ap);
+    va_end(ap);
+    if (len + 3 > sizeof(line))
+        return;
+    len += snprintf(line + len, sizeof(line) - len, "}\n");
+    write_all(client_fd, line, len);
+}
+
+/**
+ * The messages of a job are sent to its client.
+ */
+static void log_event(log_level_t level, const char *text)
+{
+    char quoted[2048];
+    size_t len = strlen(text);
+    char trimmed[1024];
+
+    /* The messages of the terminal end with blank lines */
+    while (len && (text[len - 1] == '\n' || text[len - 1] == ' '))
+        len--;
+    if (len == 0)
+        return;
+    snprintf(trimmed, sizeof(trimmed), "%.*s", (int)len,
+             text + strspn(text, "\n"));
+    json_quote(quoted, sizeof(quoted), trimmed);
+    daemon_event("log", "\"level\": \"%s\", \"text\": %s",
+                 log_level_name(level), quoted);
+}
+
+/*
+ * Daemon
+ */
+
+/**
+ * \brief Default path of the socket: tuxupd.sock in the runtime directory
+ * of the user, in /tmp if there is none
+ */
+void daemon_socket_path(char *path, size_t size)
+{
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+
+    if (dir && *dir)
+        snprintf(path, size, "%s/tuxupd.sock", dir);
+    else
+        snprintf(path, size, "/tmp/tuxupd-%u.sock", (unsigned int)getuid());
+}
+
+static bool socket_address(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        log_error("The socket path %s is too long", path);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+static void stop(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+/**
+ * Run a job: prepared by the daemon, done by a child.
+ */
+static int run_job(const daemon_request_t *request, const daemon_ops_t *ops)
+{
+    log_level_t level = log_get_level();
+    pid_t pid;
+    int status, code, null;
+
+    /* All the messages are sent, the client keeps those of its level */
+    log_set_level(LOG_LEVEL_DEBUG);
+    log_set_handler(log_event);
+    code = ops->prepare(request);
+    if (code == E_TUXUP_NOERROR)
+    {
+        fflush(stdout);
+        fflush(stderr);
+        pid = fork();
+        if (pid == 0)
+        {
+            /* The progress bars and the results printed are replaced by
+             * the events */
+            if ((null = open("/dev/null", O_WRONLY)) >= 0)
+            {
+                dup2(null, STDOUT_FILENO);
+                dup2(null, STDERR_FILENO);
+                close(null);
+            }
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            exit(ops->run(request));
+        }
+        if (pid < 0)
+        {
+            log_error("Unable to start the job");
+            code = E_TUXUP_USBERROR;
+        }
+        else
+        {
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+                ;
+            code = WIFEXITED(status) ? WEXITSTATUS(status)
+                                     : E_TUXUP_PROGRAMMINGFAILED;
+        }
+    }
+    ops->finish(request, code);
+    log_set_handler(NULL);
+    log_set_level(level);
+    return code;
+}
+
+/**
+ * Serve the jobs of a client until it disconnects.
+ */
+static void serve_client(const daemon_ops_t *ops)
+{
+    static char buffer[DAEMON_LINE_SIZE];
+    static daemon_request_t request;
+    size_t len = 0;
+    ssize_t n;
+    char *eol;
+    int code;
+
+    while (!stopping)
+    {
+        n = read(client_fd, buffer + len, sizeof(buffer) - 1 - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+        buffer[len] = '\0';
+        while ((eol = strchr(buffer, '\n')) != NULL)
+        {
+            *eol = '\0';
+            memset(&request, 0, sizeof(request));
+            if (buffer[strspn(buffer, " \t\r")] == '\0')
+                ;
+            else if (!json_object(buffer, request_member, &request)
+                     || (request.job != DAEMON_VERSION
+                         && !request.mode[0] && !request.file_count))
+            {
+                snprintf(client_id, sizeof(client_id), "%s", request.id);
+                log_set_handler(log_event);
+                log_error("Invalid request");
+                log_set_handler(NULL);
+                daemon_event("done", "\"code\": %d", E_TUXUP_USAGE);
+            }
+            else
+            {
+                snprintf(client_id, sizeof(client_id), "%s", request.id);
+                code = run_job(&request, ops);
+                daemon_event("done", "\"code\": %d", code);
+            }
+            len -= eol + 1 - buffer;
+            memmove(buffer, eol + 1, len + 1);
+        }
+        /* A line that doesn't fit is dropped */
+        if (len == sizeof(buffer) - 1)
+            len = 0;
+    }
+}
+
+/**
+ * \brief Serve the jobs sent on socket_path until SIGINT or SIGTERM
+ * \return an exit code of tuxup
+ */
+int daemon_serve(const char *socket_path, const daemon_ops_t *ops)
+{
+    struct sockaddr_un addr;
+    struct sigaction action;
+    mode_t mask;
+    bool ok;
+    int fd;
+
+    if (!socket_address(&addr, socket_path))
+        return E_TUXUP_USAGE;
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        log_error("Unable to create the socket");
+        return E_SERVER_CONNECTION;
+    }
+    /* A socket left by a daemon that died can be replaced, not the one of
+     * a daemon running */
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        log_error("A tuxup daemon is already listening on %s", socket_path);
+        close(fd);
+        return E_SERVER_CONNECTION;
+    }
+    unlink(socket_path);
+    /* Only the user may connect, the files of the jobs keep the usual
+     * mode */
+    mask = umask(077);
+    ok = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    umask(mask);
+    if (!ok || listen(fd, DAEMON_BACKLOG) < 0)
+    {
+        log_error("Unable to listen on %s", socket_path);
+        close(fd);
+        return E_SERVER_CONNECTION;
+    }
+
+    /* accept() is interrupted to stop */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    log_notice("Listening on %s", socket_path);
+
+    while (!stopping)
+    {
+        if ((client_fd = accept(fd, NULL, NULL)) < 0)
+            continue;
+        fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+        serve_client(ops);
+        close(client_fd);
+        client_fd = -1;
+    }
+
+    close(fd);
+    unlink(socket_path);
+    log_notice("Stopped");
+    return E_TUXUP_NOERROR;
+}
+
+/*
+ * Client
+ */
+
+/** Event received by a client */
+typedef struct
+{
+    char event[16];
+    char level[16];
+    char text[1024];
+    char mem[8];
+    int code;
+    int cpu_address;
+    int sent;
+    int pages;
+} daemon_reply_t;
+
+static bool reply_member(void *ctx, const char *key, const char **p)
+{
+    daemon_reply_t *reply = ctx;
+
+    if (!strcmp(key, "event"))
+        return json_string(p, reply->event, sizeof(reply->event));
+    if (!strcmp(key, "level"))
+        return json_string(p, reply->level, sizeof(reply->level));
+    if (!strcmp(key, "text"))
+        return json_string(p, reply->text, sizeof(reply->text));
+    if (!strcmp(key, "mem"))
+        return json_string(p, reply->mem, sizeof(reply->mem));
+    if (!strcmp(key, "code"))
+        return json_int(p, &reply->code);
+    if (!strcmp(key, "cpu_address"))
+        return json_int(p, &reply->cpu_address);
+    if (!strcmp(key, "sent"))
+        return json_int(p, &reply->sent);
+    if (!strcmp(key, "pages"))
+        return json_int(p, &reply->pages);
+    return json_skip(p);
+}
+
+/**
+ * Print an event as tuxup would have printed it. Returns true once the
+ * job is done.
+ */
+static bool print_reply(const daemon_reply_t *reply)
+{
+    log_level_t level;
+
+    if (!strcmp(reply->event, "log"))
+    {
+        for (level = LOG_LEVEL_DEBUG; level < LOG_LEVEL_NONE; level++)
+        {
+            if (!strcmp(reply->level, log_level_name(level)))
+                break;
+        }
+        if (level < LOG_LEVEL_NONE)
+            log_text(level, "%s", reply->text);
+    }
+    else if (!strcmp(reply->event, "progress") && reply->pages > 0)
+    {
+        if (reply->sent == 0)
+            printf("%s 0x%02x: %d pages\n",
+                   strcmp(reply->mem, "eeprom") ? "FLASH" : "EEPROM",
+                   reply->cpu_address, reply->pages);
+        else
+            printf("%s %3d%%\n",
+                   strcmp(reply->mem, "eeprom") ? "FLASH" : "EEPROM",
+                   reply->sent * 100 / reply->pages);
+        fflush(stdout);
+    }
+    /* The version events repeat messages already received */
+    return !strcmp(reply->event, "done");
+}
+
+/**
+ * \brief Send a job to the daemon listening on socket_path and print its
+ * events until it is done
+ * \return the exit code of the job
+ */
+int daemon_submit(const char *socket_path, const daemon_request_t *request)
+{
+    static char buffer[DAEMON_LINE_SIZE];
+    struct sockaddr_un addr;
+    daemon_reply_t reply;
+    size_t len = 0;
+    ssize_t n;
+    char *eol;
+    int fd;
+
+    if (!socket_address(&addr, socket_path))
+        return E_TUXUP_USAGE;
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+        || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        log_error("No tuxup daemon is listening on %s", socket_path);
+        if (fd >= 0)
+            close(fd);
+        return E_SERVER_CONNECTION;
+    }
+    format_request(request, buffer, sizeof(buffer));
+    if (!write_all(fd, buffer, strlen(buffer)))
+    {
+        log_error("Unable to send the job to the tuxup daemon");
+        close(fd);
+        return E_SERVER_CONNECTION;
+    }
+
+    for (;;)
+    {
+        n = read(fd, buffer + len, sizeof(buffer) - 1 - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+        buffer[len] = '\0';
+        while ((eol = strchr(buffer, '\n')) != NULL)
+        {
+            *eol = '\0';
+            memset(&reply, 0, sizeof(reply));
+            if (json_object(buffer, reply_member, &reply)
+                && print_reply(&reply))
+            {
+                close(fd);
+                return reply.code;
+            }
+            len -= eol + 1 - buffer;
+            memmove(buffer, eol + 1, len + 1);
+        }
+        if (len == sizeof(buffer) - 1)
+            len = 0;
+    }
+    log_error("The tuxup daemon closed the connection");
+    close(fd);
+    return E_SERVER_CONNECTION;
+}
@@ -0,0 +1,78 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+#include <limits.h>
+#include "transport.h"
+
+/** Files a job can program */
+#define DAEMON_FILES_MAX    16
+
+/** Jobs of the daemon */
+typedef enum
+{
+    DAEMON_FLASH,                   /* Program files */
+    DAEMON_VERIFY,                  /* Tell which CPUs run the files */
+    DAEMON_VERSION                  /* Versions of the CPUs */
+} daemon_job_t;
+
+/**
+ * Request of a client, sent as one JSON object per line:
+ * {"id": "1", "job": "flash", "files": ["/abs/tuxcore.hex"], "full": true}
+ * "main" or "all" give a folder or a bundle instead of the files.
+ */
+typedef struct
+{
+    char id[64];                    /* Echoed in the events of the job */
+    daemon_job_t job;
+    char mode[8];                   /* "", "main" or "all" */
+    char path[PATH_MAX];            /* Folder or bundle of main and all */
+    char files[DAEMON_FILES_MAX][PATH_MAX];
+    int file_count;
+    char device[TRANSPORT_DEVICE_SIZE];
+    bool full;
+    bool skip_blank;
+    bool update;
+    bool pretend;
+} daemon_request_t;
+
+/** What tuxup does for the jobs, returning exit codes of tuxup */
+typedef struct
+{
+    /** In the daemon: connect the dongle, the job only runs if it worked */
+    int (*prepare)(const daemon_request_t *request);
+    /** In a child process of the daemon: the job itself */
+    int (*run)(const daemon_request_t *request);
+    /** In the daemon, with the exit code of the job */
+    void (*finish)(const daemon_request_t *request, int code);
+} daemon_ops_t;
+
+/* Prototypes */
+void daemon_socket_path(char *path, size_t size);
+int daemon_serve(const char *socket_path, const daemon_ops_t *ops);
+void daemon_event(const char *event, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+int daemon_submit(const char *socket_path, const daemon_request_t *request);
+
+#endif /* DAEMON_H */
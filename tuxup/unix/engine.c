@@ -0,0 +1,507 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   engine.c
+ *
+ *   @brief  Bootloads many dongles from a single thread.
+ *
+ *   The protocol of bootloader.c is expressed as a state machine per
+ *   session: INIT, FILLPAGE for each page, then EXIT. A command is sent
+ *   when the fd of the dongle is writable and its status frame is read
+ *   when the fd is readable, so one epoll loop keeps all the dongles busy
+ *   without a thread or a process each. Only hidraw gives an fd per dongle
+ *   that can be polled, the sessions are opened on hidraw devices.
+ *
+ *   Another event loop can drive the sessions instead of
+ *   tuxup_sessions_run(): watch the fd of tuxup_session_poll_fd() for the
+ *   events it returns, call tuxup_session_step() when they fire or when
+ *   tuxup_session_timeout() expires, and ask for the events again after
+ *   each step.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "engine.h"
+#include "bootloader.h"
+#include "tux-api.h"
+#include "tux_hid_unix.h"
+#include "tux_hidraw_unix.h"
+#include "usb-connection.h"
+#include "log.h"
+#include "stats.h"
+#include "timer.h"
+
+/* Time given to the dongle to reply, as bootloader.c does */
+#define SESSION_TIMEOUT         5000    /* ms */
+/* Events handled by each call to epoll_wait() */
+#define ENGINE_EVENTS           32
+
+/** What a session is waiting for */
+typedef enum
+{
+    WAIT_SEND,                      /* The fd to be writable */
+    WAIT_REPLY,                     /* The status frame of the command */
+    WAIT_PAUSE                      /* The end of the eeprom pause */
+} session_wait_t;
+
+struct tuxup_session
+{
+    char device[TRANSPORT_DEVICE_SIZE];
+    int fd;
+    hidraw_reports_t layout;
+    const tuxfw_t *fw;
+    bool skip_blank;
+    uint8_t cpu_address;
+    tuxup_session_state_t state;
+    session_wait_t wait;
+    uint64_t deadline;              /* Of the reply or of the pause, in ms */
+    uint8_t expected;               /* Value of the status frame awaited */
+    unsigned int page;              /* Page of the image being sent */
+    unsigned int count;             /* Pages to send */
+    unsigned int sent;              /* Pages acknowledged */
+    unsigned int tenths;            /* Progress printed */
+    bool registered;                /* The fd is in the epoll set */
+    uint32_t armed;                 /* Events registered */
+    uint64_t start;                 /* Creation of the session, in ms */
+    uint64_t done;                  /* End of the bootloading, in ms */
+};
+
+static const char *mem_name(const tuxup_session_t *session)
+{
+    return session->fw->header->mem_type == EEPROM ? "EEPROM" : "FLASH";
+}
+
+static void session_fail(tuxup_session_t *session, const char *reason)
+{
+    log_error("[%s] %s", session->device, reason);
+    session->state = TUXUP_SESSION_FAILED;
+}
+
+/**
+ * Index of the first page to send from page i, the number of pages if
+ * there is none left.
+ */
+static unsigned int next_page(const tuxup_session_t *session, unsigned int i)
+{
+    while (i < session->fw->header->page_count && session->skip_blank
+           && tuxfw_page_is_blank(session->fw, i))
+        i++;
+    return i;
+}
+
+/**
+ * Send a report, framed as hidraw expects.
+ */
+static bool send_report(tuxup_session_t *session, const uint8_t *data,
+                        int size)
+{
+    uint8_t report[HIDRAW_FRAME_SIZE_MAX];
+    int len;
+
+    if ((len = tux_hidraw_frame(&session->layout, data, size, report)) < 0)
+        return false;
+    stats_add(STATS_SYSCALLS, 1);
+    if (write(session->fd, report, len) != len)
+        return false;
+    stats_add(STATS_TRANSFERS, 1);
+    stats_add(STATS_BYTES_SENT, size);
+    return true;
+}
+
+/**
+ * Read a report without blocking. Returns 1 if one has been read in frame,
+ * 0 if none is queued, -1 if the device is gone.
+ */
+static int read_report(tuxup_session_t *session, uint8_t *frame)
+{
+    uint8_t report[HIDRAW_FRAME_SIZE_MAX];
+    const uint8_t *payload;
+    ssize_t len;
+    int size;
+
+    stats_add(STATS_SYSCALLS, 1);
+    len = read(session->fd, report, sizeof(report));
+    if (len < 0)
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    if (len == 0)
+        return 0;
+    size = tux_hidraw_unframe(&session->layout, report, len, &payload);
+    if (size > TRANSPORT_REPORT_SIZE)
+        size = TRANSPORT_REPORT_SIZE;
+    memset(frame, 0, TRANSPORT_REPORT_SIZE);
+    memcpy(frame, payload, size);
+    stats_add(STATS_TRANSFERS, 1);
+    stats_add(STATS_BYTES_RECEIVED, size);
+    return 1;
+}
+
+/**
+ * Send the command of the current state: the reports queued before it
+ * can't be its reply and are dropped.
+ */
+static bool send_command(tuxup_session_t *session)
+{
+    uint8_t frame[TRANSPORT_REPORT_SIZE];
+    uint8_t first[FILLPAGE_FIRST_SIZE], second[FILLPAGE_SECOND_SIZE];
+    int size;
+
+    while (read_report(session, frame) > 0)
+        ;
+
+    switch (session->state)
+    {
+    case TUXUP_SESSION_INIT:
+        size = bootload_init_command(session->cpu_address, first);
+        session->expected = BOOT_INIT_ACK;
+        if (!send_report(session, first, size))
+            return false;
+        break;
+    case TUXUP_SESSION_FILLPAGE:
+        bootload_fillpage_packets(tuxfw_segment(session->fw, session->page),
+                                  session->fw->header->mem_type, first,
+                                  second);
+        session->expected = (uint8_t)(session->sent + 1);
+        if (!send_report(session, first, sizeof(first))
+            || !send_report(session, second, sizeof(second)))
+            return false;
+        break;
+    default:
+        size = bootload_exit_command(first);
+        session->expected = BOOT_EXIT_ACK;
+        if (!send_report(session, first, size))
+            return false;
+        break;
+    }
+    session->wait = WAIT_REPLY;
+    session->deadline = timer_deadline_ms(SESSION_TIMEOUT);
+    return true;
+}
+
+/**
+ * Go to the command of state. The pages of eeprom are sent after a pause.
+ */
+static void next_command(tuxup_session_t *session,
+                         tuxup_session_state_t state)
+{
+    session->state = state;
+    if (state == TUXUP_SESSION_FILLPAGE
+        && session->fw->header->mem_type == EEPROM)
+    {
+        session->wait = WAIT_PAUSE;
+        session->deadline = timer_deadline_ms(BOOTLOAD_EEPROM_PAUSE);
+    }
+    else
+        session->wait = WAIT_SEND;
+}
+
+static void print_progress(tuxup_session_t *session)
+{
+    while (session->sent * 10 / session->count > session->tenths)
+    {
+        session->tenths++;
+        printf("[%s] %s %3u%%\n", session->device, mem_name(session),
+               session->tenths * 10);
+    }
+    fflush(stdout);
+}
+
+/**
+ * Handle a report received while waiting for the reply of a command.
+ */
+static void handle_frame(tuxup_session_t *session, const uint8_t *frame)
+{
+    if (!bootload_is_status(frame, session->expected))
+    {
+        stats_add(STATS_RETRIES, 1);
+        return;
+    }
+
+    switch (session->state)
+    {
+    case TUXUP_SESSION_INIT:
+        session->page = next_page(session, 0);
+        next_command(session,
+                     session->page < session->fw->header->page_count
+                     ? TUXUP_SESSION_FILLPAGE : TUXUP_SESSION_EXIT);
+        break;
+    case TUXUP_SESSION_FILLPAGE:
+        if (frame[1] != 0)
+        {
+            session_fail(session, "Bootloading failed, program aborted at "
+                         "dongle reply");
+            return;
+        }
+        session->sent++;
+        print_progress(session);
+        session->page = next_page(session, session->page + 1);
+        next_command(session,
+                     session->page < session->fw->header->page_count
+                     ? TUXUP_SESSION_FILLPAGE : TUXUP_SESSION_EXIT);
+        break;
+    default:
+        session->state = TUXUP_SESSION_DONE;
+        session->done = timer_now_ms();
+        break;
+    }
+}
+
+/**
+ * \brief Start the bootloading of an image on the dongle at device
+ *
+ * The image must outlive the session. Nothing is sent before the first
+ * step.
+ *
+ * \param device       hidraw device of the dongle
+ * \param cpu_address  Bootloader address of the CPU to program
+ * \param skip_blank   Don't send the pages only holding 0xFF
+ * \return the session, NULL if the dongle can't be opened
+ */
+tuxup_session_t *tuxup_session_new(const char *device, uint8_t cpu_address,
+                                   const tuxfw_t *fw, bool skip_blank)
+{
+    tuxup_session_t *session;
+    unsigned int i;
+
+    if ((session = calloc(1, sizeof(tuxup_session_t))) == NULL)
+        return NULL;
+    snprintf(session->device, sizeof(session->device), "%s", device);
+    session->fd = tux_hidraw_open(device, TUX_VENDOR_ID, TUX_PRODUCT_ID,
+                                  &session->layout);
+    if (session->fd < 0)
+    {
+        log_error("The dongle %s was not found", device);
+        free(session);
+        return NULL;
+    }
+    fcntl(session->fd, F_SETFL, fcntl(session->fd, F_GETFL) | O_NONBLOCK);
+
+    session->fw = fw;
+    session->skip_blank = skip_blank;
+    session->cpu_address = cpu_address;
+    for (i = next_page(session, 0); i < fw->header->page_count;
+         i = next_page(session, i + 1))
+        session->count++;
+    session->state = TUXUP_SESSION_INIT;
+    session->wait = WAIT_SEND;
+    session->start = timer_now_ms();
+    printf("[%s] %s 0x%02x: %u pages\n", session->device, mem_name(session),
+           cpu_address, session->count);
+    return session;
+}
+
+/**
+ * \brief File descriptor to watch for the session
+ * \param events  Set to the epoll events awaited, 0 while the session only
+ * waits for its timeout or is over
+ */
+int tuxup_session_poll_fd(const tuxup_session_t *session, uint32_t *events)
+{
+    if (session->state >= TUXUP_SESSION_DONE)
+        *events = 0;
+    else if (session->wait == WAIT_SEND)
+        *events = EPOLLOUT;
+    else if (session->wait == WAIT_REPLY)
+        *events = EPOLLIN;
+    else
+        *events = 0;
+    return session->fd;
+}
+
+/**
+ * \brief Time after which the session must be stepped even if its fd isn't
+ * ready, in ms; -1 if there is none
+ */
+int tuxup_session_timeout(const tuxup_session_t *session)
+{
+    if (session->state >= TUXUP_SESSION_DONE || session->wait == WAIT_SEND)
+        return -1;
+    return timer_remaining_ms(session->deadline);
+}
+
+/**
+ * \brief Advance the session as far as it can go without blocking
+ * \param events  epoll events that fired on its fd, 0 when only called for
+ * its timeout
+ * \return the state the session is in after the step
+ */
+tuxup_session_state_t tuxup_session_step(tuxup_session_t *session,
+                                         uint32_t events)
+{
+    uint8_t frame[TRANSPORT_REPORT_SIZE];
+    int ret = 1;
+
+    if (session->state >= TUXUP_SESSION_DONE)
+        return session->state;
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        session_fail(session, "The dongle has been disconnected");
+        return session->state;
+    }
+
+    switch (session->wait)
+    {
+    case WAIT_PAUSE:
+        if (timer_remaining_ms(session->deadline) == 0)
+            session->wait = WAIT_SEND;
+        break;
+    case WAIT_SEND:
+        if ((events & EPOLLOUT) && !send_command(session))
+            session_fail(session, "Unable to send to the dongle");
+        break;
+    case WAIT_REPLY:
+        while ((events & EPOLLIN) && session->wait == WAIT_REPLY
+               && session->state < TUXUP_SESSION_DONE
+               && (ret = read_report(session, frame)) > 0)
+            handle_frame(session, frame);
+        if (ret < 0)
+            session_fail(session, "The dongle has been disconnected");
+        else if (session->wait == WAIT_REPLY
+                 && session->state < TUXUP_SESSION_DONE
+                 && timer_remaining_ms(session->deadline) == 0)
+            session_fail(session, session->state == TUXUP_SESSION_INIT
+                         ? "Initialization failed"
+                         : "Bootloading failed, no reply from the dongle");
+        break;
+    }
+    return session->state;
+}
+
+/**
+ * \brief Device the session programs
+ */
+const char *tuxup_session_device(const tuxup_session_t *session)
+{
+    return session->device;
+}
+
+/**
+ * \brief Time the session took to program its image, in ms, 0 if it isn't
+ * done
+ */
+uint64_t tuxup_session_elapsed_ms(const tuxup_session_t *session)
+{
+    return session->state == TUXUP_SESSION_DONE
+           ? session->done - session->start : 0;
+}
+
+/**
+ * \brief Close the dongle of a session and release it
+ */
+void tuxup_session_free(tuxup_session_t *session)
+{
+    if (session == NULL)
+        return;
+    close(session->fd);
+    free(session);
+}
+
+/**
+ * Register the events a session waits for. Returns false once the session
+ * is over, its fd is then removed.
+ */
+static bool engine_update(int epfd, tuxup_session_t *session)
+{
+    struct epoll_event event;
+    uint32_t events;
+    int op;
+
+    memset(&event, 0, sizeof(event));
+    if (session->state >= TUXUP_SESSION_DONE)
+    {
+        if (session->registered)
+            epoll_ctl(epfd, EPOLL_CTL_DEL, session->fd, &event);
+        session->registered = false;
+        return false;
+    }
+
+    tuxup_session_poll_fd(session, &events);
+    if (session->registered && events == session->armed)
+        return true;
+    event.events = events;
+    event.data.ptr = session;
+    op = session->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    stats_add(STATS_SYSCALLS, 1);
+    if (epoll_ctl(epfd, op, session->fd, &event) < 0)
+    {
+        session_fail(session, "Unable to watch the dongle");
+        return engine_update(epfd, session);
+    }
+    session->registered = true;
+    session->armed = events;
+    return true;
+}
+
+/**
+ * \brief Run sessions until they are all over, from a single epoll loop
+ * \return the number of sessions that failed
+ */
+int tuxup_sessions_run(tuxup_session_t **sessions, int count)
+{
+    struct epoll_event ready[ENGINE_EVENTS];
+    int epfd, i, n, timeout, running, failed = 0;
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        log_error("Unable to create the event loop");
+        return count;
+    }
+
+    for (;;)
+    {
+        timeout = -1;
+        for (i = running = 0; i < count; i++)
+        {
+            if (!engine_update(epfd, sessions[i]))
+                continue;
+            running++;
+            n = tuxup_session_timeout(sessions[i]);
+            if (n >= 0 && (timeout < 0 || n < timeout))
+                timeout = n;
+        }
+        if (running == 0)
+            break;
+
+        stats_add(STATS_SYSCALLS, 1);
+        n = epoll_wait(epfd, ready, ENGINE_EVENTS, timeout);
+        for (i = 0; i < n; i++)
+            tuxup_session_step(ready[i].data.ptr, ready[i].events);
+        /* The sessions whose timeout expired */
+        for (i = 0; i < count; i++)
+            tuxup_session_step(sessions[i], 0);
+    }
+    close(epfd);
+
+    for (i = 0; i < count; i++)
+    {
+        if (sessions[i]->state == TUXUP_SESSION_FAILED)
+            failed++;
+    }
+    return failed;
+}
@@ -0,0 +1,58 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tuxfw.h"
+
+/** States of a session, gone through in that order */
+typedef enum
+{
+    TUXUP_SESSION_INIT,             /* Entering the bootloader */
+    TUXUP_SESSION_FILLPAGE,         /* Sending the pages */
+    TUXUP_SESSION_EXIT,             /* Leaving the bootloader */
+    TUXUP_SESSION_DONE,             /* All the pages have been written */
+    TUXUP_SESSION_FAILED
+} tuxup_session_state_t;
+
+/**
+ * Bootloading of one image on one dongle, advanced by
+ * tuxup_session_step() each time the fd of the dongle is ready or the
+ * timeout of the session expires.
+ */
+typedef struct tuxup_session tuxup_session_t;
+
+/* Prototypes */
+tuxup_session_t *tuxup_session_new(const char *device, uint8_t cpu_address,
+                                   const tuxfw_t *fw, bool skip_blank);
+int tuxup_session_poll_fd(const tuxup_session_t *session, uint32_t *events);
+int tuxup_session_timeout(const tuxup_session_t *session);
+tuxup_session_state_t tuxup_session_step(tuxup_session_t *session,
+                                         uint32_t events);
+const char *tuxup_session_device(const tuxup_session_t *session);
+uint64_t tuxup_session_elapsed_ms(const tuxup_session_t *session);
+void tuxup_session_free(tuxup_session_t *session);
+int tuxup_sessions_run(tuxup_session_t **sessions, int count);
+
+#endif /* ENGINE_H */
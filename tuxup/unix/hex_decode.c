@@ -0,0 +1,215 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   hex_decode.c
+ *
+ *   @brief  Conversion of ASCII hex digits to bytes, with the sum of the
+ *   bytes used by the Intel HEX checksum.
+ *
+ *   On x86, the digits are converted 32 (AVX2) or 16 (SSE2) at a time. The
+ *   remaining digits, and all of them on other architectures, go through a
+ *   lookup table. In every case the validity of the digits is accumulated
+ *   in a mask that is only tested once at the end.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hex_decode.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && defined(__SSE2__)
+#define HEX_DECODE_X86
+#include <immintrin.h>
+#endif
+
+/* Value of a hex digit, with bit 4 set. Other characters are 0. */
+#define DIGIT(c, v)     [c] = 0x10 | (v)
+static const uint8_t hex_value[256] = {
+    DIGIT('0', 0), DIGIT('1', 1), DIGIT('2', 2), DIGIT('3', 3),
+    DIGIT('4', 4), DIGIT('5', 5), DIGIT('6', 6), DIGIT('7', 7),
+    DIGIT('8', 8), DIGIT('9', 9),
+    DIGIT('A', 10), DIGIT('B', 11), DIGIT('C', 12),
+    DIGIT('D', 13), DIGIT('E', 14), DIGIT('F', 15),
+    DIGIT('a', 10), DIGIT('b', 11), DIGIT('c', 12),
+    DIGIT('d', 13), DIGIT('e', 14), DIGIT('f', 15),
+};
+
+#ifdef HEX_DECODE_X86
+
+/**
+ * Convert 16 hex digits to 8 bytes, in the low bytes of the 16 bits lanes.
+ * The lanes holding an invalid digit are flagged in bad.
+ */
+static inline __m128i sse2_decode(__m128i v, __m128i *bad)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    __m128i digit, letter, is_digit, is_letter, value;
+
+    /* Unsigned range checks done as signed compares on biased bytes */
+    digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    letter = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+                          _mm_set1_epi8('a'));
+    is_digit = _mm_cmplt_epi8(_mm_xor_si128(digit, bias),
+                              _mm_set1_epi8((char)(0x80 + 10)));
+    is_letter = _mm_cmplt_epi8(_mm_xor_si128(letter, bias),
+                               _mm_set1_epi8((char)(0x80 + 6)));
+    value = _mm_or_si128(_mm_and_si128(digit, is_digit),
+                         _mm_and_si128(_mm_add_epi8(letter,
+                                                    _mm_set1_epi8(10)),
+                                       is_letter));
+    *bad = _mm_or_si128(*bad, _mm_cmpeq_epi8(_mm_or_si128(is_digit,
+                                                          is_letter),
+                                             _mm_setzero_si128()));
+
+    /* High nibble first in memory, so in the low byte of each lane */
+    value = _mm_or_si128(_mm_slli_epi16(value, 4), _mm_srli_epi16(value, 8));
+    return _mm_and_si128(value, _mm_set1_epi16(0x00FF));
+}
+
+/**
+ * Convert the digits 16 at a time. Returns the number of bytes written.
+ */
+static unsigned int decode_sse2(const char *text, unsigned int len,
+                                uint8_t *out, uint8_t *sum, bool *ok)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero, bad = zero, bytes;
+    unsigned int i;
+
+    for (i = 0; i + 8 <= len; i += 8)
+    {
+        bytes = sse2_decode(_mm_loadu_si128((const __m128i *)(text + 2 * i)),
+                            &bad);
+        bytes = _mm_packus_epi16(bytes, zero);
+        _mm_storel_epi64((__m128i *)(out + i), bytes);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(bytes, zero));
+    }
+    *sum += (uint8_t)_mm_cvtsi128_si32(acc);
+    if (_mm_movemask_epi8(bad))
+        *ok = false;
+    return i;
+}
+
+__attribute__ ((target("avx2")))
+static inline __m256i avx2_decode(__m256i v, __m256i *bad)
+{
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    __m256i digit, letter, is_digit, is_letter, value;
+
+    digit = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    letter = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)),
+                             _mm256_set1_epi8('a'));
+    is_digit = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 10)),
+                                 _mm256_xor_si256(digit, bias));
+    is_letter = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 6)),
+                                  _mm256_xor_si256(letter, bias));
+    value = _mm256_or_si256(_mm256_and_si256(digit, is_digit),
+                            _mm256_and_si256(_mm256_add_epi8(letter,
+                                                 _mm256_set1_epi8(10)),
+                                             is_letter));
+    *bad = _mm256_or_si256(*bad,
+                           _mm256_cmpeq_epi8(_mm256_or_si256(is_digit,
+                                                             is_letter),
+                                             _mm256_setzero_si256()));
+
+    value = _mm256_or_si256(_mm256_slli_epi16(value, 4),
+                            _mm256_srli_epi16(value, 8));
+    return _mm256_and_si256(value, _mm256_set1_epi16(0x00FF));
+}
+
+/**
+ * Convert the digits 32 at a time. Returns the number of bytes written.
+ */
+__attribute__ ((target("avx2")))
+static unsigned int decode_avx2(const char *text, unsigned int len,
+                                uint8_t *out, uint8_t *sum, bool *ok)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero, bad = zero, bytes;
+    __m128i total;
+    unsigned int i;
+
+    for (i = 0; i + 16 <= len; i += 16)
+    {
+        bytes = avx2_decode(_mm256_loadu_si256((const __m256i *)
+                                               (text + 2 * i)), &bad);
+        /* Packing works per 128 bits lane, bring the two halves together */
+        bytes = _mm256_packus_epi16(bytes, zero);
+        bytes = _mm256_permute4x64_epi64(bytes, 0xD8);
+        _mm_storeu_si128((__m128i *)(out + i),
+                         _mm256_castsi256_si128(bytes));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes, zero));
+    }
+    total = _mm_add_epi64(_mm256_castsi256_si128(acc),
+                          _mm256_extracti128_si256(acc, 1));
+    total = _mm_add_epi64(total, _mm_unpackhi_epi64(total, total));
+    *sum += (uint8_t)_mm_cvtsi128_si32(total);
+    if (_mm256_movemask_epi8(bad))
+        *ok = false;
+    return i;
+}
+
+static bool cpu_has_avx2(void)
+{
+    static int avx2 = -1;
+
+    if (avx2 < 0)
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    return avx2;
+}
+
+#endif /* HEX_DECODE_X86 */
+
+/**
+ * \brief Convert hex digits to bytes
+ * \param text  2 * len hex digits, upper or lower case
+ * \param len   Number of bytes to decode
+ * \param out   Decoded bytes
+ * \param sum   Sum of the decoded bytes, added to the value given
+ * \return false if a character is not a hex digit
+ */
+bool hex_decode(const char *text, unsigned int len, uint8_t *out,
+                uint8_t *sum)
+{
+    const unsigned char *s = (const unsigned char *)text;
+    unsigned int i = 0;
+    uint8_t valid = 0x10, hi, lo;
+    bool ok = true;
+
+#ifdef HEX_DECODE_X86
+    if (len >= 16 && cpu_has_avx2())
+        i = decode_avx2(text, len, out, sum, &ok);
+    i += decode_sse2(text + 2 * i, len - i, out + i, sum, &ok);
+#endif
+
+    for (; i < len; i++)
+    {
+        hi = hex_value[s[2 * i]];
+        lo = hex_value[s[2 * i + 1]];
+        valid &= hi & lo;
+        out[i] = (hi << 4) | (lo & 0x0F);
+        *sum += out[i];
+    }
+    return ok && valid;
+}
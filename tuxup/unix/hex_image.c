@@ -0,0 +1,431 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   hex_image.c
+ *
+ *   @brief  Loads an Intel HEX file in memory, as the list of pages that
+ *   will be sent to the bootloader.
+ *
+ *   The file is read once. Data records are merged in a sparse page map,
+ *   so that records given out of order or overlapping each other build
+ *   complete pages. The version record and the number of pages to program
+ *   are taken from the same pass.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hex_image.h"
+#include "hex_decode.h"
+#include "hex_scanner.h"
+#include "log.h"
+
+#define TRUE    1
+#define FALSE   0
+
+/* Byte count, address and record type */
+#define RECORD_HEADER   4
+
+/* Intel HEX record types */
+#define RECORD_DATA     0
+#define RECORD_EOF      1
+#define RECORD_EXT_SEG  2           /* Extended segment address */
+#define RECORD_START_SEG 3          /* Start segment address */
+#define RECORD_EXT_LIN  4           /* Extended linear address */
+#define RECORD_START_LIN 5          /* Start linear address */
+
+/** Page map used while loading */
+typedef struct
+{
+    hex_image_t *image;
+    unsigned int page_max;          /* Number of pages allocated */
+    uint32_t *index;                /* Hash table: page number + 1, 0 if free */
+    uint32_t base;                  /* Base address from the last extended
+                                       address record */
+    unsigned int index_mask;
+    hex_page_t *last;               /* Last page used, records are mostly
+                                       contiguous */
+} page_map_t;
+
+/**
+ * Return the page starting at addr, creating it if needed.
+ */
+static hex_page_t *get_page(page_map_t *map, uint32_t addr)
+{
+    hex_image_t *image = map->image;
+    uint32_t page_nbr = addr / HEX_PAGE_SIZE;
+    unsigned int slot = (page_nbr * 2654435761u) & map->index_mask;
+    hex_page_t *page;
+
+    if (map->last && map->last->addr == addr)
+        return map->last;
+
+    while (map->index[slot])
+    {
+        page = &image->pages[map->index[slot] - 1];
+        if (page->addr == addr)
+        {
+            map->last = page;
+            return page;
+        }
+        slot = (slot + 1) & map->index_mask;
+    }
+
+    if (image->page_count >= map->page_max)
+        return NULL;
+
+    page = &image->pages[image->page_count++];
+    page->addr = addr;
+    memset(page->data, 0xFF, HEX_PAGE_SIZE);
+    map->index[slot] = image->page_count;
+    map->last = page;
+    return page;
+}
+
+/**
+ * Store the data of a record in the page map.
+ */
+static int store_data(page_map_t *map, uint32_t addr, const uint8_t *data,
+                      unsigned int len)
+{
+    hex_page_t *page;
+    unsigned int i, offset, count;
+
+    for (i = 0; i < len; i += count)
+    {
+        offset = (addr + i) % HEX_PAGE_SIZE;
+        count = HEX_PAGE_SIZE - offset;
+        if (count > len - i)
+            count = len - i;
+
+        page = get_page(map, addr + i - offset);
+        if (page == NULL)
+            return FALSE;
+        memcpy(&page->data[offset], &data[i], count);
+    }
+    return TRUE;
+}
+
+/**
+ * Look for the version record: 12 bytes at 0x0EF0 (RF) or 0x1DF0 (tuxcore
+ * and tuxaudio), or anywhere for the USB CPU, starting with the C8 version
+ * command.
+ */
+static void check_version(hex_image_t *image, uint32_t addr,
+                          const uint8_t *data, unsigned int len)
+{
+    if (image->has_version || len != 0x0C || data[0] != 0xC8)
+        return;
+
+    if (addr == 0x0EF0 || addr == 0x1DF0 || data[1] == FUXUSB_CPU_NUM)
+    {
+        image->version.version_cmd = data[0];
+        image->version.cpu_nbr = data[1] & 0x7;     /* 3 lower bits */
+        image->version.ver_major = data[1] >> 3;    /* 5 higher bits */
+        image->version.ver_minor = data[2];
+        image->version.ver_update = data[3];
+        image->has_version = true;
+    }
+}
+
+/**
+ *   Parses a single line from an Intel Hex file.
+ *
+ *   The Intel Hex format looks like this:
+ *
+ *   : BC AAAA TT HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH CC <CR>
+ *
+ *   Note: Number of H's varies with data ..... this is example only.
+ *   Note: Spaces added for clarity
+ *
+ *   :     Start of record character
+ *   BC    Byte count
+ *   AAAA  Address to load data.  (tells receiving device where to load)
+ *   TT    Record type. (00=Data record, 01=End of file. No data in EOF record,
+ *         02=Extended segment address, 04=Extended linear address, 03 and
+ *         05=Start address, ignored)
+ *   HH    Each H is one ASCII hex digit.  (2 hex digits=1 byte)
+ *   CC    Checksum of all bytes in record (BC+AAAA+TT+HH......HH+CC=0)
+ *
+ *   See: http://www.xess.com/faq/intelhex.pdf for the complete spec
+ *
+ *   The line isn't null terminated, it holds len characters. Records can
+ *   hold up to 255 data bytes.
+ *
+ *   @return 1 to continue, 0 at the end of file record, -1 on error.
+ */
+static int parseIHexLine(page_map_t *map, const char *line, size_t len,
+                         unsigned lineNum)
+{
+    uint8_t record[RECORD_HEADER + 256];
+    uint8_t checksum = 0;
+    unsigned int dataLen;
+    unsigned short addr;
+    unsigned char recType;
+
+    if (len == 0 || line[0] != ':')
+    {
+        /* In Intel Hex format, lines which don't start with ':' are
+           supposed to be ignored */
+        return 1;
+    }
+
+    if (len < 1 + 2 * RECORD_HEADER
+        || !hex_decode(&line[1], RECORD_HEADER, record, &checksum))
+    {
+        log_error("line %u: invalid record header", lineNum);
+        return -1;
+    }
+    dataLen = record[0];
+    addr = (unsigned short)record[1] << 8 | record[2];
+    recType = record[3];
+
+    /* Data followed by the checksum */
+    if (len < 1 + 2 * (RECORD_HEADER + dataLen + 1))
+    {
+        log_error("line %u: missing checksum", lineNum);
+        return -1;
+    }
+    if (!hex_decode(&line[1 + 2 * RECORD_HEADER], dataLen + 1,
+                    &record[RECORD_HEADER], &checksum))
+    {
+        log_error("line %u: expecting hex digit", lineNum);
+        return -1;
+    }
+
+    if (checksum != 0)
+    {
+        log_error("line %u: found checksum 0x%02x, expecting 0x%02x",
+                  lineNum, record[RECORD_HEADER + dataLen],
+                  (unsigned char)(record[RECORD_HEADER + dataLen]
+                                  - checksum));
+        return -1;
+    }
+
+    switch (recType)
+    {
+    case RECORD_DATA:
+        check_version(map->image, map->base + addr, &record[RECORD_HEADER],
+                      dataLen);
+        if (!store_data(map, map->base + addr, &record[RECORD_HEADER],
+                        dataLen))
+        {
+            log_error("line %u: page map overflow", lineNum);
+            return -1;
+        }
+        return 1;
+
+    case RECORD_EXT_SEG:
+    case RECORD_EXT_LIN:
+        if (dataLen != 2)
+        {
+            log_error("line %u: invalid extended address record", lineNum);
+            return -1;
+        }
+        map->base = (uint32_t)record[RECORD_HEADER] << 8
+                    | record[RECORD_HEADER + 1];
+        /* Segment addresses are paragraphs of 16 bytes */
+        map->base <<= (recType == RECORD_EXT_SEG) ? 4 : 16;
+        return 1;
+
+    case RECORD_START_SEG:
+    case RECORD_START_LIN:
+        /* The bootloader always starts the application at 0 */
+        return 1;
+
+    case RECORD_EOF:
+        return 0;
+
+    default:
+        log_error("line %u: unrecognized record type: %d", lineNum, recType);
+        return -1;
+    }
+
+}                               // parseIHexLine
+
+/**
+ * Return an upper bound of the number of pages touched by the records of
+ * the file: each record can't span more than len / page size + 2 pages.
+ */
+static unsigned int count_pages(hex_scanner_t *scanner)
+{
+    hex_line_t line;
+    unsigned int pages = 0;
+    uint8_t dataLen, sum;
+
+    while (hex_scanner_next(scanner, &line))
+    {
+        if (line.len >= 3 && line.text[0] == ':'
+            && hex_decode(line.text + 1, 1, &dataLen, &sum))
+            pages += dataLen / HEX_PAGE_SIZE + 2;
+    }
+    hex_scanner_rewind(scanner);
+    return pages;
+}
+
+static int compare_pages(const void *a, const void *b)
+{
+    const hex_page_t *pa = a, *pb = b;
+
+    if (pa->addr < pb->addr)
+        return -1;
+    return pa->addr > pb->addr;
+}
+
+/**
+ * \brief Load an Intel HEX file in a page map
+ * \param filename  Intel HEX file
+ * \param image     Image filled with the pages of the file
+ * \return true if the whole file has been loaded
+ */
+bool hex_image_load(const char *filename, hex_image_t *image)
+{
+    page_map_t map;
+    unsigned int index_size;
+    hex_scanner_t scanner;
+    hex_line_t line;
+    int ret = 1;
+
+    memset(image, 0, sizeof(*image));
+    memset(&map, 0, sizeof(map));
+
+    if (!hex_scanner_open(&scanner, filename))
+        return false;
+
+    /* The pages and the hash table used to find them come from the same
+     * allocation, sized for the worst case */
+    map.image = image;
+    map.page_max = count_pages(&scanner);
+    for (index_size = 16; index_size < 2 * map.page_max; index_size *= 2)
+        ;
+    map.index_mask = index_size - 1;
+    image->arena = calloc(1, map.page_max * sizeof(hex_page_t)
+                          + index_size * sizeof(uint32_t));
+    if (image->arena == NULL)
+    {
+        log_error("Unable to allocate the page map");
+        hex_scanner_close(&scanner);
+        return false;
+    }
+    image->pages = image->arena;
+    map.index = (uint32_t *)(image->pages + map.page_max);
+
+    while (ret > 0 && hex_scanner_next(&scanner, &line))
+        ret = parseIHexLine(&map, line.text, line.len, scanner.line_num);
+    hex_scanner_close(&scanner);
+
+    if (ret < 0)
+    {
+        log_error("'%s' is not a valid hex file", filename);
+        hex_image_free(image);
+        return false;
+    }
+
+    qsort(image->pages, image->page_count, sizeof(hex_page_t),
+          compare_pages);
+    return true;
+}
+
+/**
+ * \brief Release the memory used by an image
+ */
+void hex_image_free(hex_image_t *image)
+{
+    free(image->arena);
+    image->arena = NULL;
+    image->pages = NULL;
+    image->page_count = 0;
+}
+
+/**
+ * \brief Raw bytes of the version record of the image, as the CPU sends
+ * them in reply to VERSION_CMD
+ *
+ * The layout of the version_bf_t bit field is left to the compiler, the
+ * bytes that are stored or compared must be built from its members.
+ */
+void hex_image_get_version(const hex_image_t *image, version_t *version)
+{
+    version->version_cmd = image->version.version_cmd;
+    version->cpu_ver_maj = CPU_VER_JOIN(image->version.cpu_nbr,
+                                        image->version.ver_major);
+    version->ver_minor = image->version.ver_minor;
+    version->ver_update = image->version.ver_update;
+}
+
+/**
+ * \brief Version record from the raw bytes sent by a CPU or stored in a
+ * file, the inverse of hex_image_get_version()
+ */
+void hex_version_from_raw(const version_t *raw, version_bf_t *version)
+{
+    version->version_cmd = raw->version_cmd;
+    version->cpu_nbr = CPU_VER_CPU(raw->cpu_ver_maj);
+    version->ver_major = CPU_VER_MAJ(raw->cpu_ver_maj);
+    version->ver_minor = raw->ver_minor;
+    version->ver_update = raw->ver_update;
+}
+
+/**
+ * \brief Check if a page only holds 0xFF, the content of an erased page
+ */
+bool hex_page_is_blank(const hex_page_t *page)
+{
+    int i;
+
+    for (i = 0; i < HEX_PAGE_SIZE; i++)
+    {
+        if (page->data[i] != 0xFF)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Remove the blank pages from the image
+ *
+ * A page that is not sent keeps its previous content as the bootloader
+ * only erases the pages it writes. This should then only be used when the
+ * CPU is known to be erased.
+ *
+ * \return the number of pages removed
+ */
+unsigned int hex_image_drop_blank_pages(hex_image_t *image)
+{
+    unsigned int i, count = 0;
+
+    for (i = 0; i < image->page_count; i++)
+    {
+        if (hex_page_is_blank(&image->pages[i]))
+            continue;
+        if (count != i)
+            image->pages[count] = image->pages[i];
+        count++;
+    }
+
+    i = image->page_count - count;
+    image->page_count = count;
+    return i;
+}
@@ -0,0 +1,60 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef HEX_IMAGE_H
+#define HEX_IMAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "common/defines.h"
+
+/** Size of the pages sent to the bootloader */
+#define HEX_PAGE_SIZE       64
+
+/** One page of the image, as it will be written in the CPU */
+typedef struct
+{
+    uint32_t addr;                  /* Address of the first byte */
+    uint8_t data[HEX_PAGE_SIZE];    /* Page content, 0xFF where not set */
+} hex_page_t;
+
+/**
+ * Firmware image loaded from an Intel HEX file. Only the pages touched by
+ * the data records are stored, sorted by address.
+ */
+typedef struct
+{
+    version_bf_t version;           /* Version record found in the image */
+    bool has_version;               /* The version record was found */
+    unsigned int page_count;        /* Number of pages */
+    hex_page_t *pages;              /* Pages sorted by address */
+    void *arena;                    /* Single allocation holding the pages */
+} hex_image_t;
+
+/* Prototypes */
+bool hex_image_load(const char *filename, hex_image_t *image);
+void hex_image_free(hex_image_t *image);
+void hex_image_get_version(const hex_image_t *image, version_t *version);
+void hex_version_from_raw(const version_t *raw, version_bf_t *version);
+bool hex_page_is_blank(const hex_page_t *page);
+unsigned int hex_image_drop_blank_pages(hex_image_t *image);
+
+#endif /* HEX_IMAGE_H */
@@ -0,0 +1,347 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   hex_scanner.c
+ *
+ *   @brief  Maps a text file in memory and returns its lines, without
+ *   copying them and without any limit on their length.
+ *
+ *   The standard input and the compressed files can't be mapped. They are
+ *   read, and decompressed, chunk by chunk in a buffer that is then split
+ *   in lines the same way. gzip needs 'make ZLIB=1' and zstd 'make ZSTD=1'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "hex_scanner.h"
+#include "log.h"
+
+/* Size of the chunks read from a stream */
+#define STREAM_CHUNK    65536
+
+/**
+ * Make room for len more bytes at the end of the buffer.
+ */
+static char *stream_reserve(hex_scanner_t *scanner, size_t *capacity,
+                            size_t len)
+{
+    char *buffer;
+
+    if (scanner->size + len > *capacity)
+    {
+        while (scanner->size + len > *capacity)
+            *capacity = *capacity ? 2 * *capacity : 4 * STREAM_CHUNK;
+        if ((buffer = realloc(scanner->map, *capacity)) == NULL)
+            return NULL;
+        scanner->map = buffer;
+    }
+    return (char *)scanner->map + scanner->size;
+}
+
+/**
+ * Read an uncompressed stream.
+ */
+static bool read_plain(hex_scanner_t *scanner, int fd)
+{
+    size_t capacity = 0;
+    ssize_t len;
+    char *buffer;
+
+    do
+    {
+        if ((buffer = stream_reserve(scanner, &capacity, STREAM_CHUNK))
+            == NULL)
+            return false;
+        if ((len = read(fd, buffer, STREAM_CHUNK)) > 0)
+            scanner->size += len;
+    }
+    while (len > 0);
+    return len == 0;
+}
+
+#ifdef USE_ZLIB
+/**
+ * Read a gzip stream.
+ */
+static bool read_gzip(hex_scanner_t *scanner, int fd)
+{
+    size_t capacity = 0;
+    gzFile gz;
+    char *buffer;
+    int len, gz_fd, err = Z_OK;
+
+    /* gzclose() closes the descriptor given, not the one of the caller */
+    if ((gz_fd = dup(fd)) < 0)
+        return false;
+    if ((gz = gzdopen(gz_fd, "rb")) == NULL)
+    {
+        close(gz_fd);
+        return false;
+    }
+    do
+    {
+        if ((buffer = stream_reserve(scanner, &capacity, STREAM_CHUNK))
+            == NULL)
+            len = -1;
+        else if ((len = gzread(gz, buffer, STREAM_CHUNK)) > 0)
+            scanner->size += len;
+    }
+    while (len > 0);
+    /* A truncated stream ends as if it was complete but sets an error */
+    gzerror(gz, &err);
+    gzclose(gz);
+    return len == 0 && err == Z_OK;
+}
+#endif
+
+#ifdef USE_ZSTD
+/**
+ * Read a zstd stream.
+ */
+static bool read_zstd(hex_scanner_t *scanner, int fd)
+{
+    static char chunk[STREAM_CHUNK];
+    size_t capacity = 0, ret = 0;
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    ssize_t len;
+    bool ok = true;
+
+    if ((dctx = ZSTD_createDCtx()) == NULL)
+        return false;
+    while (ok && (len = read(fd, chunk, sizeof(chunk))) > 0)
+    {
+        in.src = chunk;
+        in.size = len;
+        in.pos = 0;
+        while (ok && in.pos < in.size)
+        {
+            out.dst = stream_reserve(scanner, &capacity, STREAM_CHUNK);
+            if (out.dst == NULL)
+            {
+                ok = false;
+                break;
+            }
+            out.size = STREAM_CHUNK;
+            out.pos = 0;
+            ret = ZSTD_decompressStream(dctx, &out, &in);
+            ok = !ZSTD_isError(ret);
+            scanner->size += out.pos;
+        }
+    }
+    /* Flush what the decoder may still hold */
+    while (ok && ret != 0)
+    {
+        in.size = in.pos = 0;
+        out.dst = stream_reserve(scanner, &capacity, STREAM_CHUNK);
+        if (out.dst == NULL)
+        {
+            ok = false;
+            break;
+        }
+        out.size = STREAM_CHUNK;
+        out.pos = 0;
+        ret = ZSTD_decompressStream(dctx, &out, &in);
+        ok = !ZSTD_isError(ret) && out.pos > 0;
+        scanner->size += out.pos;
+    }
+    ZSTD_freeDCtx(dctx);
+    return ok && len == 0;
+}
+#endif
+
+/**
+ * \brief Compression of a file, from its name
+ * \return ".gz", ".zst" or NULL for a file that isn't compressed
+ */
+const char *hex_scanner_compression(const char *filename)
+{
+    const char *extension = strrchr(filename, '.');
+
+    if (extension && (!strcmp(extension, ".gz") || !strcmp(extension, ".zst")))
+        return extension;
+    return NULL;
+}
+
+/**
+ * Read a stream in memory, decompressing it if its name tells so.
+ */
+static bool read_stream(hex_scanner_t *scanner, const char *filename, int fd)
+{
+    const char *compression = hex_scanner_compression(filename);
+    bool ok = false;
+
+    scanner->buffered = true;
+    if (compression == NULL)
+        ok = read_plain(scanner, fd);
+    else if (!strcmp(compression, ".gz"))
+    {
+#ifdef USE_ZLIB
+        ok = read_gzip(scanner, fd);
+#else
+        log_error("tuxup has been built without gzip support");
+        return false;
+#endif
+    }
+    else
+    {
+#ifdef USE_ZSTD
+        ok = read_zstd(scanner, fd);
+#else
+        log_error("tuxup has been built without zstd support");
+        return false;
+#endif
+    }
+    if (!ok)
+        log_error("Unable to read file '%s'", filename);
+    return ok;
+}
+
+/**
+ * \brief Map a file in memory
+ * \return false if the file can't be opened or mapped
+ */
+bool hex_scanner_open(hex_scanner_t *scanner, const char *filename)
+{
+    struct stat st;
+    int fd;
+
+    memset(scanner, 0, sizeof(*scanner));
+
+    if (!strcmp(filename, HEX_SCANNER_STDIN))
+        fd = STDIN_FILENO;
+    else if ((fd = open(filename, O_RDONLY)) < 0)
+    {
+        log_error("Unable to open file '%s' for reading", filename);
+        return false;
+    }
+
+    if (fd == STDIN_FILENO || hex_scanner_compression(filename))
+    {
+        if (!read_stream(scanner, filename, fd))
+        {
+            hex_scanner_close(scanner);
+            if (fd != STDIN_FILENO)
+                close(fd);
+            return false;
+        }
+        if (fd != STDIN_FILENO)
+            close(fd);
+        scanner->pos = scanner->map;
+        return true;
+    }
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        log_error("Unable to read file '%s'", filename);
+        close(fd);
+        return false;
+    }
+
+    /* An empty file can't be mapped, it simply has no line */
+    if (st.st_size > 0)
+    {
+        scanner->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (scanner->map == MAP_FAILED)
+        {
+            log_error("Unable to map file '%s'", filename);
+            scanner->map = NULL;
+            close(fd);
+            return false;
+        }
+        scanner->size = st.st_size;
+        madvise(scanner->map, scanner->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    scanner->pos = scanner->map;
+    return true;
+}
+
+/**
+ * \brief Return the next line of the file
+ *
+ * The end of line, LF or CR LF, is not part of the line.
+ *
+ * \return false at the end of the file
+ */
+bool hex_scanner_next(hex_scanner_t *scanner, hex_line_t *line)
+{
+    const char *end = (const char *)scanner->map + scanner->size;
+    const char *eol;
+
+    if (scanner->pos == NULL || scanner->pos >= end)
+        return false;
+
+    eol = memchr(scanner->pos, '\n', end - scanner->pos);
+    if (eol == NULL)
+        eol = end;
+
+    line->text = scanner->pos;
+    line->len = eol - scanner->pos;
+    if (line->len && line->text[line->len - 1] == '\r')
+        line->len--;
+
+    scanner->pos = eol + 1;
+    scanner->line_num++;
+    return true;
+}
+
+/**
+ * \brief Go back to the first line of the file
+ */
+void hex_scanner_rewind(hex_scanner_t *scanner)
+{
+    scanner->pos = scanner->map;
+    scanner->line_num = 0;
+}
+
+/**
+ * \brief Unmap the file, or free the content of a stream
+ */
+void hex_scanner_close(hex_scanner_t *scanner)
+{
+    if (scanner->buffered)
+        free(scanner->map);
+    else if (scanner->map)
+        munmap(scanner->map, scanner->size);
+    scanner->buffered = false;
+    scanner->map = NULL;
+    scanner->pos = NULL;
+    scanner->size = 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef HEX_SCANNER_H
+#define HEX_SCANNER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/** Line of the file, pointing in the mapping. Not null terminated. */
+typedef struct
+{
+    const char *text;
+    size_t len;                     /* Without the end of line */
+} hex_line_t;
+
+/** File name standing for the standard input */
+#define HEX_SCANNER_STDIN   "-"
+
+/**
+ * File mapped in memory, or stream read in memory, split in lines. The
+ * standard input and the compressed files (.gz, .zst) are streams.
+ */
+typedef struct
+{
+    void *map;                      /* Content, NULL for an empty file */
+    size_t size;
+    bool buffered;                  /* map is allocated, not mapped */
+    const char *pos;                /* Start of the next line */
+    unsigned int line_num;          /* Number of the last line returned */
+} hex_scanner_t;
+
+/* Prototypes */
+bool hex_scanner_open(hex_scanner_t *scanner, const char *filename);
+bool hex_scanner_next(hex_scanner_t *scanner, hex_line_t *line);
+void hex_scanner_rewind(hex_scanner_t *scanner);
+void hex_scanner_close(hex_scanner_t *scanner);
+const char *hex_scanner_compression(const char *filename);
+
+#endif /* HEX_SCANNER_H */
@@ -0,0 +1,196 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   hotplug.c
+ *
+ *   @brief  Waits for USB devices to be plugged.
+ *
+ *   The uevents the kernel sends when a device is added are read from a
+ *   netlink socket, so a device is looked for again as soon as it is
+ *   enumerated instead of on a fixed period. The socket is opened before
+ *   the action that makes the device appear, so that its event can't be
+ *   missed:
+ *
+ *       hotplug_open();
+ *       while (!find_device() && hotplug_wait(vid, pid, deadline))
+ *           ;
+ *       hotplug_close();
+ *
+ *   The nodes of a device can still be missing, or not yet accessible,
+ *   when its event arrives. The device is then looked for again every
+ *   HOTPLUG_SETTLE ms. Without netlink, it is every HOTPLUG_PERIOD ms.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "hotplug.h"
+#include "log.h"
+#include "timer.h"
+
+/* Kernel multicast group of the uevents */
+#define UEVENT_GROUP        1
+/* Period of the lookups once the device has been added, in ms */
+#define HOTPLUG_SETTLE      10
+/* Period of the lookups without netlink, in ms */
+#define HOTPLUG_PERIOD      100
+
+static int uevent_fd = -1;
+/* The device waited for has been added */
+static bool added;
+
+/**
+ * \brief Listen to the uevents, before making a device appear. Without
+ * netlink, hotplug_wait() only waits a period.
+ */
+void hotplug_open(void)
+{
+    struct sockaddr_nl addr;
+
+    added = false;
+    uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+                       NETLINK_KOBJECT_UEVENT);
+    if (uevent_fd < 0)
+    {
+        log_debug("No uevents, the devices are polled");
+        return;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_GROUP;
+    if (bind(uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        log_debug("No uevents, the devices are polled");
+        close(uevent_fd);
+        uevent_fd = -1;
+    }
+}
+
+/**
+ * Tell if a uevent adds the USB device or one of its interfaces:
+ * "add@/devices/...\0ACTION=add\0...\0PRODUCT=3eb/ff07/30\0..."
+ */
+static bool uevent_matches(const char *event, size_t len,
+                           uint16_t vendor_id, uint16_t product_id)
+{
+    const char *end = event + len;
+    unsigned int vendor, product;
+    bool add = false, match = false;
+
+    for (; event < end; event += strlen(event) + 1)
+    {
+        if (!strcmp(event, "ACTION=add") || !strcmp(event, "ACTION=bind"))
+            add = true;
+        else if (sscanf(event, "PRODUCT=%x/%x/", &vendor, &product) == 2
+                 && vendor == vendor_id && product == product_id)
+            match = true;
+    }
+    return add && match;
+}
+
+/**
+ * \brief Wait for the USB device vendor_id:product_id to be added, to look
+ * for it again
+ * \return false once deadline has passed
+ */
+bool hotplug_wait(uint16_t vendor_id, uint16_t product_id, uint64_t deadline)
+{
+    char event[4096];
+    struct sockaddr_nl sender;
+    struct iovec iov = { event, sizeof(event) - 1 };
+    struct msghdr msg;
+    struct pollfd pfd;
+    int timeout, period;
+    ssize_t len;
+
+    timeout = timer_remaining_ms(deadline);
+    if (timeout <= 0)
+        return false;
+    if (uevent_fd < 0 || added)
+    {
+        period = uevent_fd < 0 ? HOTPLUG_PERIOD : HOTPLUG_SETTLE;
+        usleep((timeout < period ? timeout : period) * 1000);
+        return true;
+    }
+
+    pfd.fd = uevent_fd;
+    pfd.events = POLLIN;
+    while ((timeout = timer_remaining_ms(deadline)) > 0)
+    {
+        if (poll(&pfd, 1, timeout) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        len = 0;
+        if (pfd.revents & POLLIN)
+        {
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &sender;
+            msg.msg_namelen = sizeof(sender);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            len = recvmsg(uevent_fd, &msg, 0);
+        }
+        /* The receive buffer overflowed during a burst of uevents: the one
+         * awaited may be lost, the device is looked for from now on */
+        if ((pfd.revents & POLLERR) || (len < 0 && errno == ENOBUFS))
+        {
+            log_debug("uevents lost, looking for %04x:%04x", vendor_id,
+                      product_id);
+            added = true;
+            return true;
+        }
+        if (len <= 0)
+            continue;
+        /* Only the kernel sends the uevents of that group */
+        if (sender.nl_pid != 0)
+            continue;
+        event[len] = '\0';
+        if (uevent_matches(event, len, vendor_id, product_id))
+        {
+            log_debug("%04x:%04x added", vendor_id, product_id);
+            added = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * \brief Stop listening to the uevents
+ */
+void hotplug_close(void)
+{
+    if (uevent_fd >= 0)
+        close(uevent_fd);
+    uevent_fd = -1;
+    added = false;
+}
@@ -66,6 +66,9 @@ static FILE *log_file;
 /** Whether the log has been opened */
 static bool log_opened;
 
+/** Handler the messages are given to instead of the target, if set */
+static log_handler_t log_handler;
+
 /**
  * Open the log.
  *
@@ -137,6 +140,27 @@ void log_set_level(log_level_t new_level)
     current_level = new_level;
 }
 
+/**
+ * Give the messages to a handler instead of the logging target.
+ *
+ * /param[in] handler  Handler, NULL to go back to the target
+ */
+void log_set_handler(log_handler_t handler)
+{
+    log_handler = handler;
+}
+
+/**
+ * Get the name of a logging level.
+ *
+ * /return "debug", "info", "notice"...
+ */
+const char *log_level_name(log_level_t level)
+{
+    assert(level <= LOG_LEVEL_NONE);
+    return level_names[level];
+}
+
 /**
  * Get the logging level.
  *
@@ -178,6 +202,17 @@ bool log_text(log_level_t at_level, const char *fmt, ...)
     if (at_level < current_level)
         return true;
 
+    if (log_handler)
+    {
+        va_start(al, fmt);
+        r = vsnprintf(text, sizeof(text), fmt, al);
+        va_end(al);
+        if (r < 0)
+            return false;
+        log_handler(at_level, text);
+        return true;
+    }
+
     /* Add date & time when LOG_TARGET_TUX */
     if (log_target == LOG_TARGET_TUX)
     {
@@ -31,8 +31,13 @@ typedef enum log_level
     LOG_LEVEL_NONE /**> Quiet mode, show nothing */
 } log_level_t;
 
+/** Receiver of the messages, without prefix nor date */
+typedef void (*log_handler_t)(log_level_t level, const char *text);
+
 extern void log_set_level(log_level_t new_level);
+extern void log_set_handler(log_handler_t handler);
 extern log_level_t log_get_level(void);
+extern const char *log_level_name(log_level_t level);
 
 extern bool log_text(log_level_t at_level, const char *fmt, ...)
     __attribute__((format(printf, 2, 3)));
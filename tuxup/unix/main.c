@@ -34,10 +34,35 @@
 #include "error.h"
 #include "log.h"
 #include "usb-connection.h"
-#include "tux_hid_unix.h"
+#include "transport.h"
 #include "http_request.h"
+#include "hex_image.h"
+#include "hex_scanner.h"
+#include "page_cache.h"
+#include "tuxfw.h"
+#include "bundle.h"
+#include "timer.h"
+#include "stats.h"
+#include "workers.h"
+#include "engine.h"
+#include "daemon.h"
+#include "hotplug.h"
+#include "usb_sysfs.h"
+#include "common/api.h"
 #define countof(X) ( (size_t) ( sizeof(X)/sizeof*(X) ) )
 
+/* Time given to a CPU to answer a version request, in ms */
+#define CPU_VERSION_TIMEOUT 500
+
+/* Time given to the dongle to be plugged, in ms, see --wait */
+#define CONNECT_TIMEOUT 5000
+
+/* Time given to the dongle to enumerate in DFU mode, in ms */
+#define DFU_SWITCH_TIMEOUT 10000
+
+/* Time given to the dongle to come back after its reprogramming, in ms */
+#define DONGLE_RETURN_TIMEOUT 10000
+
 /* Messages. */
 static char const *msg_old_fuxusb =
     "\n       Your dongle firmware is too old to use this version of Tuxup"
@@ -78,10 +103,61 @@ int verbose = 0;
 /* Pretend option. */
 static int pretend = 0;
 
-/* USB handle */
-static struct usb_device *device;
-static struct usb_dev_handle *dev_h;
-static int usb_connected = 0;          /* Flag for usb connection status */
+/* Don't send the pages that only hold 0xFF. */
+static int skip_blank = 0;
+
+/* Send all the pages, even those recorded as already programmed. */
+static int full_flash = 0;
+
+/* Only program the CPUs which don't run the version of the hex files. */
+static int update_only = 0;
+
+/* 'verify': only tell which CPUs don't run the version of the files. */
+static int verify_only = 0;
+static int cpus_outdated = 0;
+
+/* Transport forced on the command line, NULL to find the dongle on any. */
+static char const *transport_name = NULL;
+
+/* Dongles to program, each by its own worker when there are several. */
+static char devices[WORKERS_MAX][TRANSPORT_DEVICE_SIZE];
+static int device_count = 0;
+static int all_devices = 0;
+
+/* Program the dongles from a single thread, see engine.c */
+static int epoll_mode = 0;
+
+/* Time given to the dongle to be plugged, in ms. */
+static int connect_timeout = CONNECT_TIMEOUT;
+
+/* Path of the dongle programmed, NULL to take the first one found. */
+static char const *device_path = NULL;
+
+/* Socket of the daemon, the jobs are sent to it when set. */
+static char const *socket_path = NULL;
+
+/* Print the statistics of the run, and write them in that JSON file. */
+static int print_stats = 0;
+static char const *stats_json = NULL;
+
+/* CPUs whose flash was found up to date, their eeprom is skipped too. */
+static bool cpu_skipped[HIGHEST_CPU_NUM + 1];
+
+/*
+ * Connection to the dongle, shared by all the files programmed during the
+ * run. The dongle is opened and its firmware version checked only once.
+ */
+typedef struct
+{
+    bool connected;                 /* Flag for usb connection status */
+    bool validated;                 /* The fuxusb version has been checked */
+    const transport_t *transport;   /* Backend the dongle is reached by */
+    int bcd_device;                 /* Release number of the dongle */
+    version_t fuxusb_version;       /* Version of the dongle firmware */
+    char id[128];                   /* Identifier of the dongle */
+} session_t;
+
+static session_t session;
 
 /*
  * Prints usage information for this program to STREAM (typically
@@ -91,11 +167,54 @@ static void usage(FILE *stream, int exit_code)
 {
     fprintf(stream, "%s %s\n", program_name, program_version);
     fprintf(stream, "Usage: %s options [path|file ...]\n", program_name);
+    fprintf(stream, "       %s compile file ...\n", program_name);
+    fprintf(stream, "       %s bundle file%s path\n", program_name,
+            BUNDLE_EXTENSION);
+    fprintf(stream, "       %s options verify [path|file ...]\n",
+            program_name);
+    fprintf(stream, "       %s [--device=PATH] version\n", program_name);
+    fprintf(stream, "       %s [--socket=PATH] daemon\n", program_name);
     fprintf(stream,
             " -m --main     Reprogram tuxcore and tuxaudio (flash and eeprom)\n"
             "               with hex files located in path.\n"
             " -a --all      Reprogram all cpu's with hex files located in path.\n"
             " -p --pretend  Don't do the programming, just simulate.\n"
+            " -b --skip-blank\n"
+            "               Don't send the pages that only hold 0xFF. These\n"
+            "               pages are not erased, only use it on erased CPUs.\n"
+            " -f --full     Program all the pages, not only those that changed\n"
+            "               since the last successful programming.\n"
+            " -u --update   Only program the CPUs that don't run the version of\n"
+            "               the hex files already, and their eeprom.\n"
+            " -t --transport NAME\n"
+            "               Reach the dongle with that backend only:\n"
+            "               ");
+    transport_list(stream);
+    fprintf(stream, ".\n"
+            "               By default the first one that finds it is used.\n"
+            "    --device=PATH\n"
+            "               Program the dongle at PATH (/dev/hidraw3,\n"
+            "               /dev/bus/usb/001/004...). Can be repeated, the\n"
+            "               dongles are then programmed at the same time.\n"
+            "    --all-devices\n"
+            "               Program all the dongles connected at the same time.\n"
+            "    --epoll    Program the dongles from a single thread instead\n"
+            "               of a process each. Only for the hex, eep and tuxfw\n"
+            "               files of the CPUs behind the dongle, on hidraw; the\n"
+            "               versions and the page cache are not checked.\n"
+            "    --socket[=PATH]\n"
+            "               Send the job to the daemon listening on PATH, by\n"
+            "               default $XDG_RUNTIME_DIR/tuxupd.sock, instead of\n"
+            "               programming the dongle. With 'daemon', listen\n"
+            "               on PATH.\n"
+            "    --wait=SECONDS\n"
+            "               Wait that long for the dongle to be plugged, 5 by\n"
+            "               default, 0 to not wait.\n"
+            " -s --stats    Print the time taken by each phase, the latency\n"
+            "               percentiles of the pages and the transfers made.\n"
+            "    --stats-json=FILE\n"
+            "               Write these statistics in FILE as JSON ('-' for\n"
+            "               the standard output).\n"
             " -h --help     Display this usage information.\n"
             " -v --verbose  Print verbose messages.\n"
             " -d --debug    Print debug messages. \n"
@@ -110,229 +229,403 @@ static void usage(FILE *stream, int exit_code)
             "  * Inputfiles can be specified only if the -a and -m options are\n"
             "    not selected.\n"
             "  * Any .hex or .eep files compiled for Tux Droid can be used.\n"
+            "  * Hex and eep files may be compressed (.gz, .zst) if tuxup has\n"
+            "    been built with that support. '-' reads a hex file for\n"
+            "    tuxcore, tuxaudio, tuxrf or fuxrf from the standard input.\n"
+            "  * 'compile' converts .hex and .eep files to .tuxfw images that\n"
+            "    are loaded without any parsing. They are programmed like the\n"
+            "    other files; the page cache doesn't apply to them.\n"
+            "  * 'bundle' packs the files of a path in one .tuxbundle file\n"
+            "    that can be given to '-a' and '-m' instead of the path.\n"
+            "  * 'verify' only tells which CPUs don't run the version of the\n"
+            "    files, and fails if any. 'version' prints the versions of\n"
+            "    the CPUs.\n"
+            "  * 'daemon' keeps the dongle connected and programs the jobs\n"
+            "    sent by 'tuxup --socket ...' until it is interrupted.\n"
             "  * The eeprom file names should contain 'tuxcore' or 'tuxaudio'\n"
             "    in order to be identified. The usb hex file should contain\n"
             "    'fuxusb'.\n");
     exit(exit_code);
 }
 
-static void retrieve_version(int *ver_minor, int *ver_update)
+/*
+ * Connect the dongle. Returns an exit code, E_TUXUP_NOERROR once connected.
+ */
+static int connect_dongle(void)
 {
-    unsigned char data_buffer[64];
-    uint8_t i;
-    data_buffer[0] = DONGLE_CMD_HDR;
-    data_buffer[1] = INFO_FUXUSB;
-    
-    if (HID)
+    uint64_t deadline, start = timer_now_us();
+
+    if (session.connected)
+        return E_TUXUP_NOERROR;
+
+    /* Looked for again each time a dongle is plugged */
+    hotplug_open();
+    deadline = timer_deadline_ms(connect_timeout);
+    session.transport = transport_open(transport_name, device_path);
+    if (session.transport == NULL && connect_timeout > 0)
+        log_info("Waiting for the dongle ...");
+    while (session.transport == NULL
+           && hotplug_wait(TUX_VENDOR_ID, TUX_PRODUCT_ID, deadline))
+        session.transport = transport_open(transport_name, device_path);
+    hotplug_close();
+    if (session.transport == NULL)
     {
-        tux_hid_write(64, data_buffer);
-        sleep(1);
-        tux_hid_read(64, data_buffer);
+        if (device_path)
+            log_error("The dongle %s was not found, now exiting.\n",
+                      device_path);
+        else
+            log_error("The dongle was not found, now exiting.\n");
+        return E_TUXUP_DONGLENOTFOUND;
     }
-    else
+    log_info("%s device", session.transport->name);
+    stats_phase(STATS_CONNECT, start);
+    stats_set_transport(session.transport->name);
+    
+    /* Verify if tuxhttpserver.pid exists. */
+    if (stop_driver() > 0)
     {
-        usb_send_commands(dev_h, data_buffer, 64);
-        sleep(1);
-        usb_get_commands(dev_h, data_buffer, 64);
+        session.transport->close();
+        return E_SERVER_CONNECTION;
     }
-    for (i = 0; i < 64; i++) 
+
+    if (verbose)
+        printf("The dongle was found.\n");
+
+    /* Check if we have the old firmware that requires entering
+     * bootloader mode manually, exits with a message that explains what
+     * to do in such a case. */
+    if (session.transport->bcd_device)
     {
-        /* Parse the frame header */
-        if (!((i) % 4))
+        session.bcd_device = session.transport->bcd_device();
+        if (session.bcd_device < 0x030)
         {
-            if (data_buffer[i] == FUXUSB_VERSION_CMD)
-            {
-                *ver_minor = data_buffer[i+2];
-                *ver_update = data_buffer[i+3];
-                break;
-            }
+            session.transport->close();
+            log_error(msg_old_firmware);
+            return E_TUXUP_DONGLEMANUALBOOTLOAD;
         }
     }
+    log_info("Interface configured \n");
+    /* Identify the dongle to keep a separate page cache for each dongle */
+    if (!transport_get_id(session.transport, session.id, sizeof(session.id)))
+        session.id[0] = '\0';
+    session.connected = true;
+    return E_TUXUP_NOERROR;
 }
 
-static int verify_version(void)
+static void fux_connect(void)
 {
-    int ver_minor=0, ver_update=0;
-    uint8_t i;
+    int ret = connect_dongle();
+
+    if (ret != E_TUXUP_NOERROR)
+        exit(ret);
+}
+
+
+static void fux_disconnect(void)
+{
+    if (!session.connected)
+        return;
+    log_info("Closing interface ...\n");
+    session.transport->close();
+    log_info("     ... interface closed \n");
+    /* The dongle may come back with another firmware */
+    session.connected = false;
+    session.validated = false;
+}
+
+/*
+ * Load the hex file and check that it has been compiled for a CPU of
+ * tuxdroid. The image is filled with the pages and the version extracted
+ * from the hex file. Returns 0 if the hex file has a cpu and version
+ * numbers, 1 otherwise, in which case the image doesn't need to be freed.
+ */
+static int check_hex_file(char const *filename, hex_image_t *image)
+{
+    if (!hex_image_load(filename, image))
+        return 1;
 
-    for (i = 0; i < 3; i++)
+    if (!image->has_version)
     {
-        retrieve_version(&ver_minor, &ver_update);
-        if (ver_minor != 0)
-            break;
+        hex_image_free(image);
+        return 1;
     }
-    
-    if (ver_minor <= MIN_VER_MINOR)
-       if (ver_update < MIN_VER_UPDATE)
-           return 1;
-
     return 0;
 }
 
-
-static void fux_connect(void)
+/*
+ * Remove the blank pages from the image if requested.
+ */
+static void skip_blank_pages(hex_image_t *image)
 {
-    int wait = 5;
-    if (usb_connected)
+    unsigned int skipped;
+
+    if (!skip_blank)
         return;
+    skipped = hex_image_drop_blank_pages(image);
+    log_info("%u blank pages skipped, %u pages to program", skipped,
+             image->page_count);
+}
 
-    /* First, try to found a HID device */
-    if (!(tux_hid_capture(TUX_VENDOR_ID, TUX_PRODUCT_ID))) 
-    {
-        /* Unable to capture the device, try with the libusb */
-        for (;;)
-        {
-            device = usb_find_tux();
-            if (device != NULL || wait == 0)
-                break;
+/*
+ * Send the version request of a CPU. The request of fuxusb is handled by the
+ * dongle itself, the others are forwarded to tux.
+ */
+static void send_version_request(uint8_t cpu_nbr)
+{
+    static const uint8_t info_cmd[] = { INFO_TUXCORE_CMD, INFO_TUXAUDIO_CMD,
+        INFO_TUXRF_CMD, INFO_FUXRF_CMD, INFO_FUXUSB_CMD };
+    uint8_t data_buffer[TRANSPORT_REPORT_SIZE];
+
+    memset(data_buffer, 0, sizeof(data_buffer));
+    data_buffer[0] = (cpu_nbr == FUXUSB_CPU_NUM) ? DONGLE_CMD_HDR
+                                                 : LIBUSB_RF_HEADER;
+    data_buffer[1] = info_cmd[cpu_nbr];
+    transport_write(session.transport, data_buffer, sizeof(data_buffer));
+}
 
-            sleep(1);
-            wait--;
-        }
+/*
+ * Ask the CPUs in the cpus mask (bit n for CPU number n) for their version.
+ * All the requests are sent before the replies are collected, so that they
+ * are all in flight at the same time. Returns the mask of the CPUs that
+ * replied in time, a CPU in bootloader mode doesn't reply.
+ */
+static unsigned int query_versions(unsigned int cpus,
+                                   version_t versions[HIGHEST_CPU_NUM + 1])
+{
+    uint8_t data_buffer[TRANSPORT_REPORT_SIZE];
+    unsigned int received = 0;
+    uint64_t deadline, start = timer_now_us();
+    int cpu, i;
+
+    /* The replies are told apart by their CPU number, only the reports
+     * received before the requests are dropped */
+    transport_drain(session.transport);
+    for (cpu = LOWEST_CPU_NUM; cpu <= HIGHEST_CPU_NUM; cpu++)
+    {
+        if (cpus & (1 << cpu))
+            send_version_request(cpu);
+    }
 
-        if (device == NULL)
-        {
-            log_error("The dongle was not found, now exiting.\n");
-            exit(E_TUXUP_DONGLENOTFOUND);
-        }
-        else
+    deadline = timer_deadline_ms(CPU_VERSION_TIMEOUT);
+    while (received != cpus && timer_remaining_ms(deadline) > 0)
+    {
+        if (!transport_read(session.transport, data_buffer,
+                            sizeof(data_buffer),
+                            timer_remaining_ms(deadline)))
+            break;
+        for (i = 0; i < TRANSPORT_REPORT_SIZE; i += 4)
         {
-            log_info("Libusb device");
-            /* The dongle is a libusb device */
-            HID = 0;
+            if (data_buffer[i] != VERSION_CMD)
+                continue;
+            cpu = CPU_VER_CPU(data_buffer[i + 1]);
+            if (cpu <= HIGHEST_CPU_NUM && (cpus & (1 << cpu)))
+            {
+                memcpy(&versions[cpu], &data_buffer[i], sizeof(version_t));
+                received |= 1 << cpu;
+            }
         }
     }
-    else
-    {
-        log_info("HID device");
-        /* The dongle is a HID device */
-        HID = 1;
+    log_debug("Versions requested 0x%02x, received 0x%02x", cpus, received);
+    stats_phase(STATS_VERSION_PROBE, start);
+    return received;
+}
 
- 
-    }
-    
-    /* Verify if tuxhttpserver.pid exists. */
-    if (stop_driver() > 0)
-    {
-        exit(E_SERVER_CONNECTION);
-    }
+/*
+ * Ask a CPU of tux for its version. Returns false if no version has been
+ * received in time.
+ */
+static bool query_cpu_version(uint8_t cpu_nbr, version_t *version)
+{
+    version_t versions[HIGHEST_CPU_NUM + 1];
 
-    if (verbose)
-        printf("The dongle was found.\n");
+    if (!query_versions(1 << cpu_nbr, versions))
+        return false;
+    *version = versions[cpu_nbr];
+    return true;
+}
 
-    /* Check if we have the old firmware that requires entering
-     * bootloader mode manually, exits with a message that explains what
-     * to do in such a case. */
-    if (!HID)
+/*
+ * Connect the dongle and check, once per connection, that its firmware is
+ * recent enough. Returns an exit code, E_TUXUP_NOERROR if it is.
+ */
+static int open_session(void)
+{
+    uint64_t start;
+    uint8_t i;
+    bool ok = false;
+    int ret;
+
+    if ((ret = connect_dongle()) != E_TUXUP_NOERROR)
+        return ret;
+    if (session.validated)
+        return E_TUXUP_NOERROR;
+
+    start = timer_now_ms();
+    for (i = 0; i < 3 && !ok; i++)
+        ok = query_cpu_version(FUXUSB_CPU_NUM, &session.fuxusb_version);
+    if (ok)
+        log_debug("Dongle version %d.%d.%d received in %d ms",
+                  CPU_VER_MAJ(session.fuxusb_version.cpu_ver_maj),
+                  session.fuxusb_version.ver_minor,
+                  session.fuxusb_version.ver_update,
+                  (int)(timer_now_ms() - start));
+    else
+        memset(&session.fuxusb_version, 0, sizeof(version_t));
+
+    if (session.fuxusb_version.ver_minor <= MIN_VER_MINOR
+        && session.fuxusb_version.ver_update < MIN_VER_UPDATE)
     {
-        if (device->descriptor.bcdDevice < 0x030)
-        {
-            log_error(msg_old_firmware);
-            exit(E_TUXUP_DONGLEMANUALBOOTLOAD);
-        }
-    
-        /* open USB device */
-        if ((dev_h = usb_open_tux(device)) == NULL)
-        {
-            log_error("USB DEVICE INIT ERROR \n");
-            exit(E_TUXUP_USBERROR);
-        }
+        log_error(msg_old_fuxusb);
+        return E_FUXUSB_VER_ERROR;
     }
-    log_info("Interface configured \n");
-    usb_connected = 1;
+    session.validated = true;
+    return E_TUXUP_NOERROR;
 }
 
+static void session_open(void)
+{
+    int ret = open_session();
 
-static void fux_disconnect(void)
+    if (ret != E_TUXUP_NOERROR)
+        exit(ret);
+}
+
+/*
+ * Tell if a CPU already runs the firmware of an image. The versions of all
+ * the CPUs are requested together the first time.
+ */
+static bool cpu_is_up_to_date(version_bf_t const *image_version)
 {
-    if (!usb_connected)
-        return;
-    log_info("Closing interface ...\n");
-    if (HID)
+    static version_t versions[HIGHEST_CPU_NUM + 1];
+    static unsigned int received;
+    static bool queried = false;
+    version_t const *device_version;
+
+    if (image_version->cpu_nbr > HIGHEST_CPU_NUM)
+        return false;
+    if (!queried)
     {
-        tux_hid_release();
+        session_open();
+        received = query_versions((1 << (HIGHEST_CPU_NUM + 1)) - 1,
+                                  versions);
+        queried = true;
     }
-    else
+    if (!(received & (1 << image_version->cpu_nbr)))
     {
-        usb_release_interface(dev_h, USB_COMMAND);
-        usb_close(dev_h);
+        cpus_outdated++;
+        return false;
     }
-    log_info("     ... interface closed \n");
-    usb_connected = 0;
+
+    device_version = &versions[image_version->cpu_nbr];
+    log_info("Version in the CPU: %d.%d.%d",
+             CPU_VER_MAJ(device_version->cpu_ver_maj),
+             device_version->ver_minor, device_version->ver_update);
+    if (CPU_VER_MAJ(device_version->cpu_ver_maj) == image_version->ver_major
+        && device_version->ver_minor == image_version->ver_minor
+        && device_version->ver_update == image_version->ver_update)
+        return true;
+    cpus_outdated++;
+    return false;
 }
 
-static int hex_to_i(char *hex_nr)
+/*
+ * Open the record of the last image programmed in that memory and remove
+ * from the image the pages that didn't change since. The record is dropped
+ * if the CPU reports a version different from the recorded one; as a CPU
+ * waiting in bootloader mode doesn't answer, the record is trusted when no
+ * version is received. The version to record once the image is programmed
+ * is returned in record: the version of the image for the flash, and the
+ * version reported by the CPU for the eeprom.
+ */
+static bool open_page_cache(page_cache_t *cache, uint8_t cpu_nbr,
+                            int mem_type, hex_image_t *image,
+                            version_t *record)
 {
-    int nr;
+    version_t device_version;
+    bool has_version;
+    unsigned int skipped;
+
+    if (pretend || !session.id[0]
+        || !page_cache_open(cache, session.id, cpu_nbr, mem_type))
+        return false;
+
+    has_version = query_cpu_version(cpu_nbr, &device_version);
+    if (mem_type == FLASH)
+        hex_image_get_version(image, record);
+    else if (has_version)
+        *record = device_version;
+    else
+        memset(record, 0, sizeof(version_t));
+
+    if (full_flash)
+        page_cache_invalidate(cache);
+    else if (cache->loaded && has_version
+             && memcmp(&cache->version, &device_version, sizeof(version_t)))
+    {
+        log_info("The CPU version differs from the cache, all the pages "
+                 "will be programmed");
+        page_cache_invalidate(cache);
+    }
 
-    sscanf(hex_nr, "%x", &nr);
-    return nr;
+    skipped = page_cache_filter(cache, image);
+    if (cache->loaded)
+        log_info("%u unchanged pages skipped, %u pages to program", skipped,
+                 image->page_count);
+    return true;
 }
 
 /*
- * Check if the hex file is valid and return the CPU number for which it has
- * been compiled. Fills the version structure with the information extracted
- * from the hex file and returns 0 if the hex file has a cpu and version
- * numbers, 1 otherwise.
+ * Program the image, only the pages not recorded in the cache are left in
+ * it, and update the cache accordingly.
  */
-static int check_hex_file(char const *filename, version_bf_t * version)
+static bool bootload_cached(uint8_t cpu_i2c_addr, int mem_type,
+                            hex_image_t *image, page_cache_t *cache,
+                            bool cached, const version_t *record)
 {
-    FILE *fs = NULL;
-    char word[80];
-    char hex_nr[3];
+    bool ok;
 
-    hex_nr[2] = (char)'\0';
-    if ((fs = fopen(filename, "r")) == NULL)
+    if (cached && cache->loaded && image->page_count == 0)
     {
-        log_error("Unable to open file '%s' for reading\n", filename);
-        exit(E_TUXUP_BADPROGFILE);
+        log_notice("Already up to date");
+        page_cache_close(cache);
+        return true;
     }
 
-    while (fscanf(fs, " %s", word) != EOF)
+    /* The record is removed before the first page is written and written
+     * again once they all are: an upload that fails, even by exiting, leaves
+     * no record of a content the CPU doesn't hold anymore */
+    if (cached)
+        page_cache_invalidate(cache);
+    ok = bootload(session.transport, cpu_i2c_addr, mem_type, image);
+    if (cached)
     {
-        /* look for the address 0EF0 (RF) or 1EF0 (tuxcore and tuxaudio)
-         * or just :0C (USB) and the C8 version command */
-        if (!strncmp(word, ":0C0EF000C8", 11)
-            || !strncmp(word, ":0C1DF000C8", 11)
-            || (!strncmp(word, ":0C", 3) && !strncmp(word+7, "00C804", 6)))
-        {
-            /* get cpu number and version number */
-            strncpy(hex_nr, &word[11], 2);
-            version->cpu_nbr = (hex_to_i(hex_nr) & 0x7);        /* 3 lower bits */
-            version->ver_major = (hex_to_i(hex_nr) >> 3);       /* 5 higher bits */
-            strncpy(hex_nr, &word[13], 2);
-            version->ver_minor = hex_to_i(hex_nr);      /* 5 higher bits */
-            strncpy(hex_nr, &word[15], 2);
-            version->ver_update = hex_to_i(hex_nr);     /* 5 higher bits */
-            return 0;
-        }
+        if (ok)
+            page_cache_commit(cache, record);
+        page_cache_close(cache);
     }
-    return 1;
+    return ok;
 }
 
 static int prog_flash(char const *filename)
 {
+    hex_image_t image;
     version_bf_t version;
+    page_cache_t cache;
+    version_t record;
+    bool cached;
     uint8_t cpu_i2c_addr;
     int ret;
 
     /* Connect the dongle. */
-    fux_connect();
-
-    ret = verify_version();
-
-    if (ret)
-    {
-        log_error(msg_old_fuxusb);
-        exit(E_FUXUSB_VER_ERROR);
-    }
+    session_open();
 
-    if (check_hex_file(filename, &version))
+    if (check_hex_file(filename, &image))
     {
         log_error("Programming of '%s' failed, this file is not a " \
                " hex file for that CPU\n\n", filename);
         return E_TUXUP_BADPROGFILE;
     }
+    version = image.version;
     if (version.cpu_nbr == TUXCORE_CPU_NUM)
     {
         log_notice("\nProgramming %s in the tuxcore CPU", filename);
@@ -357,40 +650,50 @@ static int prog_flash(char const *filename)
     {
         log_error("Unrecognized CPU number, %s doesn't appear to be compiled"
                " for a CPU of tuxdroid.\n", filename);
+        hex_image_free(&image);
         return E_TUXUP_BADPROGFILE;
     }
     log_notice("Version %d.%d.%d\n", version.ver_major, version.ver_minor,
            version.ver_update);
+    if (update_only && cpu_is_up_to_date(&version))
+    {
+        log_notice("Already up to date, skipped\n");
+        cpu_skipped[version.cpu_nbr] = true;
+        hex_image_free(&image);
+        return E_TUXUP_NOERROR;
+    }
+    cached = open_page_cache(&cache, version.cpu_nbr, FLASH, &image,
+                             &record);
+    skip_blank_pages(&image);
 
     if (pretend)
-        return E_TUXUP_NOERROR;
-    if (bootload(dev_h, cpu_i2c_addr, FLASH, filename))
+        ret = E_TUXUP_NOERROR;
+    else if (bootload_cached(cpu_i2c_addr, FLASH, &image, &cache, cached,
+                             &record))
     { 
        printf("\033[2C[ \033[01;32mOK\033[00m ]\n");
-       return E_TUXUP_NOERROR;
+       ret = E_TUXUP_NOERROR;
     }
     else
     {
         log_notice("\033[2C[\033[01;31mFAIL\033[00m]\n");
-        return E_TUXUP_PROGRAMMINGFAILED;
+        ret = E_TUXUP_PROGRAMMINGFAILED;
     }
+    hex_image_free(&image);
+    return ret;
 }
 
 static int prog_eeprom(uint8_t cpu_nbr, char const *filename)
 {
+    hex_image_t image;
+    page_cache_t cache;
+    version_t record;
+    bool cached;
     uint8_t cpu_i2c_addr;
     int ret;
 
     /* Connect the dongle. */
-    fux_connect();
-
-    ret = verify_version();
-
-    if (ret)
-    {
-        log_error(msg_old_fuxusb);
-        exit(E_FUXUSB_VER_ERROR);
-    }
+    session_open();
 
     if (cpu_nbr == TUXCORE_CPU_NUM)
     {
@@ -407,39 +710,127 @@ static int prog_eeprom(uint8_t cpu_nbr, char const *filename)
         log_error("Wrong CPU number specified for the eeprom.\n");
         return E_TUXUP_BADPROGFILE;
     }
+    if (update_only && cpu_skipped[cpu_nbr])
+    {
+        log_notice("The firmware of that CPU is up to date, skipped\n");
+        return E_TUXUP_NOERROR;
+    }
+
+    if (!hex_image_load(filename, &image))
+        return E_TUXUP_BADPROGFILE;
+    cached = open_page_cache(&cache, cpu_nbr, EEPROM, &image, &record);
+    skip_blank_pages(&image);
 
     if (pretend)
-        return E_TUXUP_NOERROR;
-    if (bootload(dev_h, cpu_i2c_addr, EEPROM, filename))
+        ret = E_TUXUP_NOERROR;
+    else if (bootload_cached(cpu_i2c_addr, EEPROM, &image, &cache, cached,
+                             &record))
     {
         printf("\033[2C[ \033[01;32mOK\033[00m ]\n");
-        return E_TUXUP_NOERROR;
+        ret = E_TUXUP_NOERROR;
     }
     else
     {
         log_notice("\033[2C[\033[01;31mFAIL\033[00m]\n");
-        return E_TUXUP_PROGRAMMINGFAILED;
+        ret = E_TUXUP_PROGRAMMINGFAILED;
+    }
+    hex_image_free(&image);
+    return ret;
+}
+
+/*
+ * Wait for a USB device to enumerate after the action that makes it
+ * appear, hotplug_open() having been called before that action.
+ */
+static bool wait_usb_device(uint16_t vendor_id, uint16_t product_id,
+                            int timeout_ms)
+{
+    uint64_t start = timer_now_ms();
+    uint64_t deadline = timer_deadline_ms(timeout_ms);
+
+    do
+    {
+        if (usb_find_device(vendor_id, product_id) != NULL)
+        {
+            log_debug("%04x:%04x found in %d ms", vendor_id, product_id,
+                      (int)(timer_now_ms() - start));
+            return true;
+        }
+    }
+    while (hotplug_wait(vendor_id, product_id, deadline));
+    return false;
+}
+
+static int flash_usb(char const *filename);
+
+/*
+ * Wait for the dongle to come back on port after its reprogramming, then
+ * program it through its new node, of the same kind as previous. Other
+ * dongles may be plugged, so the first one found won't do.
+ */
+static bool wait_dongle_at(char const *port, char const *previous)
+{
+    static char device[TRANSPORT_DEVICE_SIZE];
+    uint64_t start = timer_now_ms();
+    uint64_t deadline = timer_deadline_ms(DONGLE_RETURN_TIMEOUT);
+
+    do
+    {
+        /* Its node appears a bit later than the device, and becomes
+         * accessible once udev has set its permissions */
+        if (usb_sysfs_device(port, TUX_VENDOR_ID, TUX_PRODUCT_ID, previous,
+                             device, sizeof(device))
+            && access(device, R_OK | W_OK) == 0)
+        {
+            log_debug("Dongle back as %s in %d ms", device,
+                      (int)(timer_now_ms() - start));
+            device_path = device;
+            return true;
+        }
+    }
+    while (hotplug_wait(TUX_VENDOR_ID, TUX_PRODUCT_ID, deadline));
+    return false;
+}
+
+/*
+ * Tell if the USB CPU doesn't need to be flashed with that version, because
+ * it runs it already or nothing is programmed.
+ */
+static bool usb_skip(version_bf_t const *version)
+{
+    log_notice("Version %d.%d.%d\n", version->ver_major, version->ver_minor,
+           version->ver_update);
+    if (update_only && cpu_is_up_to_date(version))
+    {
+        log_notice("Already up to date, skipped\n");
+        return true;
     }
+    return pretend;
 }
 
 static int prog_usb(char const *filename)
 {
-#define QUIET_CMD "1>/dev/null 2>&1"
-    /* XXX include those as defines in commands.h */
-    unsigned char send_data[5] = { 0x01, 0x01, 0x00, 0x00, 0xFF };
-    char command_str[PATH_MAX];
-    int ret;
+    hex_image_t image;
     version_bf_t version;
 
     log_notice("Programming %s in the USB CPU\n", filename);
 
     /* Retrieving version number */
-    if (check_hex_file(filename, &version))
+    if (check_hex_file(filename, &image))
     {
         log_error("Programming of '%s' failed, this file is not a correct"
                " hex file for that CPU\n\n", filename);
         return E_TUXUP_BADPROGFILE;
     }
+    /* The file itself is flashed by dfu-programmer */
+    version = image.version;
+    hex_image_free(&image);
+    if (hex_scanner_compression(filename))
+    {
+        log_error("dfu-programmer only reads uncompressed hex files, "
+                  "decompress %s first.\n", filename);
+        return E_TUXUP_BADPROGFILE;
+    }
 
     if (version.cpu_nbr != FUXUSB_CPU_NUM)
     {
@@ -447,11 +838,23 @@ static int prog_usb(char const *filename)
                " for a CPU of tuxdroid.\n", filename);
         return E_TUXUP_BADPROGFILE;
     }
-    log_notice("Version %d.%d.%d\n", version.ver_major, version.ver_minor,
-           version.ver_update);
-
-    if (pretend)
+    if (usb_skip(&version))
         return E_TUXUP_NOERROR;
+    return flash_usb(filename);
+}
+
+/*
+ * Flash a hex file in the USB CPU with dfu-programmer, switching the dongle
+ * to bootloader mode first.
+ */
+static int dfu_flash(char const *filename)
+{
+#define QUIET_CMD "1>/dev/null 2>&1"
+    /* XXX include those as defines in commands.h */
+    unsigned char send_data[5] = { 0x01, 0x01, 0x00, 0x00, 0xFF };
+    char command_str[PATH_MAX];
+    char previous[TRANSPORT_DEVICE_SIZE], port[USB_SYSFS_PORT_SIZE] = "";
+    int ret;
 
     /* Check if the dongle is already in bootloader mode */
     log_info("Testing if the dongle is already in bootloader mode. "\
@@ -472,30 +875,22 @@ static int prog_usb(char const *filename)
         log_info("The dongle was not detected in bootloader mode, "
                  "now \ntrying to set it with a command.\n");
         fux_connect();
+        /* The dongle is found again on the same port once reprogrammed */
+        if (session.transport->get_path(previous, sizeof(previous))
+            && usb_sysfs_port(previous, port, sizeof(port)))
+            log_debug("Dongle %s on port %s", previous, port);
         /* Enter bootloader mode. */
-        if (HID)
-        {
-            tux_hid_write(5, send_data);
-            /* Windows needs more time than linux to enumerate the new dfu
-             * device */
-            sleep(5);
-        }
-        else
+        hotplug_open();
+        if (!transport_write(session.transport, send_data, 5)
+            || !wait_usb_device(DFU_VENDOR_ID, DFU_PRODUCT_ID,
+                                DFU_SWITCH_TIMEOUT))
         {
-            ret = usb_send_commands(dev_h, send_data, 5);
-            if (ret == 5)
-            {
-                sleep(1);
-                log_info("Switched to bootloader mode.\n");
-                sleep(2);
-            }
-
-            else
-            {
-                log_error("Switching to bootloader mode failed.\n");
-                return E_TUXUP_BOOTLOADINGFAILED;
-            }
+            hotplug_close();
+            log_error("Switching to bootloader mode failed.\n");
+            return E_TUXUP_BOOTLOADINGFAILED;
         }
+        hotplug_close();
+        log_info("Switched to bootloader mode.\n");
     }
     else
     {
@@ -541,46 +936,425 @@ static int prog_usb(char const *filename)
     sprintf(command_str, "dfu-programmer at89c5130 start %s", quiet ? QUIET_CMD
             : "");
     log_info(command_str);
+    hotplug_open();
     ret = system(command_str);
     log_notice("\033[2C[ \033[01;32mOK\033[00m ]\n");
 
     fux_disconnect();
-    /* Windows needs more time than linux to enumerate the device */
-    /*sleep(5);*/
-    /*fux_connect();*/
+    /* The dongle enumerates again with its new firmware */
+    if (port[0])
+        ret = wait_dongle_at(port, previous);
+    else
+        ret = wait_usb_device(TUX_VENDOR_ID, TUX_PRODUCT_ID,
+                              DONGLE_RETURN_TIMEOUT);
+    hotplug_close();
+    if (!ret)
+    {
+        log_error("The dongle didn't come back after its reprogramming.\n");
+        return E_TUXUP_DONGLENOTFOUND;
+    }
+
+    /* Open it again, its new firmware is checked like the first one */
+    if ((ret = open_session()) != E_TUXUP_NOERROR)
+        return ret;
+    log_notice("The dongle is back with firmware %d.%d.%d\n",
+               CPU_VER_MAJ(session.fuxusb_version.cpu_ver_maj),
+               session.fuxusb_version.ver_minor,
+               session.fuxusb_version.ver_update);
     return E_TUXUP_NOERROR;
 }
 
 /*
- * Programming function. Depending on the name, the flash or eeprom
- * programming will be selected. In case of eeprom, the correct CPU
- * will be choosen from the filename.
+ * dfu-programmer takes the first dongle in DFU mode it finds: when several
+ * dongles are programmed, only one of them is in DFU mode at a time.
  */
-static int program(char const *filename, char const *path)
+static int flash_usb(char const *filename)
 {
-    int ret = E_TUXUP_BADPROGFILE;
-    size_t len;
-    char *extension, filenamepath[PATH_MAX];
+    int ret;
 
-    if (path)
-    {
-        /* Checking path */
-        len = strlen(path);
-        strcpy(filenamepath, path);
-        /* Append '/' at the end if not specified. */
-        if (path[len - 1] != '/')
-            strcat(filenamepath, "/");
-        strcat(filenamepath, filename);
-        filename = filenamepath;
-    }
-    log_info("Processing: %s\n", filename);
+    workers_lock();
+    ret = dfu_flash(filename);
+    workers_unlock();
+    return ret;
+}
 
-    extension = strrchr(filename, '.');
+/*
+ * Return the CPU of an eeprom file from its name, which should contain
+ * 'tuxcore' or 'tuxaudio'.
+ */
+static int eeprom_cpu(char const *filename)
+{
+    size_t i, len = strlen(filename);
+
+    for (i = 0; i + 7 < len; i++)
+    {
+        if (!strncmp(filename + i, "tuxcore", 7))
+            return TUXCORE_CPU_NUM;
+        else if (!strncmp(filename + i, "tuxaudio", 7))
+            return TUXAUDIO_CPU_NUM;
+    }
+    return INVALID_CPU_NUM;
+}
+
+/* Bootloader address and name of the CPUs behind the dongle */
+static const uint8_t bl_addr[] = { TUXCORE_BL_ADDR, TUXAUDIO_BL_ADDR,
+    TUXRF_BL_ADDR, FUXRF_BL_ADDR };
+static char const *cpu_name[] = { "tuxcore", "tuxaudio", "tuxrf", "fuxrf" };
+
+/*
+ * Check that a precompiled image is for a CPU behind the dongle, and for a
+ * memory it has.
+ */
+static bool check_image(tuxfw_t const *fw, char const *name)
+{
+    uint8_t cpu_nbr = fw->header->cpu_nbr;
+
+    if (cpu_nbr >= countof(bl_addr)
+        || (fw->header->mem_type == EEPROM && cpu_nbr != TUXCORE_CPU_NUM
+            && cpu_nbr != TUXAUDIO_CPU_NUM))
+    {
+        log_error("Unrecognized CPU number, %s doesn't appear to be compiled"
+               " for a CPU of tuxdroid.\n", name);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Program a precompiled image. The pages are sent from the mapping of the
+ * file; the page cache only applies to hex and eep files.
+ */
+static int prog_image(tuxfw_t const *fw, char const *name)
+{
+    version_bf_t version;
+    uint8_t cpu_nbr;
+
+    if (!check_image(fw, name))
+        return E_TUXUP_BADPROGFILE;
+    cpu_nbr = fw->header->cpu_nbr;
+    log_notice("\nProgramming %s in the %s CPU", name, cpu_name[cpu_nbr]);
+
+    /* Connect the dongle. */
+    session_open();
+
+    if (fw->header->flags & TUXFW_HAS_VERSION)
+    {
+        hex_version_from_raw(&fw->header->version, &version);
+        log_notice("Version %d.%d.%d\n", version.ver_major,
+                   version.ver_minor, version.ver_update);
+        if (update_only && fw->header->mem_type == FLASH
+            && cpu_is_up_to_date(&version))
+        {
+            log_notice("Already up to date, skipped\n");
+            cpu_skipped[cpu_nbr] = true;
+            return E_TUXUP_NOERROR;
+        }
+    }
+    if (update_only && fw->header->mem_type == EEPROM && cpu_skipped[cpu_nbr])
+    {
+        log_notice("The firmware of that CPU is up to date, skipped\n");
+        return E_TUXUP_NOERROR;
+    }
+
+    if (pretend)
+        return E_TUXUP_NOERROR;
+    if (!bootload_tuxfw(session.transport, bl_addr[cpu_nbr], fw, skip_blank))
+    {
+        log_notice("\033[2C[\033[01;31mFAIL\033[00m]\n");
+        return E_TUXUP_PROGRAMMINGFAILED;
+    }
+    printf("\033[2C[ \033[01;32mOK\033[00m ]\n");
+    return E_TUXUP_NOERROR;
+}
+
+static int prog_tuxfw(char const *filename)
+{
+    tuxfw_t fw;
+    int ret;
+
+    if (!tuxfw_open(&fw, filename))
+        return E_TUXUP_BADPROGFILE;
+    ret = prog_image(&fw, filename);
+    tuxfw_close(&fw);
+    return ret;
+}
+
+/*
+ * Flash the hex file of the USB CPU held in a bundle. dfu-programmer reads
+ * it from a temporary file.
+ */
+static int prog_bundle_usb(bundle_t const *bundle, unsigned int i)
+{
+    bundle_entry_t const *entry = &bundle->entries[i];
+    char filename[] = "/tmp/tuxup-fuxusb-XXXXXX.hex";
+    version_bf_t version;
+    int fd, ret;
+    bool ok;
+
+    log_notice("Programming %s in the USB CPU\n", entry->name);
+    hex_version_from_raw(&entry->version, &version);
+    if (usb_skip(&version))
+        return E_TUXUP_NOERROR;
+
+    if ((fd = mkstemps(filename, 4)) < 0)
+    {
+        log_error("Unable to create a temporary file for %s", entry->name);
+        return E_TUXUP_PROGRAMMINGFAILED;
+    }
+    ok = write(fd, bundle_data(bundle, i), entry->size) == entry->size;
+    if (close(fd) != 0 || !ok)
+    {
+        log_error("Unable to write file '%s'", filename);
+        unlink(filename);
+        return E_TUXUP_PROGRAMMINGFAILED;
+    }
+    ret = flash_usb(filename);
+    unlink(filename);
+    return ret;
+}
+
+/*
+ * Program the images of a bundle in the order of its manifest. In MAIN mode
+ * only the images of tuxcore and tuxaudio are programmed. The whole bundle
+ * is checked before anything is programmed.
+ */
+static int prog_bundle(char const *filename, enum program_modes_t mode)
+{
+    bundle_t bundle;
+    bundle_entry_t const *entry;
+    tuxfw_t fw;
+    unsigned int i;
+    int ret = E_TUXUP_NOERROR;
+
+    log_info("Processing: %s\n", filename);
+    if (!bundle_open(&bundle, filename))
+        return E_TUXUP_BADPROGFILE;
+
+    for (i = 0; i < bundle.header->entry_count && !ret; i++)
+    {
+        entry = &bundle.entries[i];
+        if (mode == MAIN && entry->cpu_nbr != TUXCORE_CPU_NUM
+            && entry->cpu_nbr != TUXAUDIO_CPU_NUM)
+            continue;
+        if (entry->kind == BUNDLE_HEX)
+        {
+            if (entry->cpu_nbr == FUXUSB_CPU_NUM
+                && entry->flags & BUNDLE_HAS_VERSION)
+                ret = prog_bundle_usb(&bundle, i);
+            else
+                ret = E_TUXUP_BADPROGFILE;
+        }
+        else if (bundle_attach(&bundle, i, &fw))
+            ret = prog_image(&fw, entry->name);
+        else
+            ret = E_TUXUP_BADPROGFILE;
+        if (ret == E_TUXUP_BADPROGFILE)
+            log_error("%s is not a valid programming file.\n", entry->name);
+    }
+    bundle_close(&bundle);
+    return ret;
+}
+
+/*
+ * Tell if the name of a file ends with an extension, possibly followed by
+ * the extension of a compression ('tuxcore.hex.gz' is a .hex file).
+ */
+static bool has_extension(char const *filename, char const *extension)
+{
+    char const *compression = hex_scanner_compression(filename);
+    size_t len = compression ? (size_t)(compression - filename)
+                             : strlen(filename);
+    size_t ext_len = strlen(extension);
+
+    return len >= ext_len
+        && !strncmp(filename + len - ext_len, extension, ext_len);
+}
+
+/*
+ * Load a hex or eep file for a CPU behind the dongle, and tell which CPU
+ * and memory it is for. Returns false if it isn't one.
+ */
+static bool load_cpu_file(char const *filename, hex_image_t *image,
+                          int *cpu_nbr, int *mem_type)
+{
+    if (has_extension(filename, ".hex"))
+    {
+        if (check_hex_file(filename, image))
+        {
+            log_error("%s is not a hex file for a CPU of tuxdroid.\n",
+                      filename);
+            return false;
+        }
+        *cpu_nbr = image->version.cpu_nbr;
+        *mem_type = FLASH;
+        if (*cpu_nbr == FUXUSB_CPU_NUM)
+        {
+            log_error("%s is programmed by dfu-programmer, from the hex "
+                      "file.\n", filename);
+            hex_image_free(image);
+            return false;
+        }
+    }
+    else if (has_extension(filename, ".eep"))
+    {
+        *cpu_nbr = eeprom_cpu(filename);
+        *mem_type = EEPROM;
+        if (*cpu_nbr == INVALID_CPU_NUM || !hex_image_load(filename, image))
+        {
+            log_error("%s is not a valid eeprom file.\n", filename);
+            return false;
+        }
+    }
+    else
+    {
+        log_error("%s is not a hex or eep file.\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Compile a hex or eep file in a .tuxfw file, named after the input file.
+ */
+static int compile_file(char const *filename)
+{
+    char output[PATH_MAX];
+    char const *compression = hex_scanner_compression(filename);
+    hex_image_t image;
+    int cpu_nbr, mem_type;
+
+    if (!load_cpu_file(filename, &image, &cpu_nbr, &mem_type))
+        return E_TUXUP_BADPROGFILE;
+
+    /* The image of tuxcore.hex.gz is tuxcore.hex.tuxfw */
+    snprintf(output, sizeof(output), "%.*s.tuxfw",
+             compression ? (int)(compression - filename)
+                         : (int)strlen(filename), filename);
+    if (!tuxfw_compile(&image, cpu_nbr, mem_type, output))
+    {
+        hex_image_free(&image);
+        return E_TUXUP_BADPROGFILE;
+    }
+    log_notice("%s: %u pages written in %s", filename, image.page_count,
+               output);
+    hex_image_free(&image);
+    return E_TUXUP_NOERROR;
+}
+
+/*
+ * Build a bundle from the hex and eep files of a folder, in the order they
+ * are programmed by --all. The missing files are left out.
+ */
+static int make_bundle(char const *output, char const *path)
+{
+    static char const *s[] = { "fuxusb.hex", "tuxcore.hex", "tuxcore.eep",
+        "tuxaudio.hex", "tuxaudio.eep", "fuxrf.hex", "tuxrf.hex" };
+    char filename[PATH_MAX];
+    bundle_writer_t writer;
+    hex_image_t image;
+    version_t version;
+    unsigned int i;
+    int cpu_nbr, mem_type;
+    bool ok = true;
+
+    bundle_writer_init(&writer);
+    for (i = 0; i < countof(s) && ok; i++)
+    {
+        snprintf(filename, sizeof(filename), "%s%s%s", path,
+                 path[strlen(path) - 1] == '/' ? "" : "/", s[i]);
+        if (access(filename, R_OK))
+        {
+            log_info("%s not found, left out", filename);
+            continue;
+        }
+        if (!strcmp(strrchr(s[i], '.'), ".eep"))
+        {
+            cpu_nbr = eeprom_cpu(s[i]);
+            mem_type = EEPROM;
+            ok = hex_image_load(filename, &image);
+        }
+        else
+        {
+            ok = !check_hex_file(filename, &image);
+            cpu_nbr = ok ? image.version.cpu_nbr : INVALID_CPU_NUM;
+            mem_type = FLASH;
+        }
+        if (!ok)
+        {
+            log_error("%s is not a valid programming file.\n", filename);
+            break;
+        }
+
+        if (cpu_nbr == FUXUSB_CPU_NUM)
+        {
+            hex_image_get_version(&image, &version);
+            ok = bundle_add_file(&writer, s[i], filename, &version);
+        }
+        else
+            ok = bundle_add_image(&writer, s[i], &image, cpu_nbr, mem_type);
+        if (ok && image.has_version)
+            log_notice("%s: version %d.%d.%d, %u pages", s[i],
+                       image.version.ver_major, image.version.ver_minor,
+                       image.version.ver_update, image.page_count);
+        else if (ok)
+            log_notice("%s: %u pages", s[i], image.page_count);
+        hex_image_free(&image);
+    }
+
+    if (ok && writer.count == 0)
+    {
+        log_error("No hex or eep file found in %s", path);
+        ok = false;
+    }
+    if (ok && bundle_write(&writer, output))
+        log_notice("%u files written in %s", writer.count, output);
+    else
+        ok = false;
+    bundle_writer_free(&writer);
+    return ok ? E_TUXUP_NOERROR : E_TUXUP_BADPROGFILE;
+}
+
+/*
+ * Tell if a file is a bundle, from its extension.
+ */
+static bool is_bundle(char const *filename)
+{
+    char const *extension = strrchr(filename, '.');
+
+    return extension && !strcmp(extension, BUNDLE_EXTENSION);
+}
+
+/*
+ * Programming function. Depending on the name, the flash or eeprom
+ * programming will be selected. In case of eeprom, the correct CPU
+ * will be choosen from the filename.
+ */
+static int program(char const *filename, char const *path)
+{
+    int ret = E_TUXUP_BADPROGFILE;
+    size_t len;
+    char *extension, filenamepath[PATH_MAX];
+
+    if (path)
+    {
+        /* Append '/' at the end of the path if not specified. */
+        snprintf(filenamepath, sizeof(filenamepath), "%s%s%s", path,
+                 path[strlen(path) - 1] == '/' ? "" : "/", filename);
+        filename = filenamepath;
+    }
+    log_info("Processing: %s\n", filename);
+
+    extension = strrchr(filename, '.');
+    /* A hex file read from the standard input can only be an AVR one */
+    if (!strcmp(filename, HEX_SCANNER_STDIN))
+    {
+        ret = prog_flash(filename);
+    }
     /* check that an extension has been given */
-    if (extension)
+    else if (extension)
     {
         /* Check which program function to start. */
-        if (!strcmp(extension, ".hex"))
+        if (has_extension(filename, ".hex"))
         {
             int i, usb = 0;
 
@@ -600,24 +1374,20 @@ static int program(char const *filename, char const *path)
                 ret = prog_flash(filename);
             }
         }
-        else if (!strcmp(extension, ".eep"))
+        else if (has_extension(filename, ".eep"))
         {
-            int i;
+            int cpu_nbr = eeprom_cpu(filename);
 
-            len = strlen(filename);
-            for (i = 0; i < len - 7; i++)
-            {
-                if (!strncmp(filename + i, "tuxcore", 7))
-                {
-                    ret = prog_eeprom(TUXCORE_CPU_NUM, filename);
-                    break;
-                }
-                else if (!strncmp(filename + i, "tuxaudio", 7))
-                {
-                    ret = prog_eeprom(TUXAUDIO_CPU_NUM, filename);
-                    break;
-                }
-            }
+            if (cpu_nbr != INVALID_CPU_NUM)
+                ret = prog_eeprom(cpu_nbr, filename);
+        }
+        else if (!strcmp(extension, ".tuxfw"))
+        {
+            ret = prog_tuxfw(filename);
+        }
+        else if (!strcmp(extension, BUNDLE_EXTENSION))
+        {
+            return prog_bundle(filename, ALL);
         }
     }
     if (ret == E_TUXUP_BADPROGFILE)
@@ -625,20 +1395,453 @@ static int program(char const *filename, char const *path)
     return ret;
 }
 
+/*
+ * Print and write the statistics when the program exits, also after an
+ * error, which is when they are most useful.
+ */
+static void report_stats(void)
+{
+    if (print_stats)
+        stats_print(stdout);
+    if (stats_json)
+        stats_write_json(stats_json);
+}
+
+/* Options without a short form */
+enum { OPT_STATS_JSON = 256, OPT_DEVICE, OPT_ALL_DEVICES, OPT_EPOLL,
+       OPT_SOCKET, OPT_WAIT };
+
+/* Files to program on each dongle */
+static struct
+{
+    enum program_modes_t mode;
+    char const *path;
+    int file_count;
+    char **files;
+} job;
+
+/*
+ * Program the files of the job on the dongle of the session. With 'verify',
+ * fails if a CPU doesn't run the version of its file.
+ */
+static int program_files(void)
+{
+    int ret = E_TUXUP_NOERROR;
+
+    /* Select which files to program */
+    switch (job.mode)
+    {
+    case INPUTFILES:
+        {
+            int i;
+            for (i = 0; i < job.file_count && !ret ; ++i)
+                ret = program(job.files[i], NULL);
+        }
+        break;
+    case MAIN:
+        if (is_bundle(job.path))
+        {
+            ret = prog_bundle(job.path, MAIN);
+        }
+        else
+        {
+            char const *s[]={"tuxcore.hex", "tuxcore.eep", "tuxaudio.hex",
+                "tuxaudio.eep"};
+            char const **p;
+            for (p = s; p < &s[countof(s)] && !ret ; p++)
+                ret = program(*p, job.path);
+        }
+        break;
+    case ALL:
+        if (is_bundle(job.path))
+        {
+            ret = prog_bundle(job.path, ALL);
+        }
+        else
+        {
+            char const *s[]={"fuxusb.hex", "tuxcore.hex", "tuxcore.eep",
+                "tuxaudio.hex", "tuxaudio.eep", "fuxrf.hex", "tuxrf.hex"};
+            char const **p;
+            for (p = s; p < &s[countof(s)] && !ret ; p++)
+                ret = program(*p, job.path);
+        }
+        break;
+    default:
+        abort();
+    }
+
+    if (ret == E_TUXUP_NOERROR && verify_only && cpus_outdated)
+    {
+        log_notice("%d CPU%s not running these files", cpus_outdated,
+                   cpus_outdated > 1 ? "s are" : " is");
+        ret = E_TUXUP_PROGRAMMINGFAILED;
+    }
+    return ret;
+}
+
+/*
+ * Check if one of the files of the job is the standard input.
+ */
+static bool job_reads_stdin(void)
+{
+    int i;
+
+    if (job.mode != INPUTFILES)
+        return false;
+    for (i = 0; i < job.file_count; i++)
+    {
+        if (!strcmp(job.files[i], HEX_SCANNER_STDIN))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Program the files of the job on dongle index of devices, or on the first
+ * dongle found if none was given. Runs in a worker when several dongles are
+ * programmed.
+ */
+static int program_dongle(int index)
+{
+    static char json[PATH_MAX];
+    int ret;
+
+    if (device_count)
+        device_path = devices[index];
+    if (print_stats || stats_json)
+    {
+        /* Each worker writes its own file */
+        if (stats_json && device_count > 1)
+        {
+            snprintf(json, sizeof(json), "%s.%d", stats_json, index);
+            stats_json = json;
+        }
+        stats_enable();
+        atexit(report_stats);
+    }
+
+    ret = program_files();
+    fux_disconnect();
+    return ret;
+}
+
+/*
+ * Print the versions of the CPUs that reply, the others are likely in
+ * bootloader mode or tux is off.
+ */
+static int print_versions(void)
+{
+    version_t versions[HIGHEST_CPU_NUM + 1];
+    unsigned int received;
+    int cpu;
+
+    session_open();
+    received = query_versions((1 << (HIGHEST_CPU_NUM + 1)) - 1, versions);
+    for (cpu = LOWEST_CPU_NUM; cpu <= HIGHEST_CPU_NUM; cpu++)
+    {
+        char const *name = cpu == FUXUSB_CPU_NUM ? "fuxusb" : cpu_name[cpu];
+
+        if (!(received & (1 << cpu)))
+        {
+            log_notice("%-10s no reply", name);
+            continue;
+        }
+        log_notice("%-10s %d.%d.%d", name,
+                   CPU_VER_MAJ(versions[cpu].cpu_ver_maj),
+                   versions[cpu].ver_minor, versions[cpu].ver_update);
+        daemon_event("version",
+                     "\"cpu\": \"%s\", \"version\": \"%d.%d.%d\"", name,
+                     CPU_VER_MAJ(versions[cpu].cpu_ver_maj),
+                     versions[cpu].ver_minor, versions[cpu].ver_update);
+    }
+    return E_TUXUP_NOERROR;
+}
+
+/*
+ * Load a file to program with --epoll as a precompiled image. The hex and
+ * eep files are laid out in data as 'compile' would write them.
+ */
+static bool load_image(char const *filename, tuxfw_t *fw, uint8_t **data)
+{
+    char const *extension = strrchr(filename, '.');
+    hex_image_t image;
+    int cpu_nbr, mem_type;
+    size_t size;
+    bool ok;
+
+    *data = NULL;
+    if (extension && !strcmp(extension, ".tuxfw"))
+    {
+        if (!tuxfw_open(fw, filename))
+            return false;
+        if (check_image(fw, filename))
+            return true;
+        tuxfw_close(fw);
+        return false;
+    }
+
+    if (!load_cpu_file(filename, &image, &cpu_nbr, &mem_type))
+        return false;
+    ok = tuxfw_build(&image, cpu_nbr, mem_type, data, &size)
+         && tuxfw_attach(fw, *data, size, filename);
+    hex_image_free(&image);
+    if (!ok)
+    {
+        free(*data);
+        *data = NULL;
+    }
+    return ok;
+}
+
+/*
+ * Program the files given on the dongles from a single thread, see
+ * engine.c. Each file is programmed on all the dongles at once; a dongle
+ * that failed is left out of the next files. The versions aren't checked
+ * and the page cache isn't used.
+ */
+static int program_epoll(void)
+{
+    tuxup_session_t *sessions[WORKERS_MAX];
+    int index[WORKERS_MAX], status[WORKERS_MAX];
+    uint64_t elapsed[WORKERS_MAX];
+    uint8_t *data;
+    tuxfw_t fw;
+    int i, f, n, ret = E_TUXUP_NOERROR;
+
+    if (print_stats || stats_json)
+    {
+        stats_enable();
+        stats_set_transport("hidraw");
+        atexit(report_stats);
+    }
+    if (device_count == 0
+        && (device_count = transport_enumerate("hidraw", devices, 1)) == 0)
+    {
+        log_error("The dongle was not found, now exiting.\n");
+        return E_TUXUP_DONGLENOTFOUND;
+    }
+    if (stop_driver() > 0)
+        exit(E_SERVER_CONNECTION);
+
+    for (i = 0; i < device_count; i++)
+    {
+        status[i] = E_TUXUP_NOERROR;
+        elapsed[i] = 0;
+    }
+    for (f = 0; f < job.file_count; f++)
+    {
+        if (!load_image(job.files[f], &fw, &data))
+            return E_TUXUP_BADPROGFILE;
+        log_notice("\nProgramming %s in the %s CPU", job.files[f],
+                   cpu_name[fw.header->cpu_nbr]);
+
+        for (i = n = 0; i < device_count && !pretend; i++)
+        {
+            if (status[i] != E_TUXUP_NOERROR)
+                continue;
+            sessions[n] = tuxup_session_new(devices[i],
+                                            bl_addr[fw.header->cpu_nbr],
+                                            &fw, skip_blank);
+            if (sessions[n] == NULL)
+                status[i] = E_TUXUP_DONGLENOTFOUND;
+            else
+                index[n++] = i;
+        }
+        tuxup_sessions_run(sessions, n);
+        for (i = 0; i < n; i++)
+        {
+            /* The step of a session that is over only returns its state */
+            if (tuxup_session_step(sessions[i], 0) != TUXUP_SESSION_DONE)
+                status[index[i]] = E_TUXUP_PROGRAMMINGFAILED;
+            /* Time spent on this dongle, the slowest sets the run time */
+            elapsed[index[i]] += tuxup_session_elapsed_ms(sessions[i]);
+            tuxup_session_free(sessions[i]);
+        }
+        tuxfw_close(&fw);
+        free(data);
+    }
+
+    log_notice("\n%-32s %-8s %s", "Dongle", "Result", "Time");
+    for (i = 0; i < device_count; i++)
+    {
+        if (status[i] == E_TUXUP_NOERROR)
+            log_notice("%-32s %-8s %.1f s", devices[i], "OK",
+                       elapsed[i] / 1000.0);
+        else
+            log_notice("%-32s FAIL %-3d", devices[i], status[i]);
+        if (ret == E_TUXUP_NOERROR)
+            ret = status[i];
+    }
+    return ret;
+}
+
+/*
+ * Progress of the uploads of a daemon job, sent to its client.
+ */
+static void job_progress(uint8_t cpu_address, int mem_type,
+                         unsigned int sent, unsigned int total)
+{
+    daemon_event("progress", "\"cpu_address\": %d, \"mem\": \"%s\", "
+                 "\"sent\": %u, \"pages\": %u", cpu_address,
+                 mem_type == EEPROM ? "eeprom" : "flash", sent, total);
+}
+
+/*
+ * Connect the dongle of a daemon job. The connection is kept from a job to
+ * the next one on the same dongle.
+ */
+static int job_prepare(daemon_request_t const *request)
+{
+    static char device[TRANSPORT_DEVICE_SIZE];
+
+    if (session.connected && strcmp(device, request->device))
+        fux_disconnect();
+    snprintf(device, sizeof(device), "%s", request->device);
+    device_path = device[0] ? device : NULL;
+    return open_session();
+}
+
+/*
+ * Run a daemon job, in a child process of the daemon.
+ */
+static int job_run(daemon_request_t const *request)
+{
+    static char *files[DAEMON_FILES_MAX];
+    int i;
+
+    if (request->job == DAEMON_VERSION)
+        return print_versions();
+
+    pretend = request->pretend;
+    skip_blank = request->skip_blank;
+    full_flash = request->full;
+    update_only = request->update;
+    if (request->job == DAEMON_VERIFY)
+        verify_only = update_only = pretend = 1;
+    bootload_progress_hook(job_progress);
+
+    if (!strcmp(request->mode, "main"))
+        job.mode = MAIN;
+    else if (!strcmp(request->mode, "all"))
+        job.mode = ALL;
+    else
+        job.mode = INPUTFILES;
+    job.path = request->path;
+    for (i = 0; i < request->file_count; i++)
+        files[i] = (char *)request->files[i];
+    job.file_count = request->file_count;
+    job.files = files;
+    return program_files();
+}
+
+/*
+ * Drop the connection after a daemon job that failed or may have
+ * reprogrammed the dongle, which then comes back as another device.
+ */
+static void job_finish(daemon_request_t const *request, int code)
+{
+    bool usb = !strcmp(request->mode, "all");
+    int i;
+
+    for (i = 0; i < request->file_count; i++)
+    {
+        if (strstr(request->files[i], "fuxusb")
+            || is_bundle(request->files[i]))
+            usb = true;
+    }
+    /* A verification fails on the versions, not on the dongle */
+    if (request->job == DAEMON_VERIFY && code == E_TUXUP_PROGRAMMINGFAILED)
+        return;
+    if (code != E_TUXUP_NOERROR || (usb && !request->pretend
+                                    && request->job == DAEMON_FLASH))
+        fux_disconnect();
+}
+
+/*
+ * Run as a daemon serving the jobs sent on the socket.
+ */
+static int serve_jobs(void)
+{
+    static const daemon_ops_t ops = { job_prepare, job_run, job_finish };
+    int ret;
+
+    ret = daemon_serve(socket_path, &ops);
+    fux_disconnect();
+    if (start_driver() > 0)
+        return E_SERVER_CONNECTION;
+    return ret;
+}
+
+/*
+ * Send the job to the daemon. The files are given with their absolute path
+ * as the daemon doesn't run in the current directory.
+ */
+static int submit_job(daemon_job_t type)
+{
+    static daemon_request_t request;
+    int i;
+
+    if (device_count > 1 || all_devices || epoll_mode || transport_name)
+    {
+        log_error("The daemon programs one dongle per job, with the "
+                  "transport it found it on.");
+        usage(stderr, E_TUXUP_USAGE);
+    }
+    if (job.file_count > DAEMON_FILES_MAX)
+    {
+        log_error("At most %d files can be sent to the daemon.",
+                  DAEMON_FILES_MAX);
+        usage(stderr, E_TUXUP_USAGE);
+    }
+
+    snprintf(request.id, sizeof(request.id), "%d", (int)getpid());
+    request.job = type;
+    if (job.mode == MAIN || job.mode == ALL)
+    {
+        snprintf(request.mode, sizeof(request.mode), "%s",
+                 job.mode == MAIN ? "main" : "all");
+        if (realpath(job.path, request.path) == NULL)
+        {
+            log_error("Unable to find '%s'", job.path);
+            return E_TUXUP_BADPROGFILE;
+        }
+    }
+    else
+    {
+        for (i = 0; i < job.file_count; i++)
+        {
+            if (!strcmp(job.files[i], HEX_SCANNER_STDIN)
+                || realpath(job.files[i], request.files[i]) == NULL)
+            {
+                log_error("Unable to find '%s'", job.files[i]);
+                return E_TUXUP_BADPROGFILE;
+            }
+        }
+        request.file_count = job.file_count;
+    }
+    if (device_count)
+        snprintf(request.device, sizeof(request.device), "%s", devices[0]);
+    request.full = full_flash;
+    request.skip_blank = skip_blank;
+    request.update = update_only;
+    request.pretend = pretend;
+    return daemon_submit(socket_path, &request);
+}
+
 /*
  * Main application
  */
 int main(int argc, char *argv[])
 {
-    char path[PATH_MAX];
+    char path[PATH_MAX], default_socket[PATH_MAX];
     enum program_modes_t program_mode = NONE;
-    time_t start_time, end_time;
+    uint64_t start_time;
     int ret = E_TUXUP_NOERROR;
 
     int next_option;
 
     /* A string listing valid short options letters.  */
-    char const *const short_options = "maqphvdV";
+    char const *const short_options = "maqpbfusht:vdV";
 
     /* An array describing valid long options. */
     const struct option long_options[] = {
@@ -646,7 +1849,18 @@ int main(int argc, char *argv[])
         {"all",     0, NULL, 'a'},
         {"quiet",   0, NULL, 'q'},
         {"pretend", 0, NULL, 'p'},
+        {"skip-blank", 0, NULL, 'b'},
+        {"full",    0, NULL, 'f'},
+        {"update",  0, NULL, 'u'},
+        {"stats",   0, NULL, 's'},
+        {"stats-json", 1, NULL, OPT_STATS_JSON},
+        {"device",  1, NULL, OPT_DEVICE},
+        {"all-devices", 0, NULL, OPT_ALL_DEVICES},
+        {"epoll",   0, NULL, OPT_EPOLL},
+        {"socket",  2, NULL, OPT_SOCKET},
+        {"wait",    1, NULL, OPT_WAIT},
         {"help",    0, NULL, 'h'},
+        {"transport", 1, NULL, 't'},
         {"verbose", 0, NULL, 'v'},
         {"debug",   0, NULL, 'd'},
         {"version", 0, NULL, 'V'},
@@ -658,7 +1872,7 @@ int main(int argc, char *argv[])
     program_name = argv[0];
 
     /* Save the start time to measure the programming time */
-    start_time = time(NULL);
+    start_time = timer_now_ms();
 
     /* Flags to later select the correct log level */
     bool quiet = false, verbose = false, debug = false;
@@ -701,6 +1915,66 @@ int main(int argc, char *argv[])
         case 'p':              /* -a or --all */
             pretend = 1;
             break;
+        case 'b':              /* -b or --skip-blank */
+            skip_blank = 1;
+            break;
+        case 'f':              /* -f or --full */
+            full_flash = 1;
+            break;
+        case 'u':              /* -u or --update */
+            update_only = 1;
+            break;
+        case 's':              /* -s or --stats */
+            print_stats = 1;
+            break;
+        case OPT_STATS_JSON:   /* --stats-json */
+            stats_json = optarg;
+            break;
+        case OPT_DEVICE:       /* --device */
+            if (device_count == WORKERS_MAX)
+            {
+                log_error("At most %d dongles can be programmed at once.",
+                          WORKERS_MAX);
+                usage(stderr, E_TUXUP_USAGE);
+            }
+            snprintf(devices[device_count++], TRANSPORT_DEVICE_SIZE, "%s",
+                     optarg);
+            break;
+        case OPT_ALL_DEVICES:  /* --all-devices */
+            all_devices = 1;
+            break;
+        case OPT_EPOLL:        /* --epoll */
+            epoll_mode = 1;
+            break;
+        case OPT_WAIT:         /* --wait */
+            {
+                char *end;
+                double seconds = strtod(optarg, &end);
+
+                if (end == optarg || *end || seconds < 0 || seconds > 3600)
+                {
+                    log_error("'--wait' takes a number of seconds.");
+                    usage(stderr, E_TUXUP_USAGE);
+                }
+                connect_timeout = seconds * 1000;
+            }
+            break;
+        case OPT_SOCKET:       /* --socket */
+            if (optarg == NULL)
+            {
+                daemon_socket_path(default_socket, sizeof(default_socket));
+                optarg = default_socket;
+            }
+            socket_path = optarg;
+            break;
+        case 't':              /* -t or --transport */
+            if (transport_find(optarg) == NULL)
+            {
+                log_error("Unknown transport '%s'.", optarg);
+                usage(stderr, E_TUXUP_USAGE);
+            }
+            transport_name = optarg;
+            break;
         case 'v':              /* -v or  --verbose */
             verbose = true;
             break;
@@ -737,6 +2011,87 @@ int main(int argc, char *argv[])
     log_info("%s %s, an uploader program for tuxdroid.",
              program_name, program_version);
 
+    /* 'compile' only converts the files, the dongle isn't used. */
+    if (optind < argc && !strcmp(argv[optind], "compile"))
+    {
+        int i;
+
+        if (program_mode != NONE || optind + 1 == argc)
+        {
+            log_error("'compile' takes hex or eep files only.");
+            usage(stderr, E_TUXUP_USAGE);
+        }
+        for (i = optind + 1; i < argc && !ret; i++)
+            ret = compile_file(argv[i]);
+        return ret;
+    }
+
+    /* 'bundle' packs the files of a folder in one file. */
+    if (optind < argc && !strcmp(argv[optind], "bundle"))
+    {
+        if (program_mode != NONE || optind + 3 != argc
+            || !is_bundle(argv[optind + 1]))
+        {
+            log_error("'bundle' takes a %s file and a path.",
+                      BUNDLE_EXTENSION);
+            usage(stderr, E_TUXUP_USAGE);
+        }
+        return make_bundle(argv[optind + 1], argv[optind + 2]);
+    }
+
+    /* 'daemon' serves the jobs sent on the socket. */
+    if (optind < argc && !strcmp(argv[optind], "daemon"))
+    {
+        if (program_mode != NONE || optind + 1 != argc || device_count
+            || all_devices || epoll_mode)
+        {
+            log_error("'daemon' takes no file nor path, the jobs give "
+                      "them.");
+            usage(stderr, E_TUXUP_USAGE);
+        }
+        /* The dongle is opened by the daemon and used by the job children */
+        if (transport_name && transport_find(transport_name)->fork_unsafe)
+        {
+            log_error("The daemon can't use the '%s' transport.",
+                      transport_name);
+            usage(stderr, E_TUXUP_USAGE);
+        }
+        transport_require_fork_safe();
+        if (socket_path == NULL)
+        {
+            daemon_socket_path(default_socket, sizeof(default_socket));
+            socket_path = default_socket;
+        }
+        return serve_jobs();
+    }
+
+    /* 'version' prints the versions of the CPUs. */
+    if (optind < argc && !strcmp(argv[optind], "version"))
+    {
+        if (program_mode != NONE || optind + 1 != argc || device_count > 1
+            || all_devices)
+        {
+            log_error("'version' takes no file nor path.");
+            usage(stderr, E_TUXUP_USAGE);
+        }
+        if (socket_path)
+            return submit_job(DAEMON_VERSION);
+        if (device_count)
+            device_path = devices[0];
+        ret = print_versions();
+        fux_disconnect();
+        if (start_driver() > 0)
+            exit(E_SERVER_CONNECTION);
+        return ret;
+    }
+
+    /* 'verify' programs nothing, it only compares the versions. */
+    if (optind < argc && !strcmp(argv[optind], "verify"))
+    {
+        verify_only = update_only = pretend = 1;
+        optind++;
+    }
+
     /* If no program mode has been selected, choose INPUTFILES. */
     if (program_mode == NONE)
         program_mode = INPUTFILES;
@@ -746,7 +2101,7 @@ int main(int argc, char *argv[])
         if (program_mode != INPUTFILES)
         {
             if (argc == optind + 1)
-                strcpy(path, argv[optind]);
+                snprintf(path, sizeof(path), "%s", argv[optind]);
             else
             {
                 log_error("Too many files or paths specified.");
@@ -760,39 +2115,63 @@ int main(int argc, char *argv[])
         usage(stderr, E_TUXUP_USAGE);
     }
 
-    /* Select which files to program */
-    switch (program_mode)
+    job.mode = program_mode;
+    job.path = path;
+    job.file_count = argc - optind;
+    job.files = &argv[optind];
+
+    if (socket_path)
+        return submit_job(verify_only ? DAEMON_VERIFY : DAEMON_FLASH);
+
+    if (epoll_mode)
     {
-    case INPUTFILES:
+        if (program_mode != INPUTFILES
+            || (transport_name && strcmp(transport_name, "hidraw")))
         {
-            int i;
-            for (i = optind; i < argc && !ret ; ++i)
-                ret = program(argv[i], NULL);
+            log_error("'--epoll' takes hex, eep or tuxfw files and only "
+                      "drives hidraw devices.");
+            usage(stderr, E_TUXUP_USAGE);
         }
-        break;
-    case MAIN:
+        transport_name = "hidraw";
+    }
+
+    if (all_devices)
+    {
+        if (device_count)
         {
-            char const *s[]={"tuxcore.hex", "tuxcore.eep", "tuxaudio.hex",
-                "tuxaudio.eep"};
-            char const **p;
-            for (p = s; p < &s[countof(s)] && !ret ; p++)
-                ret = program(*p, path);
+            log_error("'--device' and '--all-devices' can't be used "
+                      "simultaneously.");
+            usage(stderr, E_TUXUP_USAGE);
         }
-        break;
-    case ALL:
+        device_count = transport_enumerate(transport_name, devices,
+                                           WORKERS_MAX);
+        if (device_count == 0)
         {
-            char const *s[]={"fuxusb.hex", "tuxcore.hex", "tuxcore.eep",
-                "tuxaudio.hex", "tuxaudio.eep", "fuxrf.hex", "tuxrf.hex"};
-            char const **p;
-            for (p = s; p < &s[countof(s)] && !ret ; p++)
-                ret = program(*p, path);
+            log_error("No dongle was found, now exiting.\n");
+            exit(E_TUXUP_DONGLENOTFOUND);
         }
-        break;
-    default:
-        abort();
+        log_info("%d dongle%s found", device_count,
+                 device_count > 1 ? "s" : "");
     }
 
-    fux_disconnect();
+    /* Each worker reads its files, only the first one would get the
+     * standard input. --epoll only takes hex, eep and tuxfw files. */
+    if (!epoll_mode && device_count > 1 && job_reads_stdin())
+    {
+        log_error("The standard input can't be programmed on several "
+                  "dongles.");
+        usage(stderr, E_TUXUP_USAGE);
+    }
+
+    if (epoll_mode)
+        ret = program_epoll();
+    else if (device_count > 1)
+    {
+        bootload_progress_lines(true);
+        ret = workers_run(devices, device_count, program_dongle);
+    }
+    else
+        ret = program_dongle(0);
    
     if (start_driver() > 0)
     {
@@ -800,8 +2179,8 @@ int main(int argc, char *argv[])
     }
 
     /* Print time elapsed for programming. */
-    end_time = time(NULL);
     if (!pretend)
-        log_notice("Time elapsed: %2.0f seconds.", difftime(end_time, start_time));
+        log_notice("Time elapsed: %2.0f seconds.",
+                   (timer_now_ms() - start_time) / 1000.0);
     return ret;
 }
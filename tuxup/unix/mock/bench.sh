@@ -0,0 +1,79 @@
+#!/bin/sh
+# $Id: $
+#
+# Throughput of tuxup against the emulated dongle, for each transport of
+# the LD_PRELOAD shim and for the in-process mock transport. Run from the tuxup directory, usually through
+# 'make bench'. The pages of a synthetic tuxcore image are all sent
+# (--full) and the memory written by the emulation is checked.
+#
+# PAGES, TUXUP_MOCK_LATENCY, TUXUP_MOCK_JITTER and TUXUP_MOCK_LOSS can be
+# set in the environment.
+
+PAGES=${PAGES:-256}
+TRANSPORTS=${TRANSPORTS:-"hidraw libusb mock"}
+MOCK=${MOCK:-./mock/libtuxup-mock.so}
+
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+mkdir "$WORK/home" "$WORK/dump"
+
+# Byte at address a is (a * 7) % 256, the version record of tuxcore 1.0.0
+# is at 0x1DF0.
+awk -v pages="$PAGES" '
+function record(addr, n, bytes,    i, sum, line) {
+    line = sprintf(":%02X%04X00", n, addr)
+    sum = n + int(addr / 256) + addr % 256
+    for (i = 0; i < n; i++) {
+        line = line sprintf("%02X", bytes[i])
+        sum += bytes[i]
+    }
+    printf "%s%02X\n", line, (256 - sum % 256) % 256
+}
+BEGIN {
+    for (a = 0; a < pages * 64; a += 16) {
+        for (i = 0; i < 16; i++)
+            b[i] = (a + i) * 7 % 256
+        record(a, 16, b)
+    }
+    split("200 8 0 0 0 0 0 0 0 0 0 0", v)
+    for (i = 0; i < 12; i++)
+        b[i] = v[i + 1]
+    record(7664, 12, b)
+    print ":00000001FF"
+}' > "$WORK/tuxcore.hex"
+
+status=0
+printf "%-8s %8s %12s %10s\n" transport pages pages/s ms/page
+for transport in $TRANSPORTS; do
+    rm -f "$WORK"/dump/*
+    # The mock transport runs the emulation in tuxup, without the shim
+    preload=$MOCK
+    [ "$transport" = mock ] && preload=
+    HOME="$WORK/home" TUXUP_MOCK_TRANSPORT=$transport \
+    TUXUP_MOCK_DUMP="$WORK/dump" LD_PRELOAD="$preload" \
+        ./tuxup --full -q --transport=$transport "$WORK/tuxcore.hex" \
+        2> "$WORK/log" > /dev/null
+    ret=$?
+    # mock: cpu 0x30, N pages in T ms, R pages/s, M ms/page
+    result=$(grep '^mock:' "$WORK/log" | tail -1)
+    if [ $ret -ne 0 ] || [ -z "$result" ]; then
+        echo "$transport: tuxup failed ($ret)"
+        cat "$WORK/log"
+        status=1
+        continue
+    fi
+    if ! od -An -tu1 -v "$WORK/dump/cpu-30.flash" | awk -v size="$PAGES" '
+        { for (i = 1; i <= NF; i++) {
+              if (a < size * 64 && (a < 7664 || a >= 7676) \
+                  && $i != a * 7 % 256)
+                  bad++
+              a++ } }
+        END { exit bad != 0 }'; then
+        echo "$transport: the flash doesn't hold the image"
+        status=1
+        continue
+    fi
+    echo "$result" | awk -v t="$transport" \
+        '{ printf "%-8s %8s %12s %10s\n", t, $4, $9, $11 }'
+done
+exit $status
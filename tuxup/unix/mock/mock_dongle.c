@@ -0,0 +1,264 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   mock_dongle.c
+ *
+ *   @brief  Emulation of the dongle and of the bootloaders of tux.
+ *
+ *   The commands sent by bootloader.c are decoded as the dongle does and
+ *   the pages are written in a virtual flash and eeprom per bootloader
+ *   address. Each command gets at most one reply, the transport delivers
+ *   it after mock_dongle_delay_us() unless mock_dongle_lost() tells to
+ *   drop it. The emulation is configured by the environment:
+ *
+ *   - TUXUP_MOCK_LATENCY   delay of the replies, in us (default 0)
+ *   - TUXUP_MOCK_JITTER    random delay added to the latency, in us
+ *   - TUXUP_MOCK_LOSS      percentage of the replies lost
+ *   - TUXUP_MOCK_DUMP      directory where the memories are written when
+ *                          the bootloader exits, as cpu-XX.flash and
+ *                          cpu-XX.eeprom, XX being the bootloader address
+ *                          (prefixed by the name of the dongle, e.g.
+ *                          mock1-cpu-XX.flash, when it has one)
+ *
+ *   The throughput of each bootloading is printed on stderr.
+ *
+ *   The state of the emulation is per thread: each thread started by the
+ *   shim for a hidraw device emulates a dongle of its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tux-api.h"
+#include "common/api.h"
+#include "common/defines.h"
+#include "mock_dongle.h"
+
+/* Size of the memories, the FILLPAGE address has 15 bits */
+#define MOCK_MEMORY_SIZE    0x8000
+#define MOCK_PAGE_SIZE      64
+/* Bytes of the segment carried by the first FILLPAGE packet */
+#define MOCK_FIRST_PACKET   34
+
+/* Version of fuxusb reported by the dongle */
+#define MOCK_FUXUSB_MAJOR   0
+#define MOCK_FUXUSB_MINOR   9
+#define MOCK_FUXUSB_UPDATE  0
+
+/** Memories of the CPU behind a bootloader address */
+typedef struct
+{
+    uint8_t memory[2][MOCK_MEMORY_SIZE];    /* Indexed by FLASH, EEPROM */
+    bool written[2];
+} mock_cpu_t;
+
+static __thread mock_cpu_t *cpus[128];
+
+static __thread struct
+{
+    unsigned int latency_us;
+    unsigned int jitter_us;
+    unsigned int loss;
+    const char *dump_dir;
+    const char *name;
+} config;
+
+/* Bootloading in progress */
+static __thread mock_cpu_t *cpu;
+static __thread uint8_t cpu_address;
+static __thread uint8_t segment[MOCK_PAGE_SIZE + 2];
+static __thread unsigned int packet;
+static __thread uint8_t counter;
+static __thread unsigned int pages;
+static __thread struct timespec start;
+
+static unsigned int env_value(const char *name)
+{
+    const char *value = getenv(name);
+
+    return value ? strtoul(value, NULL, 0) : 0;
+}
+
+/**
+ * \brief Read the configuration from the environment
+ * \param name  Name of the dongle when several are emulated, NULL if not
+ */
+void mock_dongle_init(const char *name)
+{
+    config.name = name;
+    config.latency_us = env_value("TUXUP_MOCK_LATENCY");
+    config.jitter_us = env_value("TUXUP_MOCK_JITTER");
+    config.loss = env_value("TUXUP_MOCK_LOSS");
+    config.dump_dir = getenv("TUXUP_MOCK_DUMP");
+    srand(time(NULL));
+}
+
+/**
+ * \brief Delay of the next reply: the latency plus a random jitter
+ */
+unsigned int mock_dongle_delay_us(void)
+{
+    if (config.jitter_us)
+        return config.latency_us + rand() % (config.jitter_us + 1);
+    return config.latency_us;
+}
+
+/**
+ * \brief Tell if the next reply is lost
+ */
+bool mock_dongle_lost(void)
+{
+    return config.loss && (unsigned int)(rand() % 100) < config.loss;
+}
+
+static void status_frame(uint8_t *reply, uint8_t status, uint8_t value)
+{
+    memset(reply, 0, MOCK_REPORT_SIZE);
+    reply[0] = BOOT_STATUS_FRAME;
+    reply[1] = status;
+    reply[2] = value;
+}
+
+static void dump_memory(int mem_type, const char *suffix)
+{
+    char filename[512];
+    FILE *fs;
+
+    if (!cpu->written[mem_type])
+        return;
+    snprintf(filename, sizeof(filename), "%s/%s%scpu-%02x.%s",
+             config.dump_dir, config.name ? config.name : "",
+             config.name ? "-" : "", cpu_address, suffix);
+    if ((fs = fopen(filename, "wb")) == NULL)
+    {
+        fprintf(stderr, "mock: unable to write %s\n", filename);
+        return;
+    }
+    fwrite(cpu->memory[mem_type], 1, MOCK_MEMORY_SIZE, fs);
+    fclose(fs);
+}
+
+static void boot_init(const uint8_t *command, uint8_t *reply)
+{
+    cpu_address = command[2] & 0x7F;
+    if (cpus[cpu_address] == NULL)
+    {
+        cpus[cpu_address] = malloc(sizeof(mock_cpu_t));
+        memset(cpus[cpu_address], 0xFF, sizeof(mock_cpu_t));
+    }
+    cpu = cpus[cpu_address];
+    cpu->written[FLASH] = cpu->written[EEPROM] = false;
+    packet = 0;
+    counter = 0;
+    pages = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    status_frame(reply, 0, BOOT_INIT_ACK);
+}
+
+static bool boot_fillpage(const uint8_t *command, uint8_t *reply)
+{
+    unsigned int addr;
+    int mem_type;
+
+    if (cpu == NULL)
+        return false;
+    if (packet == 0)
+    {
+        memcpy(segment, &command[2], MOCK_FIRST_PACKET);
+        packet = 1;
+        return false;
+    }
+    memcpy(&segment[MOCK_FIRST_PACKET], &command[2],
+           sizeof(segment) - MOCK_FIRST_PACKET);
+    packet = 0;
+
+    mem_type = (segment[0] & 0x80) ? EEPROM : FLASH;
+    addr = ((segment[0] & 0x7F) << 8 | segment[1]) & ~(MOCK_PAGE_SIZE - 1);
+    memcpy(&cpu->memory[mem_type][addr], &segment[2], MOCK_PAGE_SIZE);
+    cpu->written[mem_type] = true;
+    pages++;
+    status_frame(reply, 0, ++counter);
+    return true;
+}
+
+static void boot_exit(uint8_t *reply)
+{
+    struct timespec end;
+    double ms;
+
+    if (cpu != NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ms = (end.tv_sec - start.tv_sec) * 1e3
+             + (end.tv_nsec - start.tv_nsec) / 1e6;
+        fprintf(stderr, "mock: cpu 0x%02x, %u pages in %.1f ms, "
+                "%.1f pages/s, %.3f ms/page\n", cpu_address, pages, ms,
+                ms > 0 ? pages * 1e3 / ms : 0, pages ? ms / pages : 0);
+        if (config.dump_dir)
+        {
+            dump_memory(FLASH, "flash");
+            dump_memory(EEPROM, "eeprom");
+        }
+    }
+    cpu = NULL;
+    status_frame(reply, 0, BOOT_EXIT_ACK);
+}
+
+/**
+ * \brief Handle a report sent to the dongle
+ * \param command  Report, starting with its header
+ * \param reply    Reply of MOCK_REPORT_SIZE bytes
+ * \return true if the command has a reply
+ */
+bool mock_dongle_command(const uint8_t *command, uint8_t *reply)
+{
+    if (command[0] == HID_I2C_HEADER)
+    {
+        switch (command[1])
+        {
+        case BOOT_INIT:
+            boot_init(command, reply);
+            return true;
+        case BOOT_FILLPAGE:
+            return boot_fillpage(command, reply);
+        case BOOT_EXIT:
+            boot_exit(reply);
+            return true;
+        }
+        return false;
+    }
+
+    /* The CPUs of tux are in bootloader mode, only the dongle answers */
+    if (command[0] == DONGLE_CMD_HDR && command[1] == INFO_FUXUSB_CMD)
+    {
+        memset(reply, 0, MOCK_REPORT_SIZE);
+        reply[0] = VERSION_CMD;
+        reply[1] = FUXUSB_CPU_NUM | MOCK_FUXUSB_MAJOR << 3;
+        reply[2] = MOCK_FUXUSB_MINOR;
+        reply[3] = MOCK_FUXUSB_UPDATE;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,37 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef MOCK_DONGLE_H
+#define MOCK_DONGLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Size of the reports exchanged with the dongle */
+#define MOCK_REPORT_SIZE    64
+
+/* Prototypes */
+void mock_dongle_init(const char *name);
+bool mock_dongle_command(const uint8_t *command, uint8_t *reply);
+unsigned int mock_dongle_delay_us(void);
+bool mock_dongle_lost(void);
+
+#endif /* MOCK_DONGLE_H */
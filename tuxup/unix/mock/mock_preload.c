@@ -0,0 +1,519 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   mock_preload.c
+ *
+ *   @brief  LD_PRELOAD shim putting the emulated dongle of mock_dongle.c
+ *   behind the interfaces tuxup uses, so that the real binary can be run
+ *   and timed without any hardware.
+ *
+ *   TUXUP_MOCK_TRANSPORT selects the interface:
+ *
+ *   - hidraw (default)  /dev/hidraw-mock0, /dev/hidraw-mock1... are
+ *                       added to /dev, TUXUP_MOCK_DEVICES of them
+ *                       (default 1), and sysfs is hidden: they have
+ *                       no USB port and no page cache. The reports of
+ *                       each opening go through a socket pair to a
+ *                       thread running an emulation of its own.
+ *   - libusb            the libusb-0.1 functions find a single dongle and
+ *                       exchange the reports with the emulation.
+ *
+ *   The other calls are passed to the C library and to libusb.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/hidraw.h>
+#include <usb.h>
+
+#include "usb-connection.h"
+#include "mock_dongle.h"
+
+#define MOCK_HIDRAW_NAME    "hidraw-mock"
+#define MOCK_HIDRAW_PATH    "/dev/" MOCK_HIDRAW_NAME
+/* Highest file descriptor that can be a mock device */
+#define MOCK_FD_MAX         1024
+/* Replies waiting to be read through libusb */
+#define MOCK_QUEUE_SIZE     16
+
+/* Report descriptor: one input and one output report of 64 bytes */
+static const uint8_t report_descriptor[] = {
+    0x06, 0x00, 0xFF,               /* Usage page (vendor) */
+    0x09, 0x01,                     /* Usage */
+    0xA1, 0x01,                     /* Collection (application) */
+    0x75, 0x08,                     /*   Report size (8) */
+    0x95, MOCK_REPORT_SIZE,         /*   Report count */
+    0x09, 0x01,                     /*   Usage */
+    0x81, 0x02,                     /*   Input */
+    0x95, MOCK_REPORT_SIZE,         /*   Report count */
+    0x09, 0x01,                     /*   Usage */
+    0x91, 0x02,                     /*   Output */
+    0xC0                            /* End collection */
+};
+
+enum { TRANSPORT_HIDRAW, TRANSPORT_LIBUSB };
+static int transport = -1;
+
+static DIR *dev_dir;
+static int dev_dir_listed;          /* Mock devices listed */
+static int hidraw_devices;
+/* Mock device of each file descriptor, plus one, 0 for the others */
+static int hidraw_fds[MOCK_FD_MAX];
+
+static struct usb_bus mock_bus;
+static struct usb_device mock_device;
+
+static struct
+{
+    uint8_t report[MOCK_REPORT_SIZE];
+    struct timespec due;
+} queue[MOCK_QUEUE_SIZE];
+static unsigned int queue_head, queue_count;
+
+#define REAL(name)  real_##name = dlsym(RTLD_NEXT, #name)
+
+static void mock_init(void)
+{
+    const char *name;
+
+    if (transport >= 0)
+        return;
+    name = getenv("TUXUP_MOCK_TRANSPORT");
+    transport = (name && !strcmp(name, "libusb")) ? TRANSPORT_LIBUSB
+                                                  : TRANSPORT_HIDRAW;
+    name = getenv("TUXUP_MOCK_DEVICES");
+    hidraw_devices = name ? atoi(name) : 1;
+    mock_dongle_init(NULL);
+}
+
+/*
+ * hidraw
+ */
+
+/** Emulation of an opened hidraw device */
+typedef struct
+{
+    int fd;
+    char name[32];
+} hidraw_mock_t;
+
+/**
+ * Emulation thread of the hidraw device: the output reports are prefixed
+ * by their number, 0, the input reports are not numbered.
+ */
+static void *hidraw_thread(void *arg)
+{
+    hidraw_mock_t *mock = arg;
+    int fd = mock->fd;
+    uint8_t report[MOCK_REPORT_SIZE + 1], reply[MOCK_REPORT_SIZE];
+    unsigned int delay;
+    ssize_t len;
+
+    /* The dumps are only told apart when there are several dongles */
+    mock_dongle_init(hidraw_devices > 1 ? mock->name : NULL);
+    while ((len = recv(fd, report, sizeof(report), 0)) > 0)
+    {
+        if (len != sizeof(report) || !mock_dongle_command(&report[1], reply))
+            continue;
+        if ((delay = mock_dongle_delay_us()))
+            usleep(delay);
+        if (!mock_dongle_lost())
+            send(fd, reply, sizeof(reply), 0);
+    }
+    close(fd);
+    free(mock);
+    return NULL;
+}
+
+/**
+ * Index of the mock device at path, -1 if it isn't one.
+ */
+static int hidraw_index(const char *path)
+{
+    char *end;
+    long i;
+
+    if (strncmp(path, MOCK_HIDRAW_PATH, strlen(MOCK_HIDRAW_PATH)))
+        return -1;
+    path += strlen(MOCK_HIDRAW_PATH);
+    i = strtol(path, &end, 10);
+    if (end == path || *end || i < 0 || i >= hidraw_devices)
+        return -1;
+    return i;
+}
+
+static int hidraw_open(int index)
+{
+    hidraw_mock_t *mock;
+    pthread_t thread;
+    int fds[2];
+
+    if ((mock = malloc(sizeof(hidraw_mock_t))) == NULL)
+        return -1;
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+    {
+        free(mock);
+        return -1;
+    }
+    mock->fd = fds[1];
+    snprintf(mock->name, sizeof(mock->name), "%s%d", MOCK_HIDRAW_NAME,
+             index);
+    if (fds[0] >= MOCK_FD_MAX
+        || pthread_create(&thread, NULL, hidraw_thread, mock))
+    {
+        close(fds[0]);
+        close(fds[1]);
+        free(mock);
+        return -1;
+    }
+    pthread_detach(thread);
+    hidraw_fds[fds[0]] = index + 1;
+    return fds[0];
+}
+
+static int hidraw_ioctl(unsigned long request, void *arg)
+{
+    struct hidraw_devinfo *info = arg;
+    struct hidraw_report_descriptor *desc = arg;
+
+    if (request == HIDIOCGRAWINFO)
+    {
+        info->bustype = 3;          /* BUS_USB */
+        info->vendor = TUX_VENDOR_ID;
+        info->product = TUX_PRODUCT_ID;
+        return 0;
+    }
+    if (request == HIDIOCGRDESCSIZE)
+    {
+        *(int *)arg = sizeof(report_descriptor);
+        return 0;
+    }
+    if (request == HIDIOCGRDESC)
+    {
+        memcpy(desc->value, report_descriptor, sizeof(report_descriptor));
+        return 0;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+DIR *opendir(const char *name)
+{
+    static DIR *(*real_opendir)(const char *);
+    DIR *dir;
+
+    if (!real_opendir)
+        REAL(opendir);
+    mock_init();
+    /* The mock devices have no sysfs entry: without sysfs, tuxup looks
+     * for the dongles in /dev */
+    if (transport == TRANSPORT_HIDRAW
+        && !strncmp(name, "/sys/bus/usb/devices", 20))
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+    dir = real_opendir(name);
+    if (transport == TRANSPORT_HIDRAW && dir
+        && (!strcmp(name, "/dev") || !strcmp(name, "/dev/")))
+    {
+        dev_dir = dir;
+        dev_dir_listed = 0;
+    }
+    return dir;
+}
+
+struct dirent *readdir(DIR *dir)
+{
+    static struct dirent *(*real_readdir)(DIR *);
+    static struct dirent entry;
+    struct dirent *dinfo;
+
+    if (!real_readdir)
+        REAL(readdir);
+    dinfo = real_readdir(dir);
+    /* The mock devices are listed last, after the real ones */
+    if (dinfo == NULL && dir == dev_dir && dev_dir_listed < hidraw_devices)
+    {
+        memset(&entry, 0, sizeof(entry));
+        entry.d_type = DT_CHR;
+        snprintf(entry.d_name, sizeof(entry.d_name), "%s%d",
+                 MOCK_HIDRAW_NAME, dev_dir_listed++);
+        return &entry;
+    }
+    return dinfo;
+}
+
+int closedir(DIR *dir)
+{
+    static int (*real_closedir)(DIR *);
+
+    if (!real_closedir)
+        REAL(closedir);
+    if (dir == dev_dir)
+        dev_dir = NULL;
+    return real_closedir(dir);
+}
+
+static int open_file(int (*real_open)(const char *, int, ...),
+                     const char *path, int flags, va_list ap)
+{
+    mode_t mode = 0;
+    int index;
+
+    mock_init();
+    if (transport == TRANSPORT_HIDRAW && (index = hidraw_index(path)) >= 0)
+        return hidraw_open(index);
+    if (flags & O_CREAT)
+        mode = va_arg(ap, mode_t);
+    return real_open(path, flags, mode);
+}
+
+int open(const char *path, int flags, ...)
+{
+    static int (*real_open)(const char *, int, ...);
+    va_list ap;
+    int fd;
+
+    if (!real_open)
+        REAL(open);
+    va_start(ap, flags);
+    fd = open_file(real_open, path, flags, ap);
+    va_end(ap);
+    return fd;
+}
+
+int open64(const char *path, int flags, ...)
+{
+    static int (*real_open64)(const char *, int, ...);
+    va_list ap;
+    int fd;
+
+    if (!real_open64)
+        REAL(open64);
+    va_start(ap, flags);
+    fd = open_file(real_open64, path, flags, ap);
+    va_end(ap);
+    return fd;
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+    static int (*real_ioctl)(int, unsigned long, ...);
+    va_list ap;
+    void *arg;
+
+    if (!real_ioctl)
+        REAL(ioctl);
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+    if (fd >= 0 && fd < MOCK_FD_MAX && hidraw_fds[fd])
+        return hidraw_ioctl(request, arg);
+    return real_ioctl(fd, request, arg);
+}
+
+int close(int fd)
+{
+    static int (*real_close)(int);
+
+    if (!real_close)
+        REAL(close);
+    if (fd >= 0 && fd < MOCK_FD_MAX)
+        hidraw_fds[fd] = 0;
+    return real_close(fd);
+}
+
+/*
+ * libusb-0.1
+ */
+
+#define IS_MOCK(dev_h)  ((void *)(dev_h) == (void *)&mock_device)
+
+static void timespec_add_us(struct timespec *ts, unsigned int us)
+{
+    ts->tv_nsec += (long)us * 1000;
+    ts->tv_sec += ts->tv_nsec / 1000000000;
+    ts->tv_nsec %= 1000000000;
+}
+
+void usb_init(void)
+{
+    static void (*real_usb_init)(void);
+
+    mock_init();
+    if (transport == TRANSPORT_LIBUSB)
+        return;
+    if (!real_usb_init)
+        REAL(usb_init);
+    real_usb_init();
+}
+
+int usb_find_busses(void)
+{
+    static int (*real_usb_find_busses)(void);
+
+    mock_init();
+    if (transport == TRANSPORT_LIBUSB)
+        return 1;
+    if (!real_usb_find_busses)
+        REAL(usb_find_busses);
+    return real_usb_find_busses();
+}
+
+int usb_find_devices(void)
+{
+    static int (*real_usb_find_devices)(void);
+
+    mock_init();
+    if (transport == TRANSPORT_LIBUSB)
+    {
+        strcpy(mock_bus.dirname, "mock");
+        mock_bus.devices = &mock_device;
+        strcpy(mock_device.filename, "dongle");
+        mock_device.bus = &mock_bus;
+        mock_device.descriptor.idVendor = TUX_VENDOR_ID;
+        mock_device.descriptor.idProduct = TUX_PRODUCT_ID;
+        mock_device.descriptor.bcdDevice = 0x0100;
+        usb_busses = &mock_bus;
+        return 1;
+    }
+    if (!real_usb_find_devices)
+        REAL(usb_find_devices);
+    return real_usb_find_devices();
+}
+
+usb_dev_handle *usb_open(struct usb_device *dev)
+{
+    static usb_dev_handle *(*real_usb_open)(struct usb_device *);
+
+    if (dev == &mock_device)
+        return (usb_dev_handle *)&mock_device;
+    if (!real_usb_open)
+        REAL(usb_open);
+    return real_usb_open(dev);
+}
+
+int usb_close(usb_dev_handle *dev_h)
+{
+    static int (*real_usb_close)(usb_dev_handle *);
+
+    if (IS_MOCK(dev_h))
+    {
+        queue_count = 0;
+        return 0;
+    }
+    if (!real_usb_close)
+        REAL(usb_close);
+    return real_usb_close(dev_h);
+}
+
+int usb_claim_interface(usb_dev_handle *dev_h, int interface)
+{
+    static int (*real_usb_claim_interface)(usb_dev_handle *, int);
+
+    if (IS_MOCK(dev_h))
+        return 0;
+    if (!real_usb_claim_interface)
+        REAL(usb_claim_interface);
+    return real_usb_claim_interface(dev_h, interface);
+}
+
+int usb_release_interface(usb_dev_handle *dev_h, int interface)
+{
+    static int (*real_usb_release_interface)(usb_dev_handle *, int);
+
+    if (IS_MOCK(dev_h))
+        return 0;
+    if (!real_usb_release_interface)
+        REAL(usb_release_interface);
+    return real_usb_release_interface(dev_h, interface);
+}
+
+int usb_interrupt_write(usb_dev_handle *dev_h, int ep, char *bytes,
+                        int size, int timeout)
+{
+    static int (*real_usb_interrupt_write)(usb_dev_handle *, int, char *,
+                                           int, int);
+    uint8_t command[MOCK_REPORT_SIZE], reply[MOCK_REPORT_SIZE];
+    unsigned int tail;
+
+    if (!IS_MOCK(dev_h))
+    {
+        if (!real_usb_interrupt_write)
+            REAL(usb_interrupt_write);
+        return real_usb_interrupt_write(dev_h, ep, bytes, size, timeout);
+    }
+    if (size > MOCK_REPORT_SIZE)
+        return -EINVAL;
+    memset(command, 0, sizeof(command));
+    memcpy(command, bytes, size);
+    if (mock_dongle_command(command, reply) && !mock_dongle_lost()
+        && queue_count < MOCK_QUEUE_SIZE)
+    {
+        tail = (queue_head + queue_count++) % MOCK_QUEUE_SIZE;
+        memcpy(queue[tail].report, reply, sizeof(reply));
+        clock_gettime(CLOCK_MONOTONIC, &queue[tail].due);
+        timespec_add_us(&queue[tail].due, mock_dongle_delay_us());
+    }
+    return size;
+}
+
+int usb_interrupt_read(usb_dev_handle *dev_h, int ep, char *bytes, int size,
+                       int timeout)
+{
+    static int (*real_usb_interrupt_read)(usb_dev_handle *, int, char *,
+                                          int, int);
+
+    if (!IS_MOCK(dev_h))
+    {
+        if (!real_usb_interrupt_read)
+            REAL(usb_interrupt_read);
+        return real_usb_interrupt_read(dev_h, ep, bytes, size, timeout);
+    }
+    if (queue_count == 0)
+    {
+        usleep(timeout * 1000);
+        return -ETIMEDOUT;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &queue[queue_head].due,
+                    NULL);
+    if (size > MOCK_REPORT_SIZE)
+        size = MOCK_REPORT_SIZE;
+    memcpy(bytes, queue[queue_head].report, size);
+    queue_head = (queue_head + 1) % MOCK_QUEUE_SIZE;
+    queue_count--;
+    return size;
+}
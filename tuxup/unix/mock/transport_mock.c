@@ -0,0 +1,169 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   transport_mock.c
+ *
+ *   @brief  Transport to the emulated dongle of mock_dongle.c, in the
+ *   process. Selected with '--transport=mock'.
+ *
+ *   TUXUP_MOCK_DEVICES dongles (default 1) are listed, as mock0, mock1...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "transport.h"
+#include "mock_dongle.h"
+
+/* Replies waiting to be read */
+#define MOCK_QUEUE_SIZE     16
+
+static struct
+{
+    uint8_t report[MOCK_REPORT_SIZE];
+    struct timespec due;
+} queue[MOCK_QUEUE_SIZE];
+static unsigned int queue_head, queue_count;
+static char name[TRANSPORT_DEVICE_SIZE];
+
+static void timespec_add_us(struct timespec *ts, long us)
+{
+    ts->tv_nsec += us * 1000;
+    ts->tv_sec += ts->tv_nsec / 1000000000;
+    ts->tv_nsec %= 1000000000;
+}
+
+/**
+ * Number of dongles emulated
+ */
+static int mock_devices(void)
+{
+    const char *value = getenv("TUXUP_MOCK_DEVICES");
+
+    return value ? atoi(value) : 1;
+}
+
+static int mock_enumerate(char devices[][TRANSPORT_DEVICE_SIZE], int max)
+{
+    int i;
+
+    for (i = 0; i < mock_devices() && i < max; i++)
+        snprintf(devices[i], TRANSPORT_DEVICE_SIZE, "mock%d", i);
+    return i;
+}
+
+static bool mock_open(const char *device)
+{
+    char *end;
+    long i;
+
+    if (device == NULL)
+        device = "mock0";
+    if (strncmp(device, "mock", 4))
+        return false;
+    i = strtol(device + 4, &end, 10);
+    if (end == device + 4 || *end || i < 0 || i >= mock_devices())
+        return false;
+
+    snprintf(name, sizeof(name), "%s", device);
+    /* The dumps are only told apart when there are several dongles */
+    mock_dongle_init(mock_devices() > 1 ? name : NULL);
+    queue_count = 0;
+    return true;
+}
+
+static void mock_close(void)
+{
+    queue_count = 0;
+}
+
+static bool mock_get_id(char *id, int size)
+{
+    snprintf(id, size, "%s", name);
+    return true;
+}
+
+static bool mock_get_path(char *path, int size)
+{
+    snprintf(path, size, "%s", name);
+    return true;
+}
+
+static bool mock_write_report(const uint8_t *data, int size)
+{
+    uint8_t command[MOCK_REPORT_SIZE], reply[MOCK_REPORT_SIZE];
+    unsigned int tail;
+
+    if (size > MOCK_REPORT_SIZE)
+        return false;
+    memset(command, 0, sizeof(command));
+    memcpy(command, data, size);
+    if (mock_dongle_command(command, reply) && !mock_dongle_lost()
+        && queue_count < MOCK_QUEUE_SIZE)
+    {
+        tail = (queue_head + queue_count++) % MOCK_QUEUE_SIZE;
+        memcpy(queue[tail].report, reply, sizeof(reply));
+        clock_gettime(CLOCK_MONOTONIC, &queue[tail].due);
+        timespec_add_us(&queue[tail].due, mock_dongle_delay_us());
+    }
+    return true;
+}
+
+static bool mock_read_report(uint8_t *data, int size, int timeout_ms)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    timespec_add_us(&deadline, timeout_ms * 1000L);
+    if (queue_count == 0
+        || queue[queue_head].due.tv_sec > deadline.tv_sec
+        || (queue[queue_head].due.tv_sec == deadline.tv_sec
+            && queue[queue_head].due.tv_nsec > deadline.tv_nsec))
+    {
+        /* Nothing arrives in time */
+        if (timeout_ms > 0)
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        return false;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &queue[queue_head].due,
+                    NULL);
+    if (size > MOCK_REPORT_SIZE)
+        size = MOCK_REPORT_SIZE;
+    memcpy(data, queue[queue_head].report, size);
+    queue_head = (queue_head + 1) % MOCK_QUEUE_SIZE;
+    queue_count--;
+    return true;
+}
+
+const transport_t transport_mock = {
+    .name = "mock",
+    .open = mock_open,
+    .close = mock_close,
+    .enumerate = mock_enumerate,
+    .get_id = mock_get_id,
+    .get_path = mock_get_path,
+    .write_report = mock_write_report,
+    .read_report = mock_read_report,
+};
@@ -0,0 +1,300 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   page_cache.c
+ *
+ *   @brief  Record of the pages last programmed in each CPU, used to only
+ *   send the pages that changed since.
+ *
+ *   One record is kept per dongle, CPU and memory type in
+ *   ~/.tuxup/cache. It holds the version of the firmware and a hash of
+ *   every page of the image that was programmed. The record is only
+ *   written once the whole image has been programmed successfully.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "page_cache.h"
+#include "tux-api.h"
+#include "log.h"
+
+/** First line of a record */
+#define CACHE_MAGIC     "tuxup-cache 1"
+
+/**
+ * FNV-1a hash of a page and its address.
+ */
+static uint64_t page_hash(const hex_page_t *page)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        hash ^= (page->addr >> (8 * i)) & 0xFF;
+        hash *= 0x100000001b3ULL;
+    }
+    for (i = 0; i < HEX_PAGE_SIZE; i++)
+    {
+        hash ^= page->data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Create a directory if it doesn't exist yet.
+ */
+static bool make_dir(const char *path)
+{
+    return (mkdir(path, 0755) == 0) || (errno == EEXIST);
+}
+
+/**
+ * Read the record file. Anything unexpected in the file discards the whole
+ * record.
+ */
+static void load_record(page_cache_t *cache)
+{
+    FILE *fs;
+    char magic[32];
+    unsigned int v[4];
+    unsigned int addr, alloc = 0;
+    unsigned long long hash;
+    page_hash_t *pages;
+
+    if ((fs = fopen(cache->path, "r")) == NULL)
+        return;
+
+    if (fgets(magic, sizeof(magic), fs) == NULL
+        || strncmp(magic, CACHE_MAGIC, strlen(CACHE_MAGIC))
+        || fscanf(fs, " version %x %x %x %x", &v[0], &v[1], &v[2], &v[3])
+           != 4)
+    {
+        fclose(fs);
+        return;
+    }
+    cache->version.version_cmd = v[0];
+    cache->version.cpu_ver_maj = v[1];
+    cache->version.ver_minor = v[2];
+    cache->version.ver_update = v[3];
+
+    while (fscanf(fs, " %x %llx", &addr, &hash) == 2)
+    {
+        if (cache->count == alloc)
+        {
+            alloc = alloc ? 2 * alloc : 256;
+            pages = realloc(cache->pages, alloc * sizeof(page_hash_t));
+            if (pages == NULL)
+            {
+                fclose(fs);
+                cache->count = 0;
+                return;
+            }
+            cache->pages = pages;
+        }
+        /* Pages are recorded in increasing addresses */
+        if (cache->count && addr <= cache->pages[cache->count - 1].addr)
+        {
+            fclose(fs);
+            cache->count = 0;
+            return;
+        }
+        cache->pages[cache->count].addr = addr;
+        cache->pages[cache->count].hash = hash;
+        cache->count++;
+    }
+    cache->loaded = feof(fs);
+    if (!cache->loaded)
+        cache->count = 0;
+    fclose(fs);
+}
+
+/**
+ * Look for the hash recorded for the page at addr.
+ */
+static const page_hash_t *find_page(const page_cache_t *cache, uint32_t addr)
+{
+    unsigned int low = 0, high = cache->count, mid;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+        if (cache->pages[mid].addr == addr)
+            return &cache->pages[mid];
+        if (cache->pages[mid].addr < addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return NULL;
+}
+
+/**
+ * \brief Open the record of a CPU memory behind a dongle
+ * \param dongle_id  Identifier of the dongle, from its serial number or
+ *                   USB path
+ * \return false if the cache directory can't be used
+ */
+bool page_cache_open(page_cache_t *cache, const char *dongle_id,
+                     uint8_t cpu_nbr, int mem_type)
+{
+    const char *home = getenv("HOME");
+    char name[128];
+    int i;
+
+    memset(cache, 0, sizeof(*cache));
+    if (home == NULL)
+        return false;
+
+    /* Keep the identifier usable as a file name */
+    snprintf(name, sizeof(name), "%s", dongle_id);
+    for (i = 0; name[i]; i++)
+    {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '-')
+            name[i] = '_';
+    }
+
+    snprintf(cache->path, sizeof(cache->path), "%s/.tuxup", home);
+    if (!make_dir(cache->path))
+        return false;
+    snprintf(cache->path, sizeof(cache->path), "%s/.tuxup/cache", home);
+    if (!make_dir(cache->path))
+        return false;
+    snprintf(cache->path, sizeof(cache->path), "%s/.tuxup/cache/%s-%d-%s",
+             home, name, cpu_nbr, mem_type == EEPROM ? "eeprom" : "flash");
+
+    load_record(cache);
+    log_debug("Page cache %s: %s", cache->path,
+              cache->loaded ? "found" : "empty");
+    return true;
+}
+
+/**
+ * \brief Remove from the image the pages that are already programmed
+ *
+ * The hashes of all the pages of the image are kept to be recorded by
+ * page_cache_commit() once they have been programmed.
+ *
+ * \return the number of pages removed
+ */
+unsigned int page_cache_filter(page_cache_t *cache, hex_image_t *image)
+{
+    const page_hash_t *recorded;
+    unsigned int i, count = 0;
+
+    free(cache->next_pages);
+    cache->next_count = 0;
+    cache->next_pages = malloc((image->page_count + 1) * sizeof(page_hash_t));
+    if (cache->next_pages == NULL)
+        return 0;
+
+    for (i = 0; i < image->page_count; i++)
+    {
+        cache->next_pages[i].addr = image->pages[i].addr;
+        cache->next_pages[i].hash = page_hash(&image->pages[i]);
+    }
+    cache->next_count = image->page_count;
+
+    if (!cache->loaded)
+        return 0;
+
+    for (i = 0; i < image->page_count; i++)
+    {
+        recorded = find_page(cache, image->pages[i].addr);
+        if (recorded && recorded->hash == cache->next_pages[i].hash)
+            continue;
+        if (count != i)
+            image->pages[count] = image->pages[i];
+        count++;
+    }
+
+    i = image->page_count - count;
+    image->page_count = count;
+    return i;
+}
+
+/**
+ * \brief Record the image given to page_cache_filter() as programmed
+ * \param version  Version of the firmware now in the CPU
+ */
+bool page_cache_commit(page_cache_t *cache, const version_t *version)
+{
+    char tmp_path[PATH_MAX + 8];
+    unsigned int i;
+    FILE *fs;
+
+    if (!cache->path[0] || cache->next_pages == NULL)
+        return false;
+
+    /* Write a new file and rename it so that a record is never partial */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+    if ((fs = fopen(tmp_path, "w")) == NULL)
+        return false;
+
+    fprintf(fs, "%s\nversion %02x %02x %02x %02x\n", CACHE_MAGIC,
+            version->version_cmd, version->cpu_ver_maj, version->ver_minor,
+            version->ver_update);
+    for (i = 0; i < cache->next_count; i++)
+        fprintf(fs, "%04x %016llx\n", cache->next_pages[i].addr,
+                (unsigned long long)cache->next_pages[i].hash);
+
+    if (fclose(fs) != 0 || rename(tmp_path, cache->path) != 0)
+    {
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Forget the record, the content of the CPU is unknown
+ */
+void page_cache_invalidate(page_cache_t *cache)
+{
+    if (cache->path[0])
+        unlink(cache->path);
+    cache->loaded = false;
+    cache->count = 0;
+}
+
+/**
+ * \brief Release the memory used by the cache
+ */
+void page_cache_close(page_cache_t *cache)
+{
+    free(cache->pages);
+    free(cache->next_pages);
+    cache->pages = NULL;
+    cache->next_pages = NULL;
+    cache->count = 0;
+    cache->next_count = 0;
+}
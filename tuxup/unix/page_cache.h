@@ -0,0 +1,61 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "common/defines.h"
+#include "hex_image.h"
+
+/** Hash of one page written in a CPU */
+typedef struct
+{
+    uint32_t addr;
+    uint64_t hash;
+} page_hash_t;
+
+/**
+ * Record of the last image successfully programmed in one memory of one CPU,
+ * through one dongle.
+ */
+typedef struct
+{
+    char path[PATH_MAX];            /* File holding the record */
+    bool loaded;                    /* A record has been found */
+    version_t version;              /* Version recorded with the pages */
+    unsigned int count;             /* Pages of the record */
+    page_hash_t *pages;
+    unsigned int next_count;        /* Pages of the image being programmed */
+    page_hash_t *next_pages;
+} page_cache_t;
+
+/* Prototypes */
+bool page_cache_open(page_cache_t *cache, const char *dongle_id,
+                     uint8_t cpu_nbr, int mem_type);
+unsigned int page_cache_filter(page_cache_t *cache, hex_image_t *image);
+bool page_cache_commit(page_cache_t *cache, const version_t *version);
+void page_cache_invalidate(page_cache_t *cache);
+void page_cache_close(page_cache_t *cache);
+
+#endif /* PAGE_CACHE_H */
@@ -0,0 +1,349 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   stats.c
+ *
+ *   @brief  Timing and transfer statistics of a run, printed with --stats
+ *   and written as JSON with --stats-json.
+ *
+ *   Every time is taken on the monotonic clock, in microseconds. Each
+ *   upload (one CPU, one memory type) keeps the latency of its pages, from
+ *   the first packet to the status of the bootloader, to give their
+ *   percentiles. Nothing is recorded until stats_enable() is called.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "tux-api.h"
+#include "timer.h"
+#include "log.h"
+
+/* Uploads recorded, --all programs 7 files at most */
+#define STATS_MAX_UPLOADS   32
+
+typedef struct
+{
+    uint8_t cpu_address;
+    int mem_type;
+    bool ended;
+    bool ok;
+    uint64_t init_us;               /* BOOT_INIT to its ack */
+    uint64_t exit_us;               /* BOOT_EXIT to its ack */
+    uint64_t start_us;
+    uint64_t total_us;
+    uint64_t counters[STATS_COUNTERS];
+    uint32_t *page_us;              /* Latency of each page */
+    unsigned int page_count;
+    unsigned int page_max;
+} stats_upload_t;
+
+static bool enabled = false;
+static const char *transport_name;
+static uint64_t phase_us[STATS_PHASES];
+static unsigned int phase_count[STATS_PHASES];
+static uint64_t totals[STATS_COUNTERS];
+static stats_upload_t uploads[STATS_MAX_UPLOADS];
+static unsigned int upload_count;
+static stats_upload_t *current;     /* Upload in progress, if any */
+
+static const char *const phase_names[STATS_PHASES] = {
+    "connect", "version_probe"
+};
+static const char *const counter_names[STATS_COUNTERS] = {
+    "syscalls", "transfers", "bytes_sent", "bytes_received", "retries"
+};
+
+/**
+ * \brief Start recording
+ */
+void stats_enable(void)
+{
+    enabled = true;
+}
+
+/**
+ * \brief Return true if the statistics are recorded
+ */
+bool stats_enabled(void)
+{
+    return enabled;
+}
+
+/**
+ * \brief Record the transport the dongle is reached by
+ */
+void stats_set_transport(const char *name)
+{
+    transport_name = name;
+}
+
+/**
+ * \brief Add the time elapsed since start_us to a phase
+ */
+void stats_phase(enum stats_phase_t phase, uint64_t start_us)
+{
+    if (!enabled)
+        return;
+    phase_us[phase] += timer_now_us() - start_us;
+    phase_count[phase]++;
+}
+
+/**
+ * \brief Add n to a counter of the run and of the upload in progress
+ */
+void stats_add(enum stats_counter_t counter, uint64_t n)
+{
+    if (!enabled)
+        return;
+    totals[counter] += n;
+    if (current)
+        current->counters[counter] += n;
+}
+
+/**
+ * \brief Start the record of an upload
+ */
+void stats_upload_begin(uint8_t cpu_address, int mem_type)
+{
+    if (!enabled || upload_count == STATS_MAX_UPLOADS)
+    {
+        current = NULL;
+        return;
+    }
+    current = &uploads[upload_count++];
+    memset(current, 0, sizeof(*current));
+    current->cpu_address = cpu_address;
+    current->mem_type = mem_type;
+    current->start_us = timer_now_us();
+}
+
+/**
+ * \brief Record the time the bootloader took to acknowledge BOOT_INIT
+ */
+void stats_upload_init(uint64_t start_us)
+{
+    if (current)
+        current->init_us = timer_now_us() - start_us;
+}
+
+/**
+ * \brief Record the latency of a page
+ */
+void stats_page(uint64_t start_us)
+{
+    uint32_t *page_us;
+
+    if (current == NULL)
+        return;
+    if (current->page_count == current->page_max)
+    {
+        current->page_max = current->page_max ? 2 * current->page_max : 256;
+        page_us = realloc(current->page_us,
+                          current->page_max * sizeof(uint32_t));
+        if (page_us == NULL)
+        {
+            current->page_max = current->page_count;
+            return;
+        }
+        current->page_us = page_us;
+    }
+    current->page_us[current->page_count++] = timer_now_us() - start_us;
+}
+
+/**
+ * \brief Record the time the bootloader took to acknowledge BOOT_EXIT
+ */
+void stats_upload_exit(uint64_t start_us)
+{
+    if (current)
+        current->exit_us = timer_now_us() - start_us;
+}
+
+/**
+ * \brief Close the record of the upload in progress
+ */
+void stats_upload_end(bool ok)
+{
+    if (current == NULL)
+        return;
+    current->ended = true;
+    current->ok = ok;
+    current->total_us = timer_now_us() - current->start_us;
+    current = NULL;
+}
+
+static int compare_us(const void *a, const void *b)
+{
+    uint32_t ua = *(const uint32_t *)a, ub = *(const uint32_t *)b;
+
+    return (ua > ub) - (ua < ub);
+}
+
+/**
+ * Sort the page latencies of an upload, once, to read their percentiles.
+ * An upload interrupted by an error is closed here.
+ */
+static void upload_finish(stats_upload_t *upload)
+{
+    if (!upload->ended)
+    {
+        upload->ended = true;
+        upload->total_us = timer_now_us() - upload->start_us;
+        if (upload == current)
+            current = NULL;
+    }
+    qsort(upload->page_us, upload->page_count, sizeof(uint32_t),
+          compare_us);
+}
+
+/**
+ * Percentile p of the sorted page latencies, nearest rank, in ms.
+ */
+static double percentile_ms(const stats_upload_t *upload, unsigned int p)
+{
+    unsigned int rank;
+
+    if (upload->page_count == 0)
+        return 0;
+    rank = (upload->page_count * p + 99) / 100;
+    if (rank > 0)
+        rank--;
+    return upload->page_us[rank] / 1000.0;
+}
+
+static const char *mem_name(int mem_type)
+{
+    return mem_type == EEPROM ? "eeprom" : "flash";
+}
+
+/**
+ * \brief Print the statistics as a table
+ */
+void stats_print(FILE *stream)
+{
+    stats_upload_t *upload;
+    unsigned int i;
+
+    fprintf(stream, "\nStatistics (%s transport)\n",
+            transport_name ? transport_name : "no");
+    for (i = 0; i < STATS_PHASES; i++)
+        fprintf(stream, "  %-14s %10.3f ms in %u call%s\n", phase_names[i],
+                phase_us[i] / 1000.0, phase_count[i],
+                phase_count[i] == 1 ? "" : "s");
+
+    fprintf(stream, "\n  %-4s %-6s %-4s %5s %8s %8s %8s %8s %8s %9s %8s "
+            "%6s %8s %7s\n", "cpu", "mem", "ok", "pages", "init ms",
+            "p50 ms", "p95 ms", "p99 ms", "max ms", "total ms", "sent",
+            "xfers", "syscalls", "retries");
+    for (i = 0; i < upload_count; i++)
+    {
+        upload = &uploads[i];
+        upload_finish(upload);
+        fprintf(stream, "  0x%02x %-6s %-4s %5u %8.3f %8.3f %8.3f %8.3f "
+                "%8.3f %9.1f %8llu %6llu %8llu %7llu\n",
+                upload->cpu_address, mem_name(upload->mem_type),
+                upload->ok ? "yes" : "no", upload->page_count,
+                upload->init_us / 1000.0, percentile_ms(upload, 50),
+                percentile_ms(upload, 95), percentile_ms(upload, 99),
+                percentile_ms(upload, 100), upload->total_us / 1000.0,
+                (unsigned long long)upload->counters[STATS_BYTES_SENT],
+                (unsigned long long)upload->counters[STATS_TRANSFERS],
+                (unsigned long long)upload->counters[STATS_SYSCALLS],
+                (unsigned long long)upload->counters[STATS_RETRIES]);
+    }
+
+    fprintf(stream, "\n  run:");
+    for (i = 0; i < STATS_COUNTERS; i++)
+        fprintf(stream, " %s %llu%s", counter_names[i],
+                (unsigned long long)totals[i],
+                i + 1 < STATS_COUNTERS ? "," : "\n");
+}
+
+/**
+ * \brief Write the statistics in a JSON file, '-' for the standard output
+ * \return false if the file can't be written
+ */
+bool stats_write_json(const char *filename)
+{
+    stats_upload_t *upload;
+    unsigned int i, j;
+    bool ok;
+    FILE *fs;
+
+    if (!strcmp(filename, "-"))
+        fs = stdout;
+    else if ((fs = fopen(filename, "w")) == NULL)
+    {
+        log_error("Unable to open file '%s' for writing", filename);
+        return false;
+    }
+
+    fprintf(fs, "{\n  \"transport\": ");
+    if (transport_name)
+        fprintf(fs, "\"%s\",\n", transport_name);
+    else
+        fprintf(fs, "null,\n");
+    fprintf(fs, "  \"phases\": {");
+    for (i = 0; i < STATS_PHASES; i++)
+        fprintf(fs, "%s\n    \"%s\": {\"ms\": %.3f, \"count\": %u}",
+                i ? "," : "", phase_names[i], phase_us[i] / 1000.0,
+                phase_count[i]);
+    fprintf(fs, "\n  },\n  \"uploads\": [");
+    for (i = 0; i < upload_count; i++)
+    {
+        upload = &uploads[i];
+        upload_finish(upload);
+        fprintf(fs, "%s\n    {\"cpu_address\": %u, \"mem\": \"%s\", "
+                "\"ok\": %s, \"pages\": %u,\n     \"init_ms\": %.3f, "
+                "\"exit_ms\": %.3f, \"total_ms\": %.3f,\n"
+                "     \"page_ms\": {\"p50\": %.3f, \"p95\": %.3f, "
+                "\"p99\": %.3f, \"max\": %.3f}",
+                i ? "," : "", upload->cpu_address,
+                mem_name(upload->mem_type), upload->ok ? "true" : "false",
+                upload->page_count, upload->init_us / 1000.0,
+                upload->exit_us / 1000.0, upload->total_us / 1000.0,
+                percentile_ms(upload, 50), percentile_ms(upload, 95),
+                percentile_ms(upload, 99), percentile_ms(upload, 100));
+        for (j = 0; j < STATS_COUNTERS; j++)
+            fprintf(fs, ",%s\"%s\": %llu", j ? " " : "\n     ",
+                    counter_names[j],
+                    (unsigned long long)upload->counters[j]);
+        fprintf(fs, "}");
+    }
+    fprintf(fs, "%s],\n  \"totals\": {", upload_count ? "\n  " : "");
+    for (i = 0; i < STATS_COUNTERS; i++)
+        fprintf(fs, "%s\"%s\": %llu", i ? ", " : "", counter_names[i],
+                (unsigned long long)totals[i]);
+    fprintf(fs, "}\n}\n");
+
+    ok = !ferror(fs);
+    if (fs != stdout && fclose(fs) != 0)
+        ok = false;
+    if (!ok)
+        log_error("Unable to write file '%s'", filename);
+    return ok;
+}
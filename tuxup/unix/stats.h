@@ -0,0 +1,63 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Phases of a run timed outside of the uploads */
+enum stats_phase_t
+{
+    STATS_CONNECT,                  /* Finding and opening the dongle */
+    STATS_VERSION_PROBE,            /* Version requests and their replies */
+    STATS_PHASES
+};
+
+/** Counters kept for each upload and for the whole run */
+enum stats_counter_t
+{
+    STATS_SYSCALLS,                 /* Calls into the kernel (or libusb) */
+    STATS_TRANSFERS,                /* Reports sent and received */
+    STATS_BYTES_SENT,
+    STATS_BYTES_RECEIVED,
+    STATS_RETRIES,                  /* Reads repeated after a frame that
+                                       wasn't the one waited for */
+    STATS_COUNTERS
+};
+
+/* Prototypes */
+void stats_enable(void);
+bool stats_enabled(void);
+void stats_set_transport(const char *name);
+void stats_phase(enum stats_phase_t phase, uint64_t start_us);
+void stats_add(enum stats_counter_t counter, uint64_t n);
+void stats_upload_begin(uint8_t cpu_address, int mem_type);
+void stats_upload_init(uint64_t start_us);
+void stats_page(uint64_t start_us);
+void stats_upload_exit(uint64_t start_us);
+void stats_upload_end(bool ok);
+void stats_print(FILE *stream);
+bool stats_write_json(const char *filename);
+
+#endif /* STATS_H */
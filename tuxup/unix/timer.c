@@ -0,0 +1,77 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   timer.c
+ *
+ *   @brief  Monotonic time and deadlines with a millisecond resolution,
+ *   and microseconds for the statistics. The monotonic clock is not
+ *   affected by changes of the system time.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "timer.h"
+
+/**
+ * \brief Return the current value of the monotonic clock in milliseconds
+ */
+uint64_t timer_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * \brief Return the current value of the monotonic clock in microseconds
+ */
+uint64_t timer_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * \brief Return the deadline expiring in timeout_ms milliseconds
+ */
+uint64_t timer_deadline_ms(int timeout_ms)
+{
+    return timer_now_ms() + (timeout_ms > 0 ? timeout_ms : 0);
+}
+
+/**
+ * \brief Return the number of milliseconds left before the deadline, 0 if
+ * it has expired
+ */
+int timer_remaining_ms(uint64_t deadline)
+{
+    uint64_t now = timer_now_ms();
+
+    if (now >= deadline)
+        return 0;
+    return (int)(deadline - now);
+}
@@ -0,0 +1,237 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   transport.c
+ *
+ *   @brief  Selection of the transport used to reach the dongle, and the
+ *   parts of the protocol shared by all of them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "transport.h"
+#include "usb_sysfs.h"
+#include "tux-api.h"
+#include "bootloader.h"
+#include "timer.h"
+#include "stats.h"
+
+/* Transports tried in that order when none is given. The mock is only
+ * used on request. */
+static const transport_t *const transports[] = {
+    &transport_hidraw,
+    &transport_hiddev,
+#ifdef USE_LIBUSB1
+    &transport_libusb1,
+#endif
+    &transport_libusb,
+    &transport_mock,
+};
+
+#define countof(X) ( (size_t) ( sizeof(X)/sizeof*(X) ) )
+
+/* The dongle is opened by a process and used by its children */
+static bool fork_safe_only = false;
+
+/**
+ * \brief Return the transport of that name, NULL if there's none
+ */
+const transport_t *transport_find(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < countof(transports); i++)
+    {
+        if (!strcmp(transports[i]->name, name))
+            return transports[i];
+    }
+    return NULL;
+}
+
+/**
+ * \brief Leave out the transports that can't be used across fork() when
+ * none is given
+ */
+void transport_require_fork_safe(void)
+{
+    fork_safe_only = true;
+}
+
+/**
+ * \brief Open the dongle
+ * \param name    Transport to use, NULL to take the first one that finds the
+ * dongle
+ * \param device  Path of the dongle, NULL for the first one found. Each
+ * transport only opens the paths of its own kind.
+ * \return The transport opened, NULL if the dongle wasn't found
+ */
+const transport_t *transport_open(const char *name, const char *device)
+{
+    const transport_t *transport;
+    size_t i;
+
+    if (name)
+    {
+        transport = transport_find(name);
+        return (transport && transport->open(device)) ? transport : NULL;
+    }
+    for (i = 0; i < countof(transports); i++)
+    {
+        /* The mock is only found when asked for by its path */
+        if (transports[i] == &transport_mock && device == NULL)
+            continue;
+        if (transports[i]->fork_unsafe && fork_safe_only)
+            continue;
+        if (transports[i]->open(device))
+            return transports[i];
+    }
+    return NULL;
+}
+
+/**
+ * \brief List the dongles connected
+ * \param name  Transport to use, NULL to take the first one that finds at
+ * least one dongle: the same dongle is seen by several transports.
+ * \return the number of paths written in devices, at most max
+ */
+int transport_enumerate(const char *name,
+                        char devices[][TRANSPORT_DEVICE_SIZE], int max)
+{
+    const transport_t *transport;
+    size_t i;
+    int count;
+
+    if (name)
+    {
+        transport = transport_find(name);
+        return transport ? transport->enumerate(devices, max) : 0;
+    }
+    for (i = 0; i < countof(transports); i++)
+    {
+        if (transports[i] == &transport_mock)
+            continue;
+        if ((count = transports[i]->enumerate(devices, max)) > 0)
+            return count;
+    }
+    return 0;
+}
+
+/**
+ * \brief Send a report, counted in the statistics
+ * \return true if all of it has been sent
+ */
+bool transport_write(const transport_t *transport, const uint8_t *data,
+                     int size)
+{
+    if (!transport->write_report(data, size))
+        return false;
+    stats_add(STATS_TRANSFERS, 1);
+    stats_add(STATS_BYTES_SENT, size);
+    return true;
+}
+
+/**
+ * \brief Receive a report, counted in the statistics
+ * \return false if none arrived within timeout_ms
+ */
+bool transport_read(const transport_t *transport, uint8_t *data, int size,
+                    int timeout_ms)
+{
+    if (!transport->read_report(data, size, timeout_ms))
+        return false;
+    stats_add(STATS_TRANSFERS, 1);
+    stats_add(STATS_BYTES_RECEIVED, size);
+    return true;
+}
+
+/**
+ * \brief Identifier of the dongle opened, the same through all the backends
+ *
+ * The dongle is known by the USB port it is plugged in, found in sysfs from
+ * its node, so that the records kept for it don't depend on the backend it
+ * has been reached through.
+ *
+ * \return false if the dongle can't be identified
+ */
+bool transport_get_id(const transport_t *transport, char *id, int size)
+{
+    char path[TRANSPORT_DEVICE_SIZE];
+    char port[USB_SYSFS_PORT_SIZE];
+
+    if (transport->get_path(path, sizeof(path))
+        && usb_sysfs_port(path, port, sizeof(port)))
+    {
+        snprintf(id, size, "usb-%s", port);
+        return true;
+    }
+    return transport->get_id && transport->get_id(id, size);
+}
+
+/**
+ * \brief Drop the reports received before a request/response exchange
+ *
+ * Only needed once at the start of the exchange: the replies are then
+ * matched by their content, and reports still in flight are kept.
+ */
+void transport_drain(const transport_t *transport)
+{
+    if (transport->drain)
+        transport->drain();
+}
+
+/**
+ * \brief Wait for the status frame of the dongle carrying value
+ *
+ * The other reports received in the meantime are dropped. The matching
+ * frame is left in buffer.
+ *
+ * \param deadline  Monotonic time in ms, see timer_deadline_ms()
+ * \return false if the frame didn't arrive before the deadline
+ */
+bool transport_wait_frame(const transport_t *transport, uint8_t value,
+                          uint64_t deadline, uint8_t *buffer)
+{
+    do
+    {
+        if (!transport_read(transport, buffer, TRANSPORT_REPORT_SIZE,
+                            timer_remaining_ms(deadline)))
+            return false;
+        if (bootload_is_status(buffer, value))
+            return true;
+        stats_add(STATS_RETRIES, 1);
+    }
+    while (timer_remaining_ms(deadline) > 0);
+    return false;
+}
+
+/**
+ * \brief Print the names of the transports
+ */
+void transport_list(FILE *stream)
+{
+    size_t i;
+
+    for (i = 0; i < countof(transports); i++)
+        fprintf(stream, "%s%s", i ? ", " : "", transports[i]->name);
+}
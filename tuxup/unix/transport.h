@@ -0,0 +1,101 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Size of the reports exchanged with the dongle */
+#define TRANSPORT_REPORT_SIZE   64
+/** Size of a device path, /dev/hidraw3 or /dev/bus/usb/001/004 */
+#define TRANSPORT_DEVICE_SIZE   128
+
+/**
+ * Way to exchange reports with the dongle. Each backend (hidraw, hiddev,
+ * libusb, libusb-1.0, mock) fills one of these; the protocol is written
+ * against it only. A single dongle is opened at a time.
+ */
+typedef struct
+{
+    const char *name;
+    /**
+     * Open the dongle at device, or the first one found if device is NULL.
+     * false if device isn't a dongle reached by this backend.
+     */
+    bool (*open)(const char *device);
+    void (*close)(void);
+    /** List the paths of the dongles found, at most max */
+    int (*enumerate)(char devices[][TRANSPORT_DEVICE_SIZE], int max);
+    /**
+     * Optional: identifier of the dongle, stable across runs, when it can't
+     * be known by its USB port. See transport_get_id().
+     */
+    bool (*get_id)(char *id, int size);
+    /** Path of the dongle opened, as enumerate() lists it */
+    bool (*get_path)(char *path, int size);
+    /** Release number of the dongle, NULL when the backend can't tell */
+    int (*bcd_device)(void);
+    /** Send a report, true if all of it has been sent */
+    bool (*write_report)(const uint8_t *data, int size);
+    /** Receive a report, false if none arrived within timeout_ms */
+    bool (*read_report)(uint8_t *data, int size, int timeout_ms);
+    /** Optional: drop the input reports queued before a new exchange */
+    void (*drain)(void);
+    /**
+     * Optional: send the two FILLPAGE packets of a page without waiting
+     * for its status, which is checked by the backend against counter.
+     * flush() waits for the pages still in flight. false if a page failed.
+     */
+    bool (*queue_page)(const uint8_t *packet1, int len1,
+                       const uint8_t *packet2, int len2, uint8_t counter);
+    bool (*flush)(void);
+    /** The dongle opened can't be used by a child process after fork() */
+    bool fork_unsafe;
+} transport_t;
+
+extern const transport_t transport_hidraw;
+extern const transport_t transport_hiddev;
+extern const transport_t transport_libusb;
+#ifdef USE_LIBUSB1
+extern const transport_t transport_libusb1;
+#endif
+extern const transport_t transport_mock;
+
+/* Prototypes */
+const transport_t *transport_find(const char *name);
+const transport_t *transport_open(const char *name, const char *device);
+void transport_require_fork_safe(void);
+int transport_enumerate(const char *name,
+                        char devices[][TRANSPORT_DEVICE_SIZE], int max);
+bool transport_write(const transport_t *transport, const uint8_t *data,
+                     int size);
+bool transport_read(const transport_t *transport, uint8_t *data, int size,
+                    int timeout_ms);
+void transport_drain(const transport_t *transport);
+bool transport_get_id(const transport_t *transport, char *id, int size);
+bool transport_wait_frame(const transport_t *transport, uint8_t value,
+                          uint64_t deadline, uint8_t *buffer);
+void transport_list(FILE *stream);
+
+#endif /* TRANSPORT_H */
@@ -31,6 +31,19 @@
 #define HID_I2C_HEADER          3
 #define INFO_FUXUSB             6
 
+/**
+ * Bootloader commands, sent after HID_I2C_HEADER, and the values of the
+ * status frames acknowledging them
+ */
+#define BOOT_INIT               1
+#define BOOT_FILLPAGE           2
+#define BOOT_EXIT               3
+#define BOOT_INIT_ACK           255
+#define BOOT_EXIT_ACK           254
+
+/** First byte of the status frames of the dongle */
+#define BOOT_STATUS_FRAME       0xF0
+
 #define FUXUSB_VERSION_CMD      200
 #define MIN_VER_MINOR           5
 #define MIN_VER_UPDATE          2
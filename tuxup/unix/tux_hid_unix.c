@@ -27,81 +27,264 @@
 #include <asm/types.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
 #include <linux/hiddev.h>
 
 #include <string.h>
 #include <dirent.h>
 
 #include "tux_hid_unix.h"
+#include "usb-connection.h"
+#include "transport.h"
+#include "usb_sysfs.h"
+#include "stats.h"
+#include "timer.h"
+
+/* Number of usage events read from hiddev at once */
+#define HID_EVENTS_MAX      256
+
+/**
+ * Cached description of one report of the dongle. The report info and the
+ * usage reference are resolved once when the device is captured so that a
+ * whole report can then be transferred with a single HIDIOC[GS]USAGES ioctl.
+ */
+typedef struct
+{
+    struct hiddev_report_info rinfo;        /* Resolved report id */
+    struct hiddev_usage_ref_multi uref;     /* Usage values of the report */
+    unsigned int count;                     /* Number of values in the field */
+} tux_hid_report_t;
 
 static int tux_device_hdl = -1;
 static char tux_device_path[256] = "";
-static struct hiddev_usage_ref uref_out;
-static struct hiddev_report_info rinfo_out;
+static tux_hid_report_t report_out;
+static tux_hid_report_t report_in;
+
+/* Input reports are rebuilt from the usage events queued by hiddev */
+static bool use_events = false;
+static struct hiddev_usage_ref events[HID_EVENTS_MAX];
+static int events_count = 0;
+static int events_idx = 0;
+static unsigned char event_report[HID_MAX_MULTI_USAGES];
+
+/**
+ * Ask hiddev to queue every usage of the input reports along with an event
+ * marking the end of each report, so that input reports can be waited for
+ * with poll() and rebuilt from the queue.
+ */
+static void
+enable_report_events(int fd)
+{
+    int flags = HIDDEV_FLAG_UREF | HIDDEV_FLAG_REPORT;
+
+    use_events = (ioctl(fd, HIDIOCSFLAG, &flags) >= 0);
+    events_count = 0;
+    events_idx = 0;
+}
+
+/**
+ * Discard the usage events already queued, before a new request. They were
+ * sent before it and can't be a reply to it.
+ */
+static void
+drain_report_events(void)
+{
+    struct pollfd pfd;
+
+    events_count = 0;
+    events_idx = 0;
+    if (!use_events)
+    {
+        return;
+    }
+
+    pfd.fd = tux_device_hdl;
+    pfd.events = POLLIN;
+    stats_add(STATS_SYSCALLS, 1);
+    while ((poll(&pfd, 1, 0) > 0) && (pfd.revents & POLLIN))
+    {
+        stats_add(STATS_SYSCALLS, 2);
+        if (read(tux_device_hdl, events, sizeof(events)) <= 0)
+        {
+            break;
+        }
+    }
+}
 
+/**
+ * Resolve the first report of the given type and cache its usage code so
+ * that reads and writes don't have to look them up again.
+ */
 static bool
-find_dongle_from_path(const char *path, int vendor_id, int product_id)
+resolve_report(int fd, unsigned int report_type, tux_hid_report_t *report)
+{
+    struct hiddev_field_info finfo;
+
+    memset(report, 0, sizeof(*report));
+
+    report->rinfo.report_type = report_type;
+    report->rinfo.report_id = HID_REPORT_ID_FIRST;
+    if (ioctl(fd, HIDIOCGREPORTINFO, &report->rinfo) < 0)
+    {
+        return false;
+    }
+
+    finfo.report_type = report->rinfo.report_type;
+    finfo.report_id = report->rinfo.report_id;
+    finfo.field_index = 0;
+    if (ioctl(fd, HIDIOCGFIELDINFO, &finfo) < 0)
+    {
+        return false;
+    }
+
+    report->uref.uref.report_type = report->rinfo.report_type;
+    report->uref.uref.report_id = report->rinfo.report_id;
+    report->uref.uref.field_index = 0;
+    report->uref.uref.usage_index = 0;
+    if (ioctl(fd, HIDIOCGUCODE, &report->uref.uref) < 0)
+    {
+        return false;
+    }
+
+    /* HIDIOC[GS]USAGES are bounded by the report count of the field, which
+     * hiddev doesn't give. The number of usages may be larger: the count is
+     * found by reading the values kept by the kernel, which doesn't reach
+     * the dongle. */
+    report->count = finfo.maxusage;
+    if (report->count > HID_MAX_MULTI_USAGES)
+    {
+        report->count = HID_MAX_MULTI_USAGES;
+    }
+    report->uref.num_values = report->count;
+    while ((report->count > 0) &&
+           (ioctl(fd, HIDIOCGUSAGES, &report->uref) < 0))
+    {
+        report->uref.num_values = --report->count;
+    }
+
+    return report->count > 0;
+}
+
+/**
+ * Open the hiddev node at path if it is the dongle and resolve its reports.
+ * Returns the file descriptor, -1 if it isn't.
+ */
+static int
+open_dongle(const char *path, int vendor_id, int product_id)
+{
+    const char *name = strrchr(path, '/');
+    struct hiddev_devinfo device_info;
+    int fd;
+
+    name = name ? name + 1 : path;
+    if (strncmp(name, "hiddev", 6) != 0)
+    {
+        return -1;
+    }
+    if ((fd = open(path, O_RDONLY)) < 0)
+    {
+        return -1;
+    }
+
+    if ((ioctl(fd, HIDIOCGDEVINFO, &device_info) >= 0) &&
+        (device_info.vendor == vendor_id) &&
+        ((device_info.product & 0xFFFF) == product_id) &&
+        resolve_report(fd, HID_REPORT_TYPE_OUTPUT, &report_out) &&
+        resolve_report(fd, HID_REPORT_TYPE_INPUT, &report_in))
+    {
+        return fd;
+    }
+    close(fd);
+    return -1;
+}
+
+static int
+find_dongles_from_path(const char *path, int vendor_id, int product_id,
+                       char devices[][TRANSPORT_DEVICE_SIZE], int max)
 {
     DIR* dir;
     struct dirent *dinfo;
-    int fd = -1;
-    char device_path[256] = "";
-    struct hiddev_devinfo device_info;
-    int err;
+    int fd, count = 0;
     
     dir = opendir(path);
-    if (dir != NULL)
+    if (dir == NULL)
     {
-        while ((dinfo = readdir(dir)) != NULL)
+        return 0;
+    }
+
+    while ((count < max) && ((dinfo = readdir(dir)) != NULL))
+    {
+        if (snprintf(devices[count], TRANSPORT_DEVICE_SIZE, "%s/%s", path,
+                     dinfo->d_name) >= TRANSPORT_DEVICE_SIZE)
         {
-            if (strncmp(dinfo->d_name, "hiddev", 6) == 0)
-            {
-                sprintf(device_path, "%s/%s", path, dinfo->d_name);
-
-                if ((fd = open(device_path, O_RDONLY)) >= 0)
-                {
-                    err = ioctl(fd, HIDIOCGDEVINFO, &device_info);
-                    if ((device_info.vendor == vendor_id) &&
-                        ((device_info.product & 0xFFFF) == product_id))
-                    {
-                        sprintf(tux_device_path, "%s", device_path);
-                        tux_device_hdl = fd;
-        
-                        closedir(dir);
-                        
-                        return true;
-                    }
-                    else
-                    {
-                        close(fd);
-                    }
-                }
-            }
+            continue;
+        }
+        if ((fd = open_dongle(devices[count], vendor_id, product_id)) >= 0)
+        {
+            close(fd);
+            count++;
         }
+    }
         
-        closedir(dir);
+    closedir(dir);
+    return count;
+}
+
+static int
+compare_paths(const void *a, const void *b)
+{
+    return strcmp(a, b);
+}
+
+int LIBLOCAL
+tux_hid_enumerate(int vendor_id, int product_id,
+                  char devices[][TRANSPORT_DEVICE_SIZE], int max)
+{
+    int count;
+
+    /* The dongles are found in sysfs without opening any node, which
+     * could block on a busy one */
+    count = usb_sysfs_enumerate(vendor_id, product_id, USB_SYSFS_HIDDEV,
+                                devices, max);
+    if (count >= 0)
+    {
+        return count;
     }
 
-    return false;
+    /* Without sysfs, each node is opened to be identified. Normal path to
+     * scan is /dev/usb, the other possible one is /dev */
+    count = find_dongles_from_path("/dev/usb", vendor_id, product_id,
+                                   devices, max);
+    count += find_dongles_from_path("/dev", vendor_id, product_id,
+                                    devices + count, max - count);
+    qsort(devices, count, TRANSPORT_DEVICE_SIZE, compare_paths);
+    return count;
 }
     
 bool LIBLOCAL
-tux_hid_capture(int vendor_id, int product_id)
+tux_hid_capture(const char *device, int vendor_id, int product_id)
 {
-    /* Normal path to scan is /dev/usb */
-    if (find_dongle_from_path("/dev/usb", vendor_id, product_id))
+    char devices[1][TRANSPORT_DEVICE_SIZE];
+    int fd;
+
+    /* Without a path, take the first dongle found */
+    if (device == NULL)
     {
-        return true;
+        if (tux_hid_enumerate(vendor_id, product_id, devices, 1) == 0)
+        {
+            return false;
+        }
+        device = devices[0];
     }
-    
-    /* Other possible path to scan is /dev/usb */
-    if (find_dongle_from_path("/dev", vendor_id, product_id))
+
+    if ((fd = open_dongle(device, vendor_id, product_id)) < 0)
     {
-        return true;
+        return false;
     }
-    
-    /* dongle not found */
-    return false;
+    snprintf(tux_device_path, sizeof(tux_device_path), "%s", device);
+    tux_device_hdl = fd;
+    enable_report_events(fd);
+    return true;
 }
 
 void LIBLOCAL
@@ -118,37 +301,30 @@ bool LIBLOCAL
 tux_hid_write(int size, const unsigned char *buffer)
 {
     int i;
-    int err;
-    
-    rinfo_out.report_type = HID_REPORT_TYPE_OUTPUT;
-    rinfo_out.report_id = HID_REPORT_ID_FIRST;
-    
-    err = ioctl(tux_device_hdl, HIDIOCGREPORTINFO, &rinfo_out);
-    if (err < 0)
+
+    if ((size < 0) || ((unsigned int)size > report_out.count))
     {
         return false;
     }
-    
-    for(i = 0; i < size; i++)
+
+    report_out.uref.num_values = size;
+    for (i = 0; i < size; i++)
     {
-        uref_out.report_type = HID_REPORT_TYPE_OUTPUT;
-        uref_out.report_id   = HID_REPORT_ID_FIRST;
-        uref_out.usage_index = i;
-        uref_out.value = (unsigned char)buffer[i];
-        
-        err = ioctl(tux_device_hdl,HIDIOCSUSAGE, &uref_out);
-        if (err < 0)
-        {
-            return false;
-        }
+        report_out.uref.values[i] = buffer[i];
     }
-    
-    err = ioctl(tux_device_hdl,HIDIOCSREPORT,&rinfo_out);
-    if (err < 0)
+
+    /* Set all the usages at once, then send the report */
+    stats_add(STATS_SYSCALLS, 2);
+    if (ioctl(tux_device_hdl, HIDIOCSUSAGES, &report_out.uref) < 0)
     {
         return false;
     }
-    
+
+    if (ioctl(tux_device_hdl, HIDIOCSREPORT, &report_out.rinfo) < 0)
+    {
+        return false;
+    }
+
     return true;
 }
 
@@ -156,36 +332,147 @@ bool LIBLOCAL
 tux_hid_read(int size, unsigned char *buffer)
 {
     int i;
-    int err;
- 
-    rinfo_out.report_type = HID_REPORT_TYPE_INPUT;
-    rinfo_out.report_id = HID_REPORT_ID_FIRST;
-    
-    err = ioctl(tux_device_hdl, HIDIOCGREPORT, &rinfo_out);
-    if (err < 0)
+
+    if ((size < 0) || ((unsigned int)size > report_in.count))
+    {
+        return false;
+    }
+
+    stats_add(STATS_SYSCALLS, 2);
+    if (ioctl(tux_device_hdl, HIDIOCGREPORT, &report_in.rinfo) < 0)
+    {
+        return false;
+    }
+
+    /* Get all the usages of the report at once */
+    report_in.uref.num_values = size;
+    if (ioctl(tux_device_hdl, HIDIOCGUSAGES, &report_in.uref) < 0)
     {
         return false;
     }
 
     for (i = 0; i < size; i++)
     {
-        uref_out.report_type = HID_REPORT_TYPE_INPUT;
-        uref_out.report_id   = HID_REPORT_ID_FIRST;
-        uref_out.usage_index = i;
-        
-        err = ioctl(tux_device_hdl, HIDIOCGUCODE, &uref_out);
-        if (err < 0)
+        buffer[i] = (unsigned char)report_in.uref.values[i];
+    }
+    return true;
+}
+
+bool LIBLOCAL
+tux_hid_wait_report(int size, unsigned char *buffer, int timeout_ms)
+{
+    struct hiddev_usage_ref *uref;
+    struct pollfd pfd;
+    uint64_t deadline;
+    ssize_t len;
+
+    if ((size < 0) || ((unsigned int)size > report_in.count))
+    {
+        return false;
+    }
+
+    deadline = timer_deadline_ms(timeout_ms);
+
+    /* Without report events, fall back to polling the input report */
+    if (!use_events)
+    {
+        do
+        {
+            usleep(5000);
+            if (tux_hid_read(size, buffer))
+            {
+                return true;
+            }
+        }
+        while (timer_remaining_ms(deadline) > 0);
+        return false;
+    }
+
+    pfd.fd = tux_device_hdl;
+    pfd.events = POLLIN;
+    for (;;)
+    {
+        while (events_idx < events_count)
+        {
+            uref = &events[events_idx++];
+            if ((uref->report_type != HID_REPORT_TYPE_INPUT) ||
+                (uref->report_id != report_in.rinfo.report_id))
+            {
+                continue;
+            }
+            if (uref->field_index == HID_FIELD_INDEX_NONE)
+            {
+                /* End of an input report */
+                memcpy(buffer, event_report, size);
+                return true;
+            }
+            if ((uref->field_index == 0) &&
+                (uref->usage_index < report_in.count))
+            {
+                event_report[uref->usage_index] = (unsigned char)uref->value;
+            }
+        }
+
+        stats_add(STATS_SYSCALLS, 1);
+        if ((poll(&pfd, 1, timer_remaining_ms(deadline)) <= 0) ||
+            !(pfd.revents & POLLIN))
         {
             return false;
         }
-        
-        err = ioctl(tux_device_hdl, HIDIOCGUSAGE, &uref_out); 
-        if (err < 0)
+
+        stats_add(STATS_SYSCALLS, 1);
+        len = read(tux_device_hdl, events, sizeof(events));
+        if (len <= 0)
         {
             return false;
         }
-        buffer[i] = uref_out.value;
+        events_count = len / sizeof(events[0]);
+        events_idx = 0;
+    }
+}
+
+static bool
+hiddev_open(const char *device)
+{
+    return tux_hid_capture(device, TUX_VENDOR_ID, TUX_PRODUCT_ID);
+}
+
+static int
+hiddev_enumerate(char devices[][TRANSPORT_DEVICE_SIZE], int max)
+{
+    return tux_hid_enumerate(TUX_VENDOR_ID, TUX_PRODUCT_ID, devices, max);
+}
+
+static bool
+hiddev_get_path(char *path, int size)
+{
+    if (tux_device_hdl == -1)
+    {
+        return false;
     }
+    snprintf(path, size, "%s", tux_device_path);
     return true;
 }
 
+static bool
+hiddev_write_report(const uint8_t *data, int size)
+{
+    return tux_hid_write(size, data);
+}
+
+static bool
+hiddev_read_report(uint8_t *data, int size, int timeout_ms)
+{
+    return tux_hid_wait_report(size, data, timeout_ms);
+}
+
+const transport_t transport_hiddev = {
+    .name = "hiddev",
+    .open = hiddev_open,
+    .close = tux_hid_release,
+    .enumerate = hiddev_enumerate,
+    .get_path = hiddev_get_path,
+    .write_report = hiddev_write_report,
+    .read_report = hiddev_read_report,
+    .drain = drain_report_events,
+};
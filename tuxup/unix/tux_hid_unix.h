@@ -22,14 +22,20 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include "transport.h"
 
 #define HID_RW_TIMEOUT                  1000
 #define LIBEXPORT    __attribute__ ((visibility ("default")))
 #define LIBLOCAL     __attribute__ ((visibility ("hidden")))
 
-extern bool tux_hid_capture(int vendor_id, int product_id);
+extern bool tux_hid_capture(const char *device, int vendor_id,
+                            int product_id);
+extern int tux_hid_enumerate(int vendor_id, int product_id,
+                             char devices[][TRANSPORT_DEVICE_SIZE], int max);
 extern void tux_hid_release(void);
 extern bool tux_hid_write(int size, const unsigned char *buffer);
 extern bool tux_hid_read(int size, unsigned char *buffer);
+extern bool tux_hid_wait_report(int size, unsigned char *buffer,
+                                int timeout_ms);
 
 #endif /* _TUX_HID_H_ */
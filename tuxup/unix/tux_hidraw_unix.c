@@ -0,0 +1,405 @@
+/*
+ * Tux Droid - Hidraw interface (only for unix)
+ * Copyright (C) 2008 C2ME Sa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <linux/hidraw.h>
+
+#include <string.h>
+#include <dirent.h>
+
+#include "tux_hid_unix.h"
+#include "tux_hidraw_unix.h"
+#include "usb-connection.h"
+#include "transport.h"
+#include "usb_sysfs.h"
+#include "stats.h"
+
+static int tux_raw_hdl = -1;
+static char tux_raw_path[512] = "";
+static hidraw_reports_t reports;
+
+/**
+ * Walk the report descriptor of the device and compute the size of its
+ * input and output reports. Only the global items needed to compute the
+ * sizes are tracked; push/pop and long items are not used by the dongle.
+ */
+static bool
+parse_report_sizes(int fd, hidraw_reports_t *layout)
+{
+    struct hidraw_report_descriptor desc;
+    unsigned int report_size = 0, report_count = 0;
+    unsigned int in_bits = 0, out_bits = 0;
+    uint8_t report_id = 0;
+    int desc_size = 0;
+    int i;
+
+    if (ioctl(fd, HIDIOCGRDESCSIZE, &desc_size) < 0)
+    {
+        return false;
+    }
+
+    desc.size = desc_size;
+    if (ioctl(fd, HIDIOCGRDESC, &desc) < 0)
+    {
+        return false;
+    }
+
+    layout->numbered = false;
+    layout->out_id = 0;
+    i = 0;
+    while (i < desc.size)
+    {
+        uint8_t prefix = desc.value[i];
+        int len = prefix & 0x03;
+        uint32_t data = 0;
+        int j;
+
+        if (len == 3)
+        {
+            len = 4;
+        }
+        if (i + 1 + len > desc.size)
+        {
+            break;
+        }
+        for (j = 0; j < len; j++)
+        {
+            data |= (uint32_t)desc.value[i + 1 + j] << (8 * j);
+        }
+
+        switch (prefix & 0xFC)
+        {
+        case 0x74:              /* Report Size */
+            report_size = data;
+            break;
+        case 0x94:              /* Report Count */
+            report_count = data;
+            break;
+        case 0x84:              /* Report ID */
+            layout->numbered = true;
+            report_id = data;
+            break;
+        case 0x80:              /* Input */
+            in_bits += report_size * report_count;
+            break;
+        case 0x90:              /* Output */
+            out_bits += report_size * report_count;
+            layout->out_id = report_id;
+            break;
+        }
+        i += 1 + len;
+    }
+
+    layout->in_size = (in_bits + 7) / 8;
+    layout->out_size = (out_bits + 7) / 8;
+
+    return (layout->in_size > 0) &&
+           (layout->in_size <= HIDRAW_REPORT_SIZE_MAX) &&
+           (layout->out_size > 0) &&
+           (layout->out_size <= HIDRAW_REPORT_SIZE_MAX);
+}
+
+/**
+ * Discard the input reports already queued by the kernel, before a new
+ * request. They were sent before it and can't be a reply to it.
+ */
+static void
+drain_input_reports(void)
+{
+    unsigned char buffer[HIDRAW_FRAME_SIZE_MAX];
+    struct pollfd pfd;
+
+    pfd.fd = tux_raw_hdl;
+    pfd.events = POLLIN;
+    stats_add(STATS_SYSCALLS, 1);
+    while ((poll(&pfd, 1, 0) > 0) && (pfd.revents & POLLIN))
+    {
+        stats_add(STATS_SYSCALLS, 2);
+        if (read(tux_raw_hdl, buffer, sizeof(buffer)) <= 0)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * Open the hidraw node at path if it is the dongle, and read the layout of
+ * its reports. Returns the file descriptor, -1 if it isn't.
+ */
+int LIBLOCAL
+tux_hidraw_open(const char *path, int vendor_id, int product_id,
+                hidraw_reports_t *layout)
+{
+    const char *name = strrchr(path, '/');
+    struct hidraw_devinfo device_info;
+    int fd;
+
+    name = name ? name + 1 : path;
+    if (strncmp(name, "hidraw", 6) != 0)
+    {
+        return -1;
+    }
+    if ((fd = open(path, O_RDWR)) < 0)
+    {
+        return -1;
+    }
+
+    if ((ioctl(fd, HIDIOCGRAWINFO, &device_info) >= 0) &&
+        ((device_info.vendor & 0xFFFF) == vendor_id) &&
+        ((device_info.product & 0xFFFF) == product_id) &&
+        parse_report_sizes(fd, layout))
+    {
+        return fd;
+    }
+    close(fd);
+    return -1;
+}
+
+static int
+compare_paths(const void *a, const void *b)
+{
+    return strcmp(a, b);
+}
+
+int LIBLOCAL
+tux_hidraw_enumerate(int vendor_id, int product_id,
+                     char devices[][TRANSPORT_DEVICE_SIZE], int max)
+{
+    DIR* dir;
+    struct dirent *dinfo;
+    hidraw_reports_t layout;
+    int fd, count;
+
+    /* The dongles are found in sysfs without opening any node */
+    count = usb_sysfs_enumerate(vendor_id, product_id, USB_SYSFS_HIDRAW,
+                                devices, max);
+    if (count >= 0)
+    {
+        return count;
+    }
+
+    /* Without sysfs, each node is opened to be identified */
+    count = 0;
+    dir = opendir("/dev");
+    if (dir == NULL)
+    {
+        return 0;
+    }
+
+    while ((count < max) && ((dinfo = readdir(dir)) != NULL))
+    {
+        if (snprintf(devices[count], TRANSPORT_DEVICE_SIZE, "/dev/%s",
+                     dinfo->d_name) >= TRANSPORT_DEVICE_SIZE)
+        {
+            continue;
+        }
+        if ((fd = tux_hidraw_open(devices[count], vendor_id, product_id,
+                                  &layout)) >= 0)
+        {
+            close(fd);
+            count++;
+        }
+    }
+
+    closedir(dir);
+    qsort(devices, count, TRANSPORT_DEVICE_SIZE, compare_paths);
+    return count;
+}
+
+bool LIBLOCAL
+tux_hidraw_capture(const char *device, int vendor_id, int product_id)
+{
+    char devices[1][TRANSPORT_DEVICE_SIZE];
+    int fd;
+
+    /* Without a path, take the first dongle found */
+    if (device == NULL)
+    {
+        if (tux_hidraw_enumerate(vendor_id, product_id, devices, 1) == 0)
+        {
+            return false;
+        }
+        device = devices[0];
+    }
+
+    if ((fd = tux_hidraw_open(device, vendor_id, product_id, &reports)) < 0)
+    {
+        return false;
+    }
+    snprintf(tux_raw_path, sizeof(tux_raw_path), "%s", device);
+    tux_raw_hdl = fd;
+    return true;
+}
+
+void LIBLOCAL
+tux_hidraw_release(void)
+{
+    if (tux_raw_hdl != -1)
+    {
+        close(tux_raw_hdl);
+        tux_raw_hdl = -1;
+    }
+}
+
+/**
+ * Frame data as a report of the device in report: the first byte is the
+ * report number, 0 when reports aren't numbered, and the report is always
+ * complete, padded with zeros. Returns the size to write, -1 if data
+ * doesn't fit in a report.
+ */
+int LIBLOCAL
+tux_hidraw_frame(const hidraw_reports_t *layout, const unsigned char *data,
+                 int size, unsigned char *report)
+{
+    if ((size < 0) || (size > layout->out_size))
+    {
+        return -1;
+    }
+
+    memset(report, 0, HIDRAW_FRAME_SIZE_MAX);
+    report[0] = layout->out_id;
+    memcpy(&report[1], data, size);
+    return layout->out_size + 1;
+}
+
+/**
+ * Payload of the report of len bytes read from the device: the report
+ * number, if any, is skipped. Returns the size of the payload.
+ */
+int LIBLOCAL
+tux_hidraw_unframe(const hidraw_reports_t *layout,
+                   const unsigned char *report, int len,
+                   const unsigned char **payload)
+{
+    int offset = layout->numbered ? 1 : 0;
+
+    *payload = &report[offset];
+    return (len > offset) ? len - offset : 0;
+}
+
+bool LIBLOCAL
+tux_hidraw_write(int size, const unsigned char *buffer)
+{
+    unsigned char report[HIDRAW_FRAME_SIZE_MAX];
+    int len;
+
+    if ((len = tux_hidraw_frame(&reports, buffer, size, report)) < 0)
+    {
+        return false;
+    }
+
+    stats_add(STATS_SYSCALLS, 1);
+    return write(tux_raw_hdl, report, len) == len;
+}
+
+bool LIBLOCAL
+tux_hidraw_wait_report(int size, unsigned char *buffer, int timeout_ms)
+{
+    unsigned char report[HIDRAW_FRAME_SIZE_MAX];
+    const unsigned char *payload;
+    struct pollfd pfd;
+    ssize_t len;
+
+    if ((size < 0) || (size > reports.in_size))
+    {
+        return false;
+    }
+
+    pfd.fd = tux_raw_hdl;
+    pfd.events = POLLIN;
+    stats_add(STATS_SYSCALLS, 1);
+    if ((poll(&pfd, 1, timeout_ms) <= 0) || !(pfd.revents & POLLIN))
+    {
+        return false;
+    }
+
+    stats_add(STATS_SYSCALLS, 1);
+    len = read(tux_raw_hdl, report, sizeof(report));
+    if ((len < 0)
+        || (tux_hidraw_unframe(&reports, report, len, &payload) < size))
+    {
+        return false;
+    }
+
+    memcpy(buffer, payload, size);
+    return true;
+}
+
+bool LIBLOCAL
+tux_hidraw_read(int size, unsigned char *buffer)
+{
+    return tux_hidraw_wait_report(size, buffer, HID_RW_TIMEOUT);
+}
+
+static bool
+hidraw_open(const char *device)
+{
+    return tux_hidraw_capture(device, TUX_VENDOR_ID, TUX_PRODUCT_ID);
+}
+
+static int
+hidraw_enumerate(char devices[][TRANSPORT_DEVICE_SIZE], int max)
+{
+    return tux_hidraw_enumerate(TUX_VENDOR_ID, TUX_PRODUCT_ID, devices, max);
+}
+
+static bool
+hidraw_get_path(char *path, int size)
+{
+    if (tux_raw_hdl == -1)
+    {
+        return false;
+    }
+    snprintf(path, size, "%s", tux_raw_path);
+    return true;
+}
+
+static bool
+hidraw_write_report(const uint8_t *data, int size)
+{
+    return tux_hidraw_write(size, data);
+}
+
+static bool
+hidraw_read_report(uint8_t *data, int size, int timeout_ms)
+{
+    return tux_hidraw_wait_report(size, data, timeout_ms);
+}
+
+/* One read or write per report, and the input reports are queued by the
+ * kernel instead of being polled: preferred over hiddev */
+const transport_t transport_hidraw = {
+    .name = "hidraw",
+    .open = hidraw_open,
+    .close = tux_hidraw_release,
+    .enumerate = hidraw_enumerate,
+    .get_path = hidraw_get_path,
+    .write_report = hidraw_write_report,
+    .read_report = hidraw_read_report,
+    .drain = drain_input_reports,
+};
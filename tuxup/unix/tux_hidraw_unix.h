@@ -0,0 +1,60 @@
+/*
+ * Tux Droid - Hidraw interface (only for unix)
+ * Copyright (C) 2008 C2ME Sa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef _TUX_HIDRAW_H_
+#define _TUX_HIDRAW_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "transport.h"
+
+/* Largest report size accepted on the hidraw interface */
+#define HIDRAW_REPORT_SIZE_MAX               64
+/* Largest report, plus one byte for the report id */
+#define HIDRAW_FRAME_SIZE_MAX                (HIDRAW_REPORT_SIZE_MAX + 1)
+
+/** Layout of the reports of a hidraw device, from its report descriptor */
+typedef struct
+{
+    int out_size;                   /* Output report size in bytes */
+    int in_size;                    /* Input report size in bytes */
+    bool numbered;                  /* Reports are prefixed by an id */
+    uint8_t out_id;                 /* Id of the output report, if any */
+} hidraw_reports_t;
+
+extern int tux_hidraw_open(const char *path, int vendor_id, int product_id,
+                           hidraw_reports_t *layout);
+extern bool tux_hidraw_capture(const char *device, int vendor_id,
+                               int product_id);
+extern int tux_hidraw_enumerate(int vendor_id, int product_id,
+                                char devices[][TRANSPORT_DEVICE_SIZE],
+                                int max);
+extern void tux_hidraw_release(void);
+extern int tux_hidraw_frame(const hidraw_reports_t *layout,
+                            const unsigned char *data, int size,
+                            unsigned char *report);
+extern int tux_hidraw_unframe(const hidraw_reports_t *layout,
+                              const unsigned char *report, int len,
+                              const unsigned char **payload);
+extern bool tux_hidraw_write(int size, const unsigned char *buffer);
+extern bool tux_hidraw_read(int size, unsigned char *buffer);
+extern bool tux_hidraw_wait_report(int size, unsigned char *buffer,
+                                   int timeout_ms);
+
+#endif /* _TUX_HIDRAW_H_ */
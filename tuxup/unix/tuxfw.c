@@ -0,0 +1,275 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   tuxfw.c
+ *
+ *   @brief  Precompiled firmware images.
+ *
+ *   A .tuxfw file holds the pages of a hex or eep file already laid out as
+ *   the FILLPAGE command sends them. It is mapped in memory and its pages
+ *   are sent from the mapping, without any conversion.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "tuxfw.h"
+#include "bootloader.h"
+#include "log.h"
+
+/**
+ * \brief CRC-32 (IEEE 802.3) of a buffer
+ */
+uint32_t tuxfw_crc32(const void *data, size_t len)
+{
+    static uint32_t table[256];
+    static bool table_ready = false;
+    const uint8_t *p = data;
+    uint32_t crc;
+    unsigned int i, j;
+
+    if (!table_ready)
+    {
+        for (i = 0; i < 256; i++)
+        {
+            crc = i;
+            for (j = 0; j < 8; j++)
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+            table[i] = crc;
+        }
+        table_ready = true;
+    }
+
+    crc = 0xFFFFFFFF;
+    while (len--)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
+}
+
+/**
+ * \brief Lay out an image in memory as a .tuxfw file
+ * \param cpu_nbr   CPU the image is for
+ * \param mem_type  FLASH or EEPROM
+ * \param data      Allocated file content, to be freed by the caller
+ * \param size      Size of the content
+ * \return false if the image can't be sent by FILLPAGE
+ */
+bool tuxfw_build(const hex_image_t *image, uint8_t cpu_nbr, int mem_type,
+                 uint8_t **data, size_t *size)
+{
+    tuxfw_header_t header;
+    uint32_t *crc;
+    uint8_t *blank, *segment;
+    unsigned int i;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TUXFW_MAGIC, sizeof(header.magic));
+    header.format = TUXFW_FORMAT;
+    header.cpu_nbr = cpu_nbr;
+    header.mem_type = mem_type;
+    if (image->has_version)
+    {
+        header.flags |= TUXFW_HAS_VERSION;
+        hex_image_get_version(image, &header.version);
+    }
+    header.page_size = HEX_PAGE_SIZE;
+    header.segment_size = FILLPAGE_SEGMENT_SIZE;
+    header.page_count = image->page_count;
+    header.crc_offset = sizeof(header);
+    header.blank_offset = header.crc_offset
+                          + image->page_count * sizeof(uint32_t);
+    header.segments_offset = header.blank_offset
+                             + (image->page_count + 7) / 8;
+    header.segments_offset += (TUXFW_ALIGN
+                               - header.segments_offset % TUXFW_ALIGN)
+                              % TUXFW_ALIGN;
+
+    *size = header.segments_offset
+            + (size_t)image->page_count * FILLPAGE_SEGMENT_SIZE;
+    if ((*data = calloc(1, *size)) == NULL)
+    {
+        log_error("Unable to allocate the image");
+        return false;
+    }
+    memcpy(*data, &header, sizeof(header));
+    crc = (uint32_t *)(*data + header.crc_offset);
+    blank = *data + header.blank_offset;
+
+    for (i = 0; i < image->page_count; i++)
+    {
+        segment = *data + header.segments_offset + i * FILLPAGE_SEGMENT_SIZE;
+        if (!bootload_segment(&image->pages[i], segment))
+        {
+            free(*data);
+            *data = NULL;
+            return false;
+        }
+        crc[i] = tuxfw_crc32(segment, FILLPAGE_SEGMENT_SIZE);
+        if (hex_page_is_blank(&image->pages[i]))
+            blank[i / 8] |= 1 << (i % 8);
+    }
+    return true;
+}
+
+/**
+ * \brief Write an image in a .tuxfw file
+ * \param cpu_nbr   CPU the image is for
+ * \param mem_type  FLASH or EEPROM
+ * \return false if the image can't be sent by FILLPAGE or the file can't
+ * be written
+ */
+bool tuxfw_compile(const hex_image_t *image, uint8_t cpu_nbr, int mem_type,
+                   const char *filename)
+{
+    uint8_t *data;
+    size_t size;
+    bool ok;
+    FILE *fs;
+
+    if (!tuxfw_build(image, cpu_nbr, mem_type, &data, &size))
+        return false;
+
+    if ((fs = fopen(filename, "wb")) == NULL)
+    {
+        log_error("Unable to open file '%s' for writing", filename);
+        free(data);
+        return false;
+    }
+    ok = fwrite(data, 1, size, fs) == size;
+    if (fclose(fs) != 0)
+        ok = false;
+    if (!ok)
+    {
+        log_error("Unable to write file '%s'", filename);
+        unlink(filename);
+    }
+    free(data);
+    return ok;
+}
+
+/**
+ * \brief Use a .tuxfw image held in memory
+ *
+ * The layout of the image is checked, not the content of its pages. The
+ * memory isn't owned by the image and must outlive it.
+ *
+ * \param name  Name of the image, for the messages
+ * \return false if the image is not valid
+ */
+bool tuxfw_attach(tuxfw_t *fw, const void *data, size_t size,
+                  const char *name)
+{
+    const tuxfw_header_t *header = data;
+
+    memset(fw, 0, sizeof(*fw));
+    if (size < sizeof(tuxfw_header_t)
+        || memcmp(header->magic, TUXFW_MAGIC, sizeof(header->magic))
+        || header->format != TUXFW_FORMAT
+        || header->page_size != HEX_PAGE_SIZE
+        || header->segment_size != FILLPAGE_SEGMENT_SIZE
+        || header->crc_offset % sizeof(uint32_t)
+        || header->crc_offset + (uint64_t)header->page_count
+           * sizeof(uint32_t) > size
+        || header->blank_offset + (uint64_t)(header->page_count + 7) / 8
+           > size
+        || header->segments_offset + (uint64_t)header->page_count
+           * header->segment_size > size)
+    {
+        log_error("'%s' is not a valid tuxfw file", name);
+        return false;
+    }
+    fw->size = size;
+    fw->header = header;
+    fw->crc = (const uint32_t *)((const uint8_t *)data + header->crc_offset);
+    fw->blank = (const uint8_t *)data + header->blank_offset;
+    fw->segments = (const uint8_t *)data + header->segments_offset;
+    return true;
+}
+
+/**
+ * \brief Map a .tuxfw file and check its content
+ * \return false if the file can't be read or is corrupted
+ */
+bool tuxfw_open(tuxfw_t *fw, const char *filename)
+{
+    struct stat st;
+    void *map;
+    unsigned int i;
+    int fd;
+
+    memset(fw, 0, sizeof(*fw));
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+    {
+        log_error("Unable to open file '%s' for reading", filename);
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(tuxfw_header_t))
+    {
+        log_error("'%s' is not a tuxfw file", filename);
+        close(fd);
+        return false;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        log_error("Unable to map file '%s'", filename);
+        return false;
+    }
+    if (!tuxfw_attach(fw, map, st.st_size, filename))
+    {
+        munmap(map, st.st_size);
+        return false;
+    }
+    fw->map = map;
+
+    for (i = 0; i < fw->header->page_count; i++)
+    {
+        if (tuxfw_crc32(tuxfw_segment(fw, i), fw->header->segment_size)
+            != fw->crc[i])
+        {
+            log_error("'%s': page %u is corrupted", filename, i);
+            tuxfw_close(fw);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Unmap a .tuxfw file, an attached image is only forgotten
+ */
+void tuxfw_close(tuxfw_t *fw)
+{
+    if (fw->map)
+        munmap(fw->map, fw->size);
+    memset(fw, 0, sizeof(*fw));
+}
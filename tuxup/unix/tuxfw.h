@@ -0,0 +1,95 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef TUXFW_H
+#define TUXFW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "common/defines.h"
+#include "hex_image.h"
+
+#define TUXFW_MAGIC         "TXFW"
+#define TUXFW_FORMAT        1
+/** The segments start on a boundary of that size in the file */
+#define TUXFW_ALIGN         4096
+
+/** version is valid */
+#define TUXFW_HAS_VERSION   0x01
+
+/**
+ * Header of a .tuxfw file, in the byte order of the host. It is followed
+ * by the CRC-32 of each segment, the bitmap of the blank pages (bit i % 8 of
+ * byte i / 8 set when page i only holds 0xFF) and, aligned on
+ * TUXFW_ALIGN, the segments in the layout sent by the FILLPAGE command.
+ */
+typedef struct
+{
+    char magic[4];                  /* TUXFW_MAGIC */
+    uint8_t format;                 /* TUXFW_FORMAT */
+    uint8_t cpu_nbr;
+    uint8_t mem_type;               /* FLASH or EEPROM */
+    uint8_t flags;
+    version_t version;
+    uint16_t page_size;             /* Data bytes in a page */
+    uint16_t segment_size;          /* Address and data of a page */
+    uint32_t page_count;
+    uint32_t crc_offset;
+    uint32_t blank_offset;
+    uint32_t segments_offset;
+} tuxfw_header_t;
+
+/** .tuxfw image mapped in memory */
+typedef struct
+{
+    void *map;                      /* Mapping owned, NULL when attached */
+    size_t size;
+    const tuxfw_header_t *header;
+    const uint32_t *crc;
+    const uint8_t *blank;
+    const uint8_t *segments;
+} tuxfw_t;
+
+/* Prototypes */
+uint32_t tuxfw_crc32(const void *data, size_t len);
+bool tuxfw_build(const hex_image_t *image, uint8_t cpu_nbr, int mem_type,
+                 uint8_t **data, size_t *size);
+bool tuxfw_compile(const hex_image_t *image, uint8_t cpu_nbr, int mem_type,
+                   const char *filename);
+bool tuxfw_attach(tuxfw_t *fw, const void *data, size_t size,
+                  const char *name);
+bool tuxfw_open(tuxfw_t *fw, const char *filename);
+void tuxfw_close(tuxfw_t *fw);
+
+/** Segment of page i */
+static inline const uint8_t *tuxfw_segment(const tuxfw_t *fw, unsigned int i)
+{
+    return fw->segments + (size_t)i * fw->header->segment_size;
+}
+
+/** Page i only holds 0xFF */
+static inline bool tuxfw_page_is_blank(const tuxfw_t *fw, unsigned int i)
+{
+    return fw->blank[i / 8] & (1 << (i % 8));
+}
+
+#endif /* TUXFW_H */
@@ -0,0 +1,553 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <libusb-1.0/libusb.h>
+
+#include "usb-connection.h"
+#include "usb-async.h"
+#include "tux-api.h"
+#include "transport.h"
+#include "bootloader.h"
+#include "stats.h"
+#include "log.h"
+
+/**
+ * \defgroup USB_ASYNC Asynchronous USB handling
+ * \ingroup USB
+ * \brief libusb-1.0 backend that pipelines the bootloader pages
+ *
+ * A page is sent as two OUT transfers followed by one IN transfer that
+ * returns the bootloader status. All three are submitted at once. While a
+ * page is in flight, the next one can be queued; it is submitted from the
+ * completion callback of the current page as soon as its status arrives, so
+ * that no time is lost between pages.
+ *
+ * @{
+ */
+
+/** Number of frames skipped while waiting for the status of a page */
+#define STATUS_RETRIES      16
+
+/** One bootloader page, split in the two packets sent to the dongle */
+typedef struct
+{
+    uint8_t out1[USB_ASYNC_PACKET_SIZE];
+    int len1;
+    uint8_t out2[USB_ASYNC_PACKET_SIZE];
+    int len2;
+    uint8_t counter;                    /* Page counter of its status */
+} usb_async_page_t;
+
+static libusb_context *ctx;
+static libusb_device_handle *handle;
+static int bcd_device;
+
+static struct libusb_transfer *xfer_out1;
+static struct libusb_transfer *xfer_out2;
+static struct libusb_transfer *xfer_in;
+static uint8_t status_frame[USB_ASYNC_PACKET_SIZE];
+
+static usb_async_page_t inflight;       /* Page being transferred */
+static usb_async_page_t pending;        /* Next page, waiting for the ack */
+static bool page_inflight;
+static bool page_pending;
+static int outs_left;                   /* OUT transfers not completed yet */
+static bool ack_received;
+static int status_retries;
+static int active_transfers;            /* Submitted, not called back yet */
+static bool async_error;
+
+static void submit_inflight(void);
+
+/**
+ * \brief Check if the page in flight is complete and start the next one.
+ */
+static void page_check_done(void)
+{
+    if (!page_inflight || outs_left || !ack_received)
+        return;
+
+    page_inflight = false;
+    if (page_pending && !async_error)
+    {
+        inflight = pending;
+        page_pending = false;
+        submit_inflight();
+    }
+}
+
+static void LIBUSB_CALL out_callback(struct libusb_transfer *transfer)
+{
+    active_transfers--;
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED
+        || transfer->actual_length != transfer->length)
+    {
+        if (transfer->status != LIBUSB_TRANSFER_CANCELLED)
+            log_error("usb async write error: status = %d \n",
+                      transfer->status);
+        async_error = true;
+        return;
+    }
+    stats_add(STATS_TRANSFERS, 1);
+    stats_add(STATS_BYTES_SENT, transfer->actual_length);
+    outs_left--;
+    page_check_done();
+}
+
+static void LIBUSB_CALL in_callback(struct libusb_transfer *transfer)
+{
+    active_transfers--;
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED
+        || transfer->actual_length != transfer->length)
+    {
+        if (transfer->status != LIBUSB_TRANSFER_CANCELLED)
+            log_error("usb async read error: status = %d \n",
+                      transfer->status);
+        async_error = true;
+        return;
+    }
+    stats_add(STATS_TRANSFERS, 1);
+    stats_add(STATS_BYTES_RECEIVED, transfer->actual_length);
+
+    /* Skip the frames that are not the status of the page in flight: the
+     * reply to the initialization or a late status of the previous page */
+    if (!bootload_is_status(status_frame, inflight.counter))
+    {
+        stats_add(STATS_RETRIES, 1);
+        stats_add(STATS_SYSCALLS, 1);
+        if (++status_retries > STATUS_RETRIES
+            || libusb_submit_transfer(xfer_in) < 0)
+        {
+            log_error("No status received from the bootloader\n");
+            async_error = true;
+            return;
+        }
+        active_transfers++;
+        return;
+    }
+
+    if (status_frame[1] != 0)
+    {
+        log_error("Bootloader status error: %x\n", status_frame[1]);
+        async_error = true;
+        return;
+    }
+
+    ack_received = true;
+    page_check_done();
+}
+
+/**
+ * \brief Submit the two packets and the status request of the page in
+ * flight.
+ */
+static void submit_inflight(void)
+{
+    page_inflight = true;
+    outs_left = 2;
+    ack_received = false;
+    status_retries = 0;
+
+    libusb_fill_interrupt_transfer(xfer_out1, handle, USB_W_ENDPOINT,
+                                   inflight.out1, inflight.len1,
+                                   out_callback, NULL, USB_W_TIMEOUT);
+    libusb_fill_interrupt_transfer(xfer_out2, handle, USB_W_ENDPOINT,
+                                   inflight.out2, inflight.len2,
+                                   out_callback, NULL, USB_W_TIMEOUT);
+    libusb_fill_interrupt_transfer(xfer_in, handle, USB_R_ENDPOINT,
+                                   status_frame, sizeof(status_frame),
+                                   in_callback, NULL, USB_R_TIMEOUT);
+
+    stats_add(STATS_SYSCALLS, 3);
+    if (libusb_submit_transfer(xfer_out1) < 0)
+    {
+        async_error = true;
+        return;
+    }
+    active_transfers++;
+    if (libusb_submit_transfer(xfer_out2) < 0)
+    {
+        async_error = true;
+        return;
+    }
+    active_transfers++;
+    if (libusb_submit_transfer(xfer_in) < 0)
+    {
+        async_error = true;
+        return;
+    }
+    active_transfers++;
+}
+
+/**
+ * \brief Run the libusb event loop while there is something in flight and
+ * the pending slot is in use (or anything is in flight if 'all' is set).
+ * \return false if a transfer failed
+ */
+static bool wait_events(bool all)
+{
+    while (!async_error && (page_pending || (all && page_inflight)))
+    {
+        stats_add(STATS_SYSCALLS, 1);
+        if (libusb_handle_events(ctx) < 0)
+            async_error = true;
+    }
+    return !async_error;
+}
+
+/**
+ * \brief Cancel all the transfers still active and wait for their
+ * callbacks.
+ */
+static void cancel_transfers(void)
+{
+    if (active_transfers <= 0)
+        return;
+
+    libusb_cancel_transfer(xfer_out1);
+    libusb_cancel_transfer(xfer_out2);
+    libusb_cancel_transfer(xfer_in);
+    while (active_transfers > 0)
+    {
+        if (libusb_handle_events(ctx) < 0)
+            break;
+    }
+}
+
+/**
+ * \brief Path of the usbfs node of a device, /dev/bus/usb/BUS/DEVICE
+ */
+static void device_path(libusb_device *dev, char *path, int size)
+{
+    snprintf(path, size, "/dev/bus/usb/%03d/%03d",
+             libusb_get_bus_number(dev), libusb_get_device_address(dev));
+}
+
+/**
+ * \brief List the dongles, or open the one at path if open_path is set
+ * \return the number of dongles listed, 1 if the dongle has been opened
+ */
+static int scan_dongles(libusb_context *context,
+                        char devices[][TRANSPORT_DEVICE_SIZE], int max,
+                        const char *open_path)
+{
+    struct libusb_device_descriptor desc;
+    char path[TRANSPORT_DEVICE_SIZE];
+    libusb_device **list;
+    ssize_t n, i;
+    int count = 0;
+
+    if ((n = libusb_get_device_list(context, &list)) < 0)
+        return 0;
+    for (i = 0; i < n && count < max; i++)
+    {
+        if (libusb_get_device_descriptor(list[i], &desc) != 0
+            || desc.idVendor != TUX_VENDOR_ID
+            || desc.idProduct != TUX_PRODUCT_ID)
+            continue;
+        device_path(list[i], path, sizeof(path));
+        if (open_path == NULL)
+            snprintf(devices[count++], TRANSPORT_DEVICE_SIZE, "%s", path);
+        else if (!strcmp(path, open_path))
+        {
+            if (libusb_open(list[i], &handle) == 0)
+                count = 1;
+            break;
+        }
+    }
+    libusb_free_device_list(list, 1);
+    return count;
+}
+
+/**
+ * \brief List the dongles seen by libusb-1.0
+ */
+int usb_async_enumerate(char devices[][TRANSPORT_DEVICE_SIZE], int max)
+{
+    libusb_context *context;
+    int count;
+
+    if (libusb_init(&context) < 0)
+        return 0;
+    count = scan_dongles(context, devices, max, NULL);
+    libusb_exit(context);
+    return count;
+}
+
+/**
+ * \brief Find and open the dongle with libusb-1.0
+ * \param device  usbfs path of the dongle, NULL for the first one found
+ * \return true if the dongle has been opened and its interface claimed
+ */
+bool usb_async_open(const char *device)
+{
+    struct libusb_device_descriptor desc;
+    int err;
+
+    if (handle)
+        return true;
+
+    /* Only the usbfs paths are libusb devices */
+    if (device && strncmp(device, "/dev/bus/usb/", 13))
+        return false;
+
+    if (libusb_init(&ctx) < 0)
+        return false;
+
+    if (device == NULL)
+        handle = libusb_open_device_with_vid_pid(ctx, TUX_VENDOR_ID,
+                                                 TUX_PRODUCT_ID);
+    else
+        scan_dongles(ctx, NULL, 1, device);
+    if (handle == NULL)
+    {
+        libusb_exit(ctx);
+        ctx = NULL;
+        return false;
+    }
+
+    log_info("Device opened");
+
+    if (libusb_get_device_descriptor(libusb_get_device(handle), &desc) == 0)
+        bcd_device = desc.bcdDevice;
+
+    if (libusb_kernel_driver_active(handle, USB_COMMAND) == 1)
+        libusb_detach_kernel_driver(handle, USB_COMMAND);
+
+    err = libusb_claim_interface(handle, USB_COMMAND);
+    if (err != 0)
+    {
+        log_error("Claim interface failed: %s\n", libusb_error_name(err));
+        usb_async_close();
+        return false;
+    }
+
+    xfer_out1 = libusb_alloc_transfer(0);
+    xfer_out2 = libusb_alloc_transfer(0);
+    xfer_in = libusb_alloc_transfer(0);
+    if (!xfer_out1 || !xfer_out2 || !xfer_in)
+    {
+        usb_async_close();
+        return false;
+    }
+
+    page_inflight = false;
+    page_pending = false;
+    active_transfers = 0;
+    async_error = false;
+
+    log_info("USB interface claimed successfully \n");
+
+    return true;
+}
+
+/**
+ * \brief Release the interface and close the dongle
+ */
+void usb_async_close(void)
+{
+    if (handle == NULL)
+        return;
+
+    cancel_transfers();
+    libusb_free_transfer(xfer_out1);
+    libusb_free_transfer(xfer_out2);
+    libusb_free_transfer(xfer_in);
+    xfer_out1 = xfer_out2 = xfer_in = NULL;
+
+    libusb_release_interface(handle, USB_COMMAND);
+    libusb_close(handle);
+    handle = NULL;
+    libusb_exit(ctx);
+    ctx = NULL;
+}
+
+/**
+ * \brief Return the bcdDevice of the dongle opened with usb_async_open()
+ */
+int usb_async_bcd_device(void)
+{
+    return bcd_device;
+}
+
+/**
+ * \brief Path of the dongle opened
+ */
+bool usb_async_get_path(char *path, int size)
+{
+    if (handle == NULL)
+        return false;
+    device_path(libusb_get_device(handle), path, size);
+    return true;
+}
+
+/**
+ * \brief Identify the dongle by the USB port it is plugged in, in the form
+ * transport_get_id() gives from sysfs
+ */
+bool usb_async_get_id(char *id, int size)
+{
+    libusb_device *dev;
+    uint8_t ports[7];
+    int count, i, len;
+
+    if (handle == NULL || size <= 0)
+        return false;
+
+    dev = libusb_get_device(handle);
+    len = snprintf(id, size, "usb-%d", libusb_get_bus_number(dev));
+    count = libusb_get_port_numbers(dev, ports, sizeof(ports));
+    for (i = 0; i < count && len < size; i++)
+        len += snprintf(id + len, size - len, "%c%d", i ? '.' : '-',
+                        ports[i]);
+    return true;
+}
+
+/**
+ * \brief Send a command synchronously
+ * \return number of bytes sent or a negative libusb error
+ */
+int usb_async_send_commands(uint8_t * send_data, int size)
+{
+    int transferred = 0;
+    int status;
+
+    stats_add(STATS_SYSCALLS, 1);
+    status = libusb_interrupt_transfer(handle, USB_W_ENDPOINT, send_data,
+                                       size, &transferred, USB_W_TIMEOUT);
+    if (status < 0)
+    {
+        log_error("libusb_interrupt_transfer error: status = %d :: %s \n",
+                  status, libusb_error_name(status));
+        return status;
+    }
+    return transferred;
+}
+
+/**
+ * \brief Get a frame synchronously
+ * \return number of bytes received or a negative libusb error
+ */
+int usb_async_get_commands(uint8_t * receive_data, int size, int timeout_ms)
+{
+    int transferred = 0;
+    int status;
+
+    stats_add(STATS_SYSCALLS, 1);
+    status = libusb_interrupt_transfer(handle, USB_R_ENDPOINT, receive_data,
+                                       size, &transferred, timeout_ms);
+    if (status < 0 && status != LIBUSB_ERROR_TIMEOUT)
+    {
+        log_error("libusb_interrupt_transfer error: status = %d :: %s \n",
+                  status, libusb_error_name(status));
+        return status;
+    }
+    return transferred;
+}
+
+/**
+ * \brief Queue a bootloader page
+ *
+ * The page is submitted right away if nothing is in flight. Otherwise it is
+ * kept until the status of the page in flight arrives, at which point it is
+ * submitted from the completion callback. This function only blocks when a
+ * page is already waiting.
+ *
+ * \param counter  Page counter the bootloader returns in the status
+ * \return false if a transfer failed or the bootloader reported an error
+ */
+bool usb_async_queue_page(const uint8_t *packet1, int len1,
+                          const uint8_t *packet2, int len2, uint8_t counter)
+{
+    usb_async_page_t *page;
+
+    /* Only one page can wait behind the one in flight */
+    if (!wait_events(false))
+        return false;
+
+    page = page_inflight ? &pending : &inflight;
+    memcpy(page->out1, packet1, len1);
+    page->len1 = len1;
+    memcpy(page->out2, packet2, len2);
+    page->len2 = len2;
+    page->counter = counter;
+
+    if (page_inflight)
+        page_pending = true;
+    else
+        submit_inflight();
+
+    return !async_error;
+}
+
+/**
+ * \brief Wait until all the queued pages have been acknowledged
+ * \return false if a transfer failed or the bootloader reported an error
+ */
+bool usb_async_flush(void)
+{
+    bool ret = wait_events(true);
+
+    if (!ret)
+    {
+        cancel_transfers();
+        page_inflight = false;
+        page_pending = false;
+        async_error = false;
+    }
+    return ret;
+}
+
+static bool async_write_report(const uint8_t *data, int size)
+{
+    return usb_async_send_commands((uint8_t *)data, size) == size;
+}
+
+static bool async_read_report(uint8_t *data, int size, int timeout_ms)
+{
+    /* A timeout of 0 would wait forever */
+    if (timeout_ms <= 0)
+        return false;
+    return usb_async_get_commands(data, size, timeout_ms) == size;
+}
+
+const transport_t transport_libusb1 = {
+    .name = "libusb1",
+    .open = usb_async_open,
+    .close = usb_async_close,
+    .enumerate = usb_async_enumerate,
+    .get_id = usb_async_get_id,
+    .get_path = usb_async_get_path,
+    .bcd_device = usb_async_bcd_device,
+    .write_report = async_write_report,
+    .read_report = async_read_report,
+    .queue_page = usb_async_queue_page,
+    .flush = usb_async_flush,
+    /* libusb-1.0 doesn't support its context and transfers being used by
+     * a child process */
+    .fork_unsafe = true,
+};
+
+          /** @} *//* end of USB_ASYNC group */
@@ -0,0 +1,45 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef USB_ASYNC_H
+#define USB_ASYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "transport.h"
+
+/** Largest packet exchanged with the command interface */
+#define USB_ASYNC_PACKET_SIZE   64
+
+/* Prototypes, the backend is only built with 'make LIBUSB1=1' */
+bool usb_async_open(const char *device);
+int usb_async_enumerate(char devices[][TRANSPORT_DEVICE_SIZE], int max);
+void usb_async_close(void);
+int usb_async_bcd_device(void);
+bool usb_async_get_id(char *id, int size);
+bool usb_async_get_path(char *path, int size);
+int usb_async_send_commands(uint8_t * send_data, int size);
+int usb_async_get_commands(uint8_t * receive_data, int size, int timeout_ms);
+bool usb_async_queue_page(const uint8_t *packet1, int len1,
+                          const uint8_t *packet2, int len2, uint8_t counter);
+bool usb_async_flush(void);
+
+#endif /* USB_ASYNC_H */
@@ -21,10 +21,14 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <usb.h>                /* libusb header */
 #include <syslog.h>
 
 #include "usb-connection.h"
+#include "transport.h"
+#include "stats.h"
 #include "log.h"
 
 #define PRINT_DATA 0
@@ -38,10 +42,10 @@
  */
 
 /**
- * \brief Scan all USB busses to find Tux device
- * \return USB device of Tux
+ * \brief Scan all USB busses to find a device
+ * \return USB device, NULL if not found
  */
-struct usb_device *usb_find_tux()
+struct usb_device *usb_find_device(uint16_t vendor_id, uint16_t product_id)
 {
     struct usb_bus *bus;
     struct usb_device *device;
@@ -52,13 +56,22 @@ struct usb_device *usb_find_tux()
 
     for (bus = usb_busses; bus; bus = bus->next)
         for (device = bus->devices; device; device = device->next)
-            if (device->descriptor.idVendor == TUX_VENDOR_ID
-                && device->descriptor.idProduct == TUX_PRODUCT_ID)
+            if (device->descriptor.idVendor == vendor_id
+                && device->descriptor.idProduct == product_id)
                 return device;
 
     return NULL;
 }
 
+/**
+ * \brief Scan all USB busses to find Tux device
+ * \return USB device of Tux
+ */
+struct usb_device *usb_find_tux()
+{
+    return usb_find_device(TUX_VENDOR_ID, TUX_PRODUCT_ID);
+}
+
 /**
  * \brief Open USB interface
  * \param dev USB device
@@ -118,6 +131,7 @@ int usb_send_commands(usb_dev_handle * dev_h, uint8_t * send_data, int size)
 {
     int status;
 
+    stats_add(STATS_SYSCALLS, 1);
     status = usb_interrupt_write(dev_h, USB_W_ENDPOINT, (char *)send_data, size,
                                  USB_W_TIMEOUT);
     if (status < 0)
@@ -173,4 +187,132 @@ int usb_get_commands(usb_dev_handle * dev_h, uint8_t * receive_data, int size)
     return status;
 }
 
+/*
+ * Transport through libusb-0.1
+ */
+
+static struct usb_device *tux_device;
+static usb_dev_handle *tux_dev_h;
+
+/**
+ * Path of the usbfs node of a device, /dev/bus/usb/BUS/DEVICE
+ */
+static void libusb_device_path(struct usb_device *device, char *path,
+                               int size)
+{
+    snprintf(path, size, "/dev/bus/usb/%s/%s", device->bus->dirname,
+             device->filename);
+}
+
+/**
+ * Scan all USB busses to find the dongle at path, or the first one if path
+ * is NULL
+ */
+static struct usb_device *libusb_find_dongle(const char *path)
+{
+    char device_path[TRANSPORT_DEVICE_SIZE];
+    struct usb_bus *bus;
+    struct usb_device *device;
+
+    if (path == NULL)
+        return usb_find_tux();
+
+    usb_init();
+    usb_find_busses();
+    usb_find_devices();
+
+    for (bus = usb_busses; bus; bus = bus->next)
+        for (device = bus->devices; device; device = device->next)
+        {
+            libusb_device_path(device, device_path, sizeof(device_path));
+            if (device->descriptor.idVendor == TUX_VENDOR_ID
+                && device->descriptor.idProduct == TUX_PRODUCT_ID
+                && !strcmp(device_path, path))
+                return device;
+        }
+    return NULL;
+}
+
+static int libusb_enumerate(char devices[][TRANSPORT_DEVICE_SIZE], int max)
+{
+    struct usb_bus *bus;
+    struct usb_device *device;
+    int count = 0;
+
+    usb_init();
+    usb_find_busses();
+    usb_find_devices();
+
+    for (bus = usb_busses; bus; bus = bus->next)
+        for (device = bus->devices; device && count < max;
+             device = device->next)
+            if (device->descriptor.idVendor == TUX_VENDOR_ID
+                && device->descriptor.idProduct == TUX_PRODUCT_ID)
+                libusb_device_path(device, devices[count++],
+                                   TRANSPORT_DEVICE_SIZE);
+    return count;
+}
+
+static bool libusb_open_dongle(const char *device)
+{
+    /* Only the usbfs paths are libusb devices */
+    if (device && strncmp(device, "/dev/bus/usb/", 13))
+        return false;
+
+    /* The caller waits for the dongle to be plugged, see hotplug.c */
+    tux_device = libusb_find_dongle(device);
+    if (tux_device == NULL)
+        return false;
+
+    if ((tux_dev_h = usb_open_tux(tux_device)) == NULL)
+    {
+        log_error("USB DEVICE INIT ERROR \n");
+        return false;
+    }
+    return true;
+}
+
+static void libusb_close_dongle(void)
+{
+    usb_close_tux(tux_dev_h);
+    tux_dev_h = NULL;
+}
+
+static bool libusb_get_path(char *path, int size)
+{
+    libusb_device_path(tux_device, path, size);
+    return true;
+}
+
+static int libusb_bcd_device(void)
+{
+    return tux_device->descriptor.bcdDevice;
+}
+
+static bool libusb_write_report(const uint8_t *data, int size)
+{
+    return usb_send_commands(tux_dev_h, (uint8_t *)data, size) == size;
+}
+
+static bool libusb_read_report(uint8_t *data, int size, int timeout_ms)
+{
+    /* A timeout of 0 would wait forever */
+    if (timeout_ms <= 0)
+        return false;
+    stats_add(STATS_SYSCALLS, 1);
+    return usb_interrupt_read(tux_dev_h, USB_R_ENDPOINT, (char *)data, size,
+                              timeout_ms) == size;
+}
+
+const transport_t transport_libusb = {
+    .name = "libusb",
+    .open = libusb_open_dongle,
+    .close = libusb_close_dongle,
+    .enumerate = libusb_enumerate,
+    .get_path = libusb_get_path,
+    .bcd_device = libusb_bcd_device,
+    .write_report = libusb_write_report,
+    .read_report = libusb_read_report,
+};
+
           /** @} *//* end of USB group */
@@ -27,6 +27,8 @@
 /* USB general information */
 #define TUX_VENDOR_ID       0x03EB /** USB Manufacturer ID (Vendor Id) */
 #define TUX_PRODUCT_ID      0xFF07 /** USB Model Code (Product ID) */
+#define DFU_VENDOR_ID       0x03EB /** Vendor Id of the dongle in DFU mode */
+#define DFU_PRODUCT_ID      0x2FFD /** Product Id of the dongle in DFU mode */
 
 /* USB interfaces */
 #define USB_AUDIO_IN        0x01 /** audio input channel interface number */
@@ -63,6 +65,7 @@
 
 /* Prototypes */
 usb_dev_handle *usb_open_tux(struct usb_device *dev);
+struct usb_device *usb_find_device(uint16_t vendor_id, uint16_t product_id);
 struct usb_device *usb_find_tux();
 int usb_check_tux_status(usb_dev_handle * dev_h);
 int usb_send_commands(usb_dev_handle * dev_h, uint8_t * send_data, int size);
@@ -0,0 +1,343 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   usb_sysfs.c
+ *
+ *   @brief  Finds the USB devices, their ports and their nodes in sysfs.
+ *
+ *   The devices are matched on the idVendor and idProduct attributes of
+ *   /sys/bus/usb/devices, and their hidraw or hiddev node is taken from the
+ *   class devices of their interfaces: no node is opened to find them.
+ *
+ *   The nodes of a dongle (/dev/hidraw3, /dev/usb/hiddev0,
+ *   /dev/bus/usb/001/004) change each time it enumerates, when its firmware
+ *   is reprogrammed for example. The port it is plugged in, named as in
+ *   /sys/bus/usb/devices (1-2, 1-2.4...), doesn't.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <glob.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "usb_sysfs.h"
+#include "log.h"
+
+#ifndef SYSFS_ROOT
+#define SYSFS_ROOT          "/sys"
+#endif
+#define SYSFS_USB_DEVICES   SYSFS_ROOT "/bus/usb/devices"
+
+/**
+ * Read a number in an attribute of sysfs, -1 if it can't be read.
+ * \param format  "%d" or "%x"
+ */
+static int read_attribute(const char *path, const char *format)
+{
+    FILE *fs;
+    int value;
+
+    if ((fs = fopen(path, "r")) == NULL)
+        return -1;
+    if (fscanf(fs, format, &value) != 1)
+        value = -1;
+    fclose(fs);
+    return value;
+}
+
+static int read_number(const char *path)
+{
+    return read_attribute(path, "%d");
+}
+
+/**
+ * Tell if the USB device on port is vendor_id:product_id.
+ */
+static bool port_is(const char *port, int vendor_id, int product_id)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), SYSFS_USB_DEVICES "/%s/idVendor", port);
+    if (read_attribute(path, "%x") != vendor_id)
+        return false;
+    snprintf(path, sizeof(path), SYSFS_USB_DEVICES "/%s/idProduct", port);
+    return read_attribute(path, "%x") == product_id;
+}
+
+/**
+ * Name of the node of a device, hidraw3 for /dev/hidraw3.
+ */
+static const char *node_name(const char *device)
+{
+    const char *name = strrchr(device, '/');
+
+    return name ? name + 1 : device;
+}
+
+/**
+ * Kind of a node, from its path. -1 if it isn't one of a USB device.
+ */
+static int node_kind(const char *device)
+{
+    const char *name = node_name(device);
+
+    if (!strncmp(device, "/dev/bus/usb/", 13))
+        return USB_SYSFS_USBFS;
+    if (!strncmp(name, "hidraw", 6))
+        return USB_SYSFS_HIDRAW;
+    if (!strncmp(name, "hiddev", 6))
+        return USB_SYSFS_HIDDEV;
+    return -1;
+}
+
+/**
+ * Port of the USB device a class device (hidraw, hiddev) belongs to: the
+ * first directory above it that has a bus number.
+ */
+static bool class_port(const char *class_path, char *port, int size)
+{
+    char path[PATH_MAX], attribute[PATH_MAX + 8];
+    char *slash;
+
+    if (realpath(class_path, path) == NULL)
+        return false;
+    while ((slash = strrchr(path, '/')) != NULL && slash != path)
+    {
+        snprintf(attribute, sizeof(attribute), "%s/busnum", path);
+        if (access(attribute, F_OK) == 0)
+        {
+            snprintf(port, size, "%s", slash + 1);
+            return true;
+        }
+        *slash = '\0';
+    }
+    return false;
+}
+
+/**
+ * Port of the usbfs node /dev/bus/usb/BUS/DEVICE.
+ */
+static bool usbfs_port(const char *device, char *port, int size)
+{
+    char path[PATH_MAX];
+    glob_t found;
+    int bus, address;
+    size_t i;
+    bool ok = false;
+
+    if (sscanf(device, "/dev/bus/usb/%d/%d", &bus, &address) != 2
+        || glob(SYSFS_USB_DEVICES "/*/busnum", 0, NULL, &found) != 0)
+        return false;
+    for (i = 0; i < found.gl_pathc && !ok; i++)
+    {
+        *strrchr(found.gl_pathv[i], '/') = '\0';
+        snprintf(path, sizeof(path), "%s/devnum", found.gl_pathv[i]);
+        if (read_number(path) != address)
+            continue;
+        snprintf(path, sizeof(path), "%s/busnum", found.gl_pathv[i]);
+        if (read_number(path) != bus)
+            continue;
+        snprintf(port, size, "%s", node_name(found.gl_pathv[i]));
+        ok = true;
+    }
+    globfree(&found);
+    return ok;
+}
+
+/**
+ * \brief Find the USB port a dongle is plugged in
+ * \param device  Node of the dongle: hidraw, hiddev or usbfs
+ * \return false if the node isn't one of a USB device
+ */
+bool usb_sysfs_port(const char *device, char *port, int size)
+{
+    const char *name = node_name(device);
+    char path[PATH_MAX];
+
+    switch (node_kind(device))
+    {
+    case USB_SYSFS_USBFS:
+        return usbfs_port(device, port, size);
+    case USB_SYSFS_HIDRAW:
+        snprintf(path, sizeof(path), SYSFS_ROOT "/class/hidraw/%s/device",
+                 name);
+        return class_port(path, port, size);
+    case USB_SYSFS_HIDDEV:
+        /* The class of hiddev has been renamed from usb to usbmisc */
+        snprintf(path, sizeof(path), SYSFS_ROOT "/class/usbmisc/%s/device",
+                 name);
+        if (class_port(path, port, size))
+            return true;
+        snprintf(path, sizeof(path), SYSFS_ROOT "/class/usb/%s/device",
+                 name);
+        return class_port(path, port, size);
+    default:
+        return false;
+    }
+}
+
+/**
+ * Node in dir of the first class device matching pattern.
+ */
+static bool class_device(const char *pattern, const char *dir, int dir_len,
+                         char *device, int size)
+{
+    glob_t found;
+    bool ok;
+
+    if (glob(pattern, 0, NULL, &found) != 0)
+        return false;
+    ok = found.gl_pathc > 0;
+    if (ok)
+        snprintf(device, size, "%.*s%s", dir_len, dir,
+                 node_name(found.gl_pathv[0]));
+    globfree(&found);
+    return ok;
+}
+
+/**
+ * Node of a kind of the device on port. The class nodes are looked for in
+ * the dir_len first characters of dir.
+ */
+static bool port_node(const char *port, usb_sysfs_node_t node,
+                      const char *dir, int dir_len, char *device, int size)
+{
+    char path[PATH_MAX];
+    int bus, address;
+
+    switch (node)
+    {
+    case USB_SYSFS_USBFS:
+        snprintf(path, sizeof(path), SYSFS_USB_DEVICES "/%s/busnum", port);
+        bus = read_number(path);
+        snprintf(path, sizeof(path), SYSFS_USB_DEVICES "/%s/devnum", port);
+        address = read_number(path);
+        if (bus < 0 || address < 0)
+            return false;
+        snprintf(device, size, "/dev/bus/usb/%03d/%03d", bus, address);
+        return true;
+    case USB_SYSFS_HIDRAW:
+        snprintf(path, sizeof(path),
+                 SYSFS_USB_DEVICES "/%s/%s:*/*/hidraw/hidraw*", port, port);
+        return class_device(path, dir, dir_len, device, size);
+    case USB_SYSFS_HIDDEV:
+        /* The class of hiddev has been renamed from usb to usbmisc */
+        snprintf(path, sizeof(path),
+                 SYSFS_USB_DEVICES "/%s/%s:*/usbmisc/hiddev*", port, port);
+        if (class_device(path, dir, dir_len, device, size))
+            return true;
+        snprintf(path, sizeof(path),
+                 SYSFS_USB_DEVICES "/%s/%s:*/usb/hiddev*", port, port);
+        return class_device(path, dir, dir_len, device, size);
+    }
+    return false;
+}
+
+static int compare_devices(const void *a, const void *b)
+{
+    const usb_sysfs_match_t *ma = a, *mb = b;
+
+    return strcmp(ma->device, mb->device);
+}
+
+/**
+ * \brief Find the devices vendor_id:product_id and their nodes of a kind
+ *
+ * The devices that have no such node, or no node yet, are left out. The
+ * matches are sorted by node.
+ *
+ * \return the number of matches, at most max, -1 if sysfs can't be read
+ */
+int usb_sysfs_find(int vendor_id, int product_id, usb_sysfs_node_t node,
+                   usb_sysfs_match_t *matches, int max)
+{
+    /* udev puts the hiddev nodes in /dev/usb, older setups in /dev */
+    const char *dir = (node == USB_SYSFS_HIDDEV
+                       && access("/dev/usb", F_OK) == 0) ? "/dev/usb/"
+                                                         : "/dev/";
+    struct dirent *dinfo;
+    DIR *devices;
+    int count = 0;
+
+    if ((devices = opendir(SYSFS_USB_DEVICES)) == NULL)
+        return -1;
+    while (count < max && (dinfo = readdir(devices)) != NULL)
+    {
+        /* The interfaces are named after their device, 1-2:1.0 */
+        if (dinfo->d_name[0] == '.' || strchr(dinfo->d_name, ':')
+            || strlen(dinfo->d_name) >= USB_SYSFS_PORT_SIZE
+            || !port_is(dinfo->d_name, vendor_id, product_id)
+            || !port_node(dinfo->d_name, node, dir, strlen(dir),
+                          matches[count].device,
+                          sizeof(matches[count].device)))
+            continue;
+        strcpy(matches[count].port, dinfo->d_name);
+        count++;
+    }
+    closedir(devices);
+    qsort(matches, count, sizeof(*matches), compare_devices);
+    return count;
+}
+
+/**
+ * \brief List the nodes of the devices vendor_id:product_id, for the
+ * enumerate() of the transports
+ * \return the number of nodes, -1 if sysfs can't be read
+ */
+int usb_sysfs_enumerate(int vendor_id, int product_id, usb_sysfs_node_t node,
+                        char devices[][TRANSPORT_DEVICE_SIZE], int max)
+{
+    usb_sysfs_match_t *matches;
+    int count, i;
+
+    if ((matches = calloc(max > 0 ? max : 1, sizeof(*matches))) == NULL)
+        return -1;
+    count = usb_sysfs_find(vendor_id, product_id, node, matches, max);
+    for (i = 0; i < count; i++)
+    {
+        log_debug("%04x:%04x on port %s: %s", vendor_id, product_id,
+                  matches[i].port, matches[i].device);
+        snprintf(devices[i], TRANSPORT_DEVICE_SIZE, "%s", matches[i].device);
+    }
+    free(matches);
+    return count;
+}
+
+/**
+ * \brief Find the node of the device vendor_id:product_id plugged in a port
+ * \param like  Node of the same kind, hidraw, hiddev or usbfs, usually the
+ * one the device had before enumerating again
+ * \return false if there is no such node on that port yet
+ */
+bool usb_sysfs_device(const char *port, int vendor_id, int product_id,
+                      const char *like, char *device, int size)
+{
+    int node = node_kind(like);
+
+    if (node < 0 || !port_is(port, vendor_id, product_id))
+        return false;
+    return port_node(port, node, like, node_name(like) - like, device, size);
+}
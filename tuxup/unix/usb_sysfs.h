@@ -0,0 +1,55 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef USB_SYSFS_H
+#define USB_SYSFS_H
+
+#include <stdbool.h>
+#include "transport.h"
+
+/** Size of a USB port name, 1-2.4.1 */
+#define USB_SYSFS_PORT_SIZE 32
+
+/** Kind of node a USB device is reached through */
+typedef enum
+{
+    USB_SYSFS_HIDRAW,               /* /dev/hidraw3 */
+    USB_SYSFS_HIDDEV,               /* /dev/usb/hiddev0 */
+    USB_SYSFS_USBFS                 /* /dev/bus/usb/001/004 */
+} usb_sysfs_node_t;
+
+/** USB device found in sysfs */
+typedef struct
+{
+    char port[USB_SYSFS_PORT_SIZE];         /* 1-2.4 */
+    char device[TRANSPORT_DEVICE_SIZE];     /* Its node */
+} usb_sysfs_match_t;
+
+/* Prototypes */
+int usb_sysfs_find(int vendor_id, int product_id, usb_sysfs_node_t node,
+                   usb_sysfs_match_t *matches, int max);
+int usb_sysfs_enumerate(int vendor_id, int product_id, usb_sysfs_node_t node,
+                        char devices[][TRANSPORT_DEVICE_SIZE], int max);
+bool usb_sysfs_port(const char *device, char *port, int size);
+bool usb_sysfs_device(const char *port, int vendor_id, int product_id,
+                      const char *like, char *device, int size);
+
+#endif /* USB_SYSFS_H */
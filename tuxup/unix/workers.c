@@ -0,0 +1,243 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+/**
+ *
+ *   @file   workers.c
+ *
+ *   @brief  Programs several dongles at once, one process per dongle.
+ *
+ *   Each worker is a child process that runs the whole programming of one
+ *   dongle, so the state of the dongle connection stays private to it. The
+ *   output of the workers is read through pipes and printed line by line,
+ *   prefixed by the dongle it comes from. Once they are all done, a report
+ *   tells which dongles passed.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "workers.h"
+#include "error.h"
+#include "log.h"
+#include "timer.h"
+
+/* Longest line of output kept together */
+#define WORKER_LINE_SIZE    512
+
+typedef struct
+{
+    const char *device;
+    pid_t pid;
+    int fd;                         /* Output of the worker, -1 at its end */
+    char line[WORKER_LINE_SIZE];    /* Line being received */
+    size_t len;
+    int status;                     /* Exit code */
+    uint64_t end_ms;
+} worker_t;
+
+/* Lock shared by the workers, see workers_lock() */
+static FILE *lock_file = NULL;
+
+/**
+ * \brief Wait until no other worker holds the lock
+ *
+ * Used around the steps that can't tell the dongles apart, like the DFU
+ * programming of fuxusb. Does nothing outside of the workers.
+ */
+void workers_lock(void)
+{
+    fflush(stdout);
+    if (lock_file)
+        lockf(fileno(lock_file), F_LOCK, 0);
+}
+
+/**
+ * \brief Release the lock taken by workers_lock()
+ */
+void workers_unlock(void)
+{
+    if (lock_file)
+        lockf(fileno(lock_file), F_ULOCK, 0);
+}
+
+static void print_line(worker_t *worker)
+{
+    worker->line[worker->len] = '\0';
+    printf("[%s] %s\n", worker->device, worker->line);
+    worker->len = 0;
+}
+
+/**
+ * Print the complete lines received from a worker, keep the rest.
+ * Returns false at the end of its output.
+ */
+static bool read_output(worker_t *worker)
+{
+    char buffer[4096];
+    ssize_t len, i;
+
+    len = read(worker->fd, buffer, sizeof(buffer));
+    for (i = 0; i < len; i++)
+    {
+        if (buffer[i] == '\n')
+            print_line(worker);
+        else if (buffer[i] != '\r')
+        {
+            worker->line[worker->len++] = buffer[i];
+            if (worker->len == WORKER_LINE_SIZE - 1)
+                print_line(worker);
+        }
+    }
+    fflush(stdout);
+    return len > 0;
+}
+
+/**
+ * Run the job of a worker in the child process. Doesn't return.
+ */
+static void run_worker(worker_t *workers, int index, int fd, worker_job_t job)
+{
+    int i;
+
+    for (i = 0; i < index; i++)
+        close(workers[i].fd);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    exit(job(index));
+}
+
+/**
+ * \brief Run a job for each dongle, all at the same time
+ * \param devices  Paths of the dongles
+ * \return E_TUXUP_NOERROR if all the jobs succeeded, otherwise the exit
+ * code of the first dongle that failed
+ */
+int workers_run(char devices[][TRANSPORT_DEVICE_SIZE], int count,
+                worker_job_t job)
+{
+    worker_t workers[WORKERS_MAX];
+    struct pollfd pfd[WORKERS_MAX];
+    int map[WORKERS_MAX];
+    uint64_t start = timer_now_ms();
+    int i, n, status, pipefd[2], ret = E_TUXUP_NOERROR;
+
+    if (count > WORKERS_MAX)
+        count = WORKERS_MAX;
+    lock_file = tmpfile();
+    /* Nothing buffered should be printed twice by the children */
+    fflush(stdout);
+    fflush(stderr);
+
+    for (i = 0; i < count; i++)
+    {
+        memset(&workers[i], 0, sizeof(worker_t));
+        workers[i].device = devices[i];
+        workers[i].fd = -1;
+        workers[i].status = E_TUXUP_USBERROR;
+        if (pipe(pipefd) < 0)
+        {
+            log_error("Unable to start the worker of %s", devices[i]);
+            continue;
+        }
+        workers[i].pid = fork();
+        if (workers[i].pid == 0)
+        {
+            close(pipefd[0]);
+            run_worker(workers, i, pipefd[1], job);
+        }
+        close(pipefd[1]);
+        if (workers[i].pid < 0)
+        {
+            log_error("Unable to start the worker of %s", devices[i]);
+            close(pipefd[0]);
+            continue;
+        }
+        workers[i].fd = pipefd[0];
+    }
+
+    for (;;)
+    {
+        for (i = n = 0; i < count; i++)
+        {
+            if (workers[i].fd < 0)
+                continue;
+            pfd[n].fd = workers[i].fd;
+            pfd[n].events = POLLIN;
+            map[n++] = i;
+        }
+        if (n == 0)
+            break;
+        if (poll(pfd, n, -1) < 0)
+            continue;
+        for (i = 0; i < n; i++)
+        {
+            worker_t *worker = &workers[map[i]];
+
+            if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            if (!read_output(worker))
+            {
+                if (worker->len)
+                    print_line(worker);
+                close(worker->fd);
+                worker->fd = -1;
+                worker->end_ms = timer_now_ms();
+            }
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (workers[i].pid <= 0)
+            continue;
+        if (waitpid(workers[i].pid, &status, 0) == workers[i].pid)
+            workers[i].status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                                  : E_TUXUP_PROGRAMMINGFAILED;
+    }
+    if (lock_file)
+        fclose(lock_file);
+    lock_file = NULL;
+
+    log_notice("\n%-32s %-8s %s", "Dongle", "Result", "Time");
+    for (i = 0; i < count; i++)
+    {
+        if (workers[i].status == E_TUXUP_NOERROR)
+            log_notice("%-32s %-8s %.1f s", workers[i].device, "OK",
+                       (workers[i].end_ms - start) / 1000.0);
+        else
+            log_notice("%-32s FAIL %-3d %.1f s", workers[i].device,
+                       workers[i].status,
+                       workers[i].end_ms
+                       ? (workers[i].end_ms - start) / 1000.0 : 0.0);
+        if (ret == E_TUXUP_NOERROR)
+            ret = workers[i].status;
+    }
+    return ret;
+}
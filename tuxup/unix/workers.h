@@ -0,0 +1,39 @@
+/*
+ * TUXUP - Firmware uploader for tuxdroid
+ * Copyright (C) 2007 C2ME S.A. <tuxdroid@c2me.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* $Id: */
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include "transport.h"
+
+/** Dongles programmed at once */
+#define WORKERS_MAX         32
+
+/** Work done for dongle index, returns an exit code of tuxup */
+typedef int (*worker_job_t)(int index);
+
+/* Prototypes */
+int workers_run(char devices[][TRANSPORT_DEVICE_SIZE], int count,
+                worker_job_t job);
+void workers_lock(void);
+void workers_unlock(void);
+
+#endif /* WORKERS_H */